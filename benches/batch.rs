@@ -0,0 +1,122 @@
+//! Throughput of a batch send compared to a loop of single sends.
+//!
+//! Runs against a simulated notification center: a background thread confirms every
+//! delivered notification the way the delegate does.
+
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use std::collections::HashSet;
+use std::sync::mpsc::{self, Sender};
+use std::sync::{Arc, Mutex};
+use std::thread;
+use std::time::Duration;
+
+use mac_notification_sys::internals::{
+    send_all, Deliver, Delivery, EventLoop, GaveUp, Parker, Waiter,
+};
+use mac_notification_sys::CancelHandle;
+
+/// Confirms every delivery from a background thread, like the delegate on the run loop
+struct SimulatedCenter {
+    pending: Arc<Mutex<HashSet<usize>>>,
+    deliveries: Sender<Arc<Waiter<usize>>>,
+}
+
+impl SimulatedCenter {
+    fn start() -> Self {
+        let pending = Arc::new(Mutex::new(HashSet::new()));
+        let (deliveries, delivered) = mpsc::channel::<Arc<Waiter<usize>>>();
+        let confirmed = Arc::clone(&pending);
+        thread::spawn(move || {
+            for waiter in delivered {
+                if confirmed.lock().unwrap().remove(&address(&waiter)) {
+                    waiter.complete(0);
+                }
+            }
+        });
+        SimulatedCenter {
+            pending,
+            deliveries,
+        }
+    }
+}
+
+fn address(waiter: &Arc<Waiter<usize>>) -> usize {
+    let waiter: *const Waiter<usize> = &**waiter;
+    waiter as usize
+}
+
+impl Deliver<usize, usize> for SimulatedCenter {
+    fn deliver_all(
+        &self,
+        notifications: &[usize],
+        waiters: &[Arc<Waiter<usize>>],
+    ) -> Vec<Delivery> {
+        let mut pending = self.pending.lock().unwrap();
+        for waiter in waiters {
+            pending.insert(address(waiter));
+            self.deliveries.send(Arc::clone(waiter)).unwrap();
+        }
+        vec![Delivery::Delivered; notifications.len()]
+    }
+
+    fn detach_all(&self, waiters: &[Arc<Waiter<usize>>]) {
+        let mut pending = self.pending.lock().unwrap();
+        for waiter in waiters {
+            pending.remove(&address(waiter));
+        }
+    }
+
+    fn response_timeout(&self, _notification: &usize) -> Option<Duration> {
+        None
+    }
+
+    fn cancel_handle<'a>(&self, _notification: &'a usize) -> Option<&'a CancelHandle> {
+        None
+    }
+
+    fn gave_up(
+        &self,
+        _notification: &usize,
+        _waiter: &Arc<Waiter<usize>>,
+        _reason: GaveUp,
+    ) -> usize {
+        unreachable!("notifications are only delivered")
+    }
+}
+
+fn batch_vs_single(c: &mut Criterion) {
+    let event_loop: Arc<dyn EventLoop> = Arc::new(Parker::default());
+    let center = SimulatedCenter::start();
+    let ack_timeout = Duration::from_secs(1);
+
+    let mut group = c.benchmark_group("send");
+    for &count in &[20usize, 200] {
+        let notifications: Vec<usize> = (0..count).collect();
+        group.throughput(Throughput::Elements(count as u64));
+        group.bench_with_input(
+            BenchmarkId::new("single", count),
+            &notifications,
+            |b, notifications| {
+                b.iter(|| {
+                    for notification in notifications.chunks(1) {
+                        send_all(&center, Arc::clone(&event_loop), notification, ack_timeout)
+                            .unwrap();
+                    }
+                })
+            },
+        );
+        group.bench_with_input(
+            BenchmarkId::new("batch", count),
+            &notifications,
+            |b, notifications| {
+                b.iter(|| {
+                    send_all(&center, Arc::clone(&event_loop), notifications, ack_timeout).unwrap()
+                })
+            },
+        );
+    }
+    group.finish();
+}
+
+criterion_group!(benches, batch_vs_single);
+criterion_main!(benches);
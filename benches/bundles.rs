@@ -0,0 +1,138 @@
+//! Startup cost of resolving many application names, one by one compared to in one batch.
+//!
+//! Runs the bundle identifier cache against a simulated AppleScript resolver, which pays for
+//! compiling a script once per script and for looking up an application once per name.
+//! The index is run against a synthetic tree of application bundles.
+
+use criterion::{criterion_group, criterion_main, BatchSize, Criterion};
+use std::env;
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::process;
+use std::sync::Mutex;
+use std::thread;
+use std::time::Duration;
+
+use mac_notification_sys::internals::{AppIndex, BundleCache, Resolve};
+
+const NAMES: usize = 30;
+const BUNDLES: usize = 300;
+/// Compiling and running a script, scaled down from the hundreds of milliseconds it takes
+const SCRIPT_COST: Duration = Duration::from_millis(20);
+/// Asking the system for one application within a script
+const NAME_COST: Duration = Duration::from_millis(2);
+
+/// Pays for one script per call
+struct SimulatedAppleScript;
+
+impl Resolve for SimulatedAppleScript {
+    fn resolve(&self, app_name: &str) -> Option<String> {
+        self.resolve_all(&[app_name]).pop().unwrap_or(None)
+    }
+
+    fn resolve_all(&self, app_names: &[&str]) -> Vec<Option<String>> {
+        thread::sleep(SCRIPT_COST + NAME_COST * app_names.len() as u32);
+        app_names
+            .iter()
+            .map(|app_name| Some(format!("com.example.{}", app_name)))
+            .collect()
+    }
+}
+
+fn names() -> Vec<String> {
+    (0..NAMES).map(|index| format!("App {}", index)).collect()
+}
+
+fn cache() -> Mutex<BundleCache<SimulatedAppleScript>> {
+    Mutex::new(BundleCache::new(SimulatedAppleScript, None))
+}
+
+/// A directory of application bundles with XML property lists
+fn applications(dir: &Path) -> PathBuf {
+    let applications = dir.join("Applications");
+    for index in 0..BUNDLES {
+        let contents = applications.join(format!("App {}.app/Contents", index));
+        fs::create_dir_all(&contents).unwrap();
+        fs::write(
+            contents.join("Info.plist"),
+            format!(
+                "<?xml version=\"1.0\"?>\n<plist version=\"1.0\">\n<dict>\n\t<key>CFBundleIdentifier</key>\n\t<string>com.example.app{}</string>\n\t<key>CFBundleName</key>\n\t<string>App {}</string>\n</dict>\n</plist>\n",
+                index, index
+            ),
+        )
+        .unwrap();
+    }
+    applications
+}
+
+fn bundles(c: &mut Criterion) {
+    let names = names();
+    let names: Vec<&str> = names.iter().map(String::as_str).collect();
+
+    let mut group = c.benchmark_group("bundles");
+    group.sample_size(10);
+    group.bench_function(format!("{} single lookups", NAMES).as_str(), |b| {
+        b.iter_batched(
+            cache,
+            |cache| {
+                names
+                    .iter()
+                    .map(|name| BundleCache::get(&cache, name))
+                    .collect::<Vec<_>>()
+            },
+            BatchSize::PerIteration,
+        )
+    });
+    group.bench_function(format!("{} names in one script", NAMES).as_str(), |b| {
+        b.iter_batched(
+            cache,
+            |cache| BundleCache::get_all(&cache, &names, 1),
+            BatchSize::PerIteration,
+        )
+    });
+    group.bench_function(
+        format!("{} names in 4 scripts in parallel", NAMES).as_str(),
+        |b| {
+            b.iter_batched(
+                cache,
+                |cache| BundleCache::get_all(&cache, &names, 4),
+                BatchSize::PerIteration,
+            )
+        },
+    );
+
+    // the index is kept outside of the directory it indexes, like in the cache directory
+    let dir = env::temp_dir().join(format!("mac-notification-sys-bench-{}", process::id()));
+    let applications = applications(&dir);
+    let file = dir.join("app-index");
+    group.bench_function(format!("index of {} bundles", BUNDLES).as_str(), |b| {
+        b.iter_batched(
+            || {
+                let _ = fs::remove_file(&file);
+                AppIndex::new(vec![applications.clone()], Some(file.clone()))
+            },
+            |mut index| index.lookup("App 0"),
+            BatchSize::PerIteration,
+        )
+    });
+    let mut index = AppIndex::new(vec![applications], Some(file));
+    index.lookup_all(&names);
+    group.bench_function(format!("{} single index lookups", NAMES).as_str(), |b| {
+        b.iter(|| {
+            names
+                .iter()
+                .map(|name| index.lookup(name))
+                .collect::<Vec<_>>()
+        })
+    });
+    group.bench_function(
+        format!("{} names in one index lookup", NAMES).as_str(),
+        |b| b.iter(|| index.lookup_all(&names)),
+    );
+    group.finish();
+
+    fs::remove_dir_all(dir).unwrap();
+}
+
+criterion_group!(benches, bundles);
+criterion_main!(benches);
@@ -0,0 +1,149 @@
+//! Memory and decode time of content images, at full resolution and as thumbnails.
+//!
+//! Runs the image cache against a decoder of synthetic 4K screenshots. Thumbnails are
+//! downsampled row by row while decoding, like ImageIO does, so the full bitmap of a
+//! thumbnail is never allocated. Peak heap usage is counted by the global allocator.
+
+use criterion::{black_box, criterion_group, criterion_main, Criterion};
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::env;
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::process;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex};
+
+use mac_notification_sys::internals::{Decode, ImageCache};
+
+const WIDTH: u32 = 3840;
+const HEIGHT: u32 = 2160;
+const PENDING: usize = 10;
+const MAX_PIXEL_SIZE: u32 = 512;
+
+/// Tracks the bytes currently allocated and the most there ever were
+struct PeakAllocator;
+
+static ALLOCATED: AtomicUsize = AtomicUsize::new(0);
+static PEAK: AtomicUsize = AtomicUsize::new(0);
+
+unsafe impl GlobalAlloc for PeakAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        let allocated = ALLOCATED.fetch_add(layout.size(), Ordering::Relaxed) + layout.size();
+        let mut peak = PEAK.load(Ordering::Relaxed);
+        while allocated > peak {
+            match PEAK.compare_exchange(peak, allocated, Ordering::Relaxed, Ordering::Relaxed) {
+                Ok(_) => break,
+                Err(current) => peak = current,
+            }
+        }
+        System.alloc(layout)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        ALLOCATED.fetch_sub(layout.size(), Ordering::Relaxed);
+        System.dealloc(ptr, layout)
+    }
+}
+
+#[global_allocator]
+static ALLOCATOR: PeakAllocator = PeakAllocator;
+
+/// Decodes every file as the same synthetic screenshot
+struct ScreenshotDecoder;
+
+impl Decode for ScreenshotDecoder {
+    type Image = Arc<Vec<u8>>;
+
+    fn decode(&self, _: &Path, max_pixel_size: Option<u32>) -> Option<(Arc<Vec<u8>>, usize)> {
+        let longest = WIDTH.max(HEIGHT);
+        let scale = max_pixel_size.map_or(1, |max| (longest + max - 1) / max.max(1));
+        let (width, height) = ((WIDTH / scale) as usize, (HEIGHT / scale) as usize);
+        let scale = scale as usize;
+
+        let mut bitmap = vec![0u8; width * height * 4];
+        let mut row = vec![0u32; width * 4];
+        for y in 0..height * scale {
+            for x in 0..width * scale {
+                let pixel = [x as u8, y as u8, (x ^ y) as u8, 0xff];
+                for (sum, channel) in row[x / scale * 4..].iter_mut().zip(&pixel) {
+                    *sum += u32::from(*channel);
+                }
+            }
+            if (y + 1) % scale == 0 {
+                let samples = (scale * scale) as u32;
+                let line = y / scale * width * 4;
+                for (pixel, sum) in bitmap[line..line + width * 4].iter_mut().zip(&mut row) {
+                    *pixel = (*sum / samples) as u8;
+                    *sum = 0;
+                }
+            }
+        }
+        let bytes = bitmap.len();
+        Some((Arc::new(bitmap), bytes))
+    }
+}
+
+fn screenshots() -> Vec<PathBuf> {
+    let dir = env::temp_dir().join(format!("mac-notification-sys-bench-{}", process::id()));
+    fs::create_dir_all(&dir).unwrap();
+    (0..PENDING)
+        .map(|index| {
+            let path = dir.join(format!("screenshot-{}.png", index));
+            fs::write(&path, "png").unwrap();
+            path
+        })
+        .collect()
+}
+
+/// Peak heap bytes while every pending notification holds its content image
+fn peak_memory(paths: &[PathBuf], max_pixel_size: Option<u32>) -> usize {
+    let mut cache = ImageCache::new(ScreenshotDecoder, usize::max_value());
+    cache.set_max_pixel_size(max_pixel_size);
+    let cache = Mutex::new(cache);
+    let baseline = ALLOCATED.load(Ordering::Relaxed);
+    PEAK.store(baseline, Ordering::Relaxed);
+    let pending: Vec<_> = paths
+        .iter()
+        .map(|path| ImageCache::get(&cache, path))
+        .collect();
+    let peak = PEAK.load(Ordering::Relaxed) - baseline;
+    drop(pending);
+    peak
+}
+
+fn images(c: &mut Criterion) {
+    let paths = screenshots();
+    let mebibytes = |bytes: usize| bytes as f64 / (1024. * 1024.);
+    println!(
+        "images/peak memory of {} pending {}x{} screenshots: {:.1} MiB at full resolution, {:.1} MiB as {} px thumbnails",
+        PENDING,
+        WIDTH,
+        HEIGHT,
+        mebibytes(peak_memory(&paths, None)),
+        mebibytes(peak_memory(&paths, Some(MAX_PIXEL_SIZE))),
+        MAX_PIXEL_SIZE,
+    );
+
+    let mut group = c.benchmark_group("images");
+    group.sample_size(10);
+    group.bench_function("decode full resolution", |b| {
+        b.iter(|| ScreenshotDecoder.decode(black_box(&paths[0]), None))
+    });
+    group.bench_function("decode thumbnail", |b| {
+        b.iter(|| ScreenshotDecoder.decode(black_box(&paths[0]), Some(MAX_PIXEL_SIZE)))
+    });
+
+    let mut cache = ImageCache::new(ScreenshotDecoder, usize::max_value());
+    cache.set_max_pixel_size(Some(MAX_PIXEL_SIZE));
+    let cache = Mutex::new(cache);
+    ImageCache::get(&cache, &paths[0]);
+    group.bench_function("cached thumbnail", |b| {
+        b.iter(|| ImageCache::get(&cache, black_box(&paths[0])))
+    });
+    group.finish();
+
+    fs::remove_dir_all(paths[0].parent().unwrap()).unwrap();
+}
+
+criterion_group!(benches, images);
+criterion_main!(benches);
@@ -0,0 +1,43 @@
+//! Cost of marshalling notification options for the Objective C side.
+//!
+//! Covers the Rust half of a send: copying the options on the sending thread and
+//! borrowing them as the C layout struct for the FFI call.
+
+use criterion::{black_box, criterion_group, criterion_main, Criterion};
+
+use mac_notification_sys::{MainButton, Notification};
+
+fn marshal(c: &mut Criterion) {
+    let actions = ["Approve", "Reject", "Snooze", "Escalate"];
+    let mut notification = Notification::new();
+    notification
+        .main_button(MainButton::DropdownActions("Review", &actions))
+        .close_button("Later")
+        .app_icon("/Applications/Safari.app/Contents/Resources/AppIcon.icns")
+        .content_image("/tmp/preview.png")
+        .delivery_date(1.7e9)
+        .sound("Blow")
+        .asynchronous(false);
+
+    let mut group = c.benchmark_group("options");
+    group.bench_function("copy and borrow", |b| {
+        b.iter(|| {
+            let options = black_box(&notification).to_options();
+            let actions = options.raw_actions();
+            black_box(options.as_raw(&actions).action_count)
+        })
+    });
+
+    let options = notification.to_options();
+    group.bench_function("borrow", |b| {
+        b.iter(|| {
+            let options = black_box(&options);
+            let actions = options.raw_actions();
+            black_box(options.as_raw(&actions).action_count)
+        })
+    });
+    group.finish();
+}
+
+criterion_group!(benches, marshal);
+criterion_main!(benches);
@@ -0,0 +1,122 @@
+//! Recovery time and write amplification of the outbox of scheduled notifications.
+//!
+//! Runs the outbox alone on a temporary file: a steady state of pending notifications is
+//! kept through many deliveries, then the file is replayed as on startup. Write amplification
+//! is the bytes the process passed to `write`, from `/proc/self/io` on Linux, over the bytes of
+//! the records it appended.
+
+use criterion::{criterion_group, criterion_main, BatchSize, Criterion};
+use std::collections::VecDeque;
+use std::env;
+use std::fs;
+use std::path::Path;
+use std::process;
+
+use mac_notification_sys::internals::Outbox;
+
+const PENDING: usize = 10_000;
+const ROUNDS: usize = 100_000;
+/// About what a notification with a title, a message, two actions and a sound takes
+const PAYLOAD: usize = 256;
+/// The length, checksum, kind, id and due time in front of the payload of every record
+const RECORD_OVERHEAD: usize = 29;
+/// Schedules that are flushed to the disk one by one
+const SYNCED: usize = 100;
+
+/// Schedule `PENDING` notifications, then keep that many pending for `rounds`: every round
+/// delivers the notification due first, which is due again if it is one of a series and
+/// replaced by a new one otherwise. Returns the bytes of the records appended.
+fn workload(outbox: &mut Outbox, rounds: usize) -> u64 {
+    let payload = vec![0x5a; PAYLOAD];
+    let mut pending = VecDeque::new();
+    for due in 0..PENDING as u64 {
+        pending.push_back((outbox.schedule(due, payload.clone()).unwrap(), due));
+    }
+    let mut appended = (PENDING * (RECORD_OVERHEAD + PAYLOAD)) as u64;
+    for round in 0..rounds {
+        let (id, due) = pending.pop_front().unwrap();
+        let next = due + PENDING as u64;
+        if round % 10 == 0 {
+            outbox.delivered(id, Some(next)).unwrap();
+            pending.push_back((id, next));
+            appended += RECORD_OVERHEAD as u64;
+        } else {
+            outbox.delivered(id, None).unwrap();
+            pending.push_back((outbox.schedule(next, payload.clone()).unwrap(), next));
+            appended += (2 * RECORD_OVERHEAD + PAYLOAD) as u64;
+        }
+    }
+    appended
+}
+
+/// Bytes the process passed to `write` so far, `None` where `/proc/self/io` is missing
+fn written() -> Option<u64> {
+    let io = fs::read_to_string("/proc/self/io").ok()?;
+    let line = io.lines().find(|line| line.starts_with("wchar:"))?;
+    line["wchar:".len()..].trim().parse().ok()
+}
+
+fn fresh(file: &Path, sync: bool) -> Outbox {
+    let _ = fs::remove_file(file);
+    Outbox::open(file.to_path_buf(), sync).unwrap()
+}
+
+fn outbox(c: &mut Criterion) {
+    let dir = env::temp_dir().join(format!("mac-notification-sys-bench-{}", process::id()));
+    let file = dir.join("outbox");
+    let recovered = dir.join("recovered");
+
+    let mut outbox = fresh(&file, false);
+    let before = written();
+    let appended = workload(&mut outbox, ROUNDS);
+    match (before, written()) {
+        (Some(before), Some(after)) => println!(
+            "outbox/write amplification of {} rounds on {} pending: {:.2} ({} bytes written for {} bytes of records), {} KiB left on disk",
+            ROUNDS,
+            PENDING,
+            (after - before) as f64 / appended as f64,
+            after - before,
+            appended,
+            fs::metadata(&file).unwrap().len() / 1024,
+        ),
+        _ => println!("outbox/write amplification: /proc/self/io is not available"),
+    }
+    drop(outbox);
+
+    let mut group = c.benchmark_group("outbox");
+    group.sample_size(10);
+    group.bench_function(
+        format!("{} rounds on {} pending", ROUNDS, PENDING).as_str(),
+        |b| {
+            b.iter_batched(
+                || fresh(&recovered, false),
+                |mut outbox| workload(&mut outbox, ROUNDS),
+                BatchSize::PerIteration,
+            )
+        },
+    );
+    group.bench_function(format!("recover {} pending", PENDING).as_str(), |b| {
+        b.iter_batched(
+            || fs::copy(&file, &recovered).unwrap(),
+            |_| Outbox::open(recovered.clone(), false).unwrap(),
+            BatchSize::PerIteration,
+        )
+    });
+    group.bench_function(format!("{} synced schedules", SYNCED).as_str(), |b| {
+        b.iter_batched(
+            || fresh(&recovered, true),
+            |mut outbox| {
+                for due in 0..SYNCED as u64 {
+                    outbox.schedule(due, vec![0x5a; PAYLOAD]).unwrap();
+                }
+            },
+            BatchSize::PerIteration,
+        )
+    });
+    group.finish();
+
+    fs::remove_dir_all(dir).unwrap();
+}
+
+criterion_group!(benches, outbox);
+criterion_main!(benches);
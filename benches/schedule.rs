@@ -0,0 +1,158 @@
+//! Cost of keeping many recurring notifications scheduled.
+//!
+//! Compares finding the next fire time of calendar patterns with the bit sets of the
+//! recurrence to scanning the calendar minute by minute, and runs a day of virtual time for
+//! series held in the timing wheel, which only ever holds the next instance of each.
+
+use chrono::{Datelike, TimeZone, Timelike, Utc, Weekday};
+use criterion::{black_box, criterion_group, criterion_main, BatchSize, Criterion};
+use std::time::Duration;
+
+use mac_notification_sys::internals::TimerWheel;
+use mac_notification_sys::{CalendarPattern, Recurrence};
+
+const SERIES: usize = 10_000;
+/// Series scanned minute by minute, a fraction of `SERIES` to keep the run short
+const SCANNED: usize = 100;
+const START: u64 = 1_600_000_000_000;
+const DAY: u64 = 24 * 3600 * 1000;
+const WEEKDAYS: [Weekday; 7] = [
+    Weekday::Mon,
+    Weekday::Tue,
+    Weekday::Wed,
+    Weekday::Thu,
+    Weekday::Fri,
+    Weekday::Sat,
+    Weekday::Sun,
+];
+
+/// A minute, an hour and a weekday, like a weekly reminder
+#[derive(Clone, Copy)]
+struct Weekly {
+    minute: u32,
+    hour: u32,
+    weekday: usize,
+}
+
+impl Weekly {
+    fn recurrence(self) -> Recurrence {
+        Recurrence::Calendar(
+            CalendarPattern::new()
+                .minutes(&[self.minute])
+                .hours(&[self.hour])
+                .weekdays(&[WEEKDAYS[self.weekday]]),
+        )
+    }
+
+    /// The next matching minute, by checking every minute after `after`
+    fn scan(self, after: u64) -> u64 {
+        let mut minute = after / 60_000 + 1;
+        loop {
+            let time = Utc.timestamp_opt(minute as i64 * 60, 0).single().unwrap();
+            if time.minute() == self.minute
+                && time.hour() == self.hour
+                && time.weekday() == WEEKDAYS[self.weekday]
+            {
+                return minute * 60_000;
+            }
+            minute += 1;
+        }
+    }
+}
+
+fn weekly(count: usize) -> Vec<Weekly> {
+    (0..count)
+        .map(|index| Weekly {
+            minute: (index * 7 % 60) as u32,
+            hour: (index * 5 % 24) as u32,
+            weekday: index % 7,
+        })
+        .collect()
+}
+
+/// Half of the series repeat every one to sixty minutes, the other half weekly
+fn series() -> Vec<Recurrence> {
+    weekly(SERIES)
+        .into_iter()
+        .enumerate()
+        .map(|(index, weekly)| match index % 2 {
+            0 => Recurrence::Every(Duration::from_secs(60 * (index as u64 % 60 + 1))),
+            _ => weekly.recurrence(),
+        })
+        .collect()
+}
+
+/// A wheel holding the first instance of every series, with the time it is due
+fn wheel(series: &[Recurrence]) -> TimerWheel<(usize, u64)> {
+    let mut wheel = TimerWheel::new(START);
+    for (index, recurrence) in series.iter().enumerate() {
+        let due = recurrence.next_after(START, None, &Utc).unwrap();
+        wheel.insert(due, (index, due));
+    }
+    wheel
+}
+
+/// Advance the wheel through a day in steps of a second, putting every series back for its
+/// next instance, and return how many instances fired
+fn run_day(wheel: &mut TimerWheel<(usize, u64)>, series: &[Recurrence]) -> usize {
+    let mut fired = 0;
+    let mut now = START;
+    while now < START + DAY {
+        now += 1000;
+        for (key, (index, due)) in wheel.expire(now) {
+            fired += 1;
+            let next = series[index].next_after(now, Some(due), &Utc);
+            wheel.settle(key, (index, next.unwrap_or(0)), next);
+        }
+    }
+    fired
+}
+
+fn schedule(c: &mut Criterion) {
+    let weekly = weekly(SERIES);
+    let recurrences: Vec<Recurrence> = weekly.iter().map(|weekly| weekly.recurrence()).collect();
+    for (weekly, recurrence) in weekly.iter().zip(&recurrences).take(SCANNED) {
+        assert_eq!(
+            recurrence.next_after(START, None, &Utc),
+            Some(weekly.scan(START))
+        );
+    }
+
+    let mut group = c.benchmark_group("schedule");
+    group.sample_size(10);
+    group.bench_function(
+        format!("next fire of {} weekly patterns", SERIES).as_str(),
+        |b| {
+            b.iter(|| {
+                recurrences
+                    .iter()
+                    .map(|recurrence| recurrence.next_after(black_box(START), None, &Utc))
+                    .collect::<Vec<_>>()
+            })
+        },
+    );
+    group.bench_function(
+        format!("next fire of {} weekly patterns by minute scan", SCANNED).as_str(),
+        |b| {
+            b.iter(|| {
+                weekly[..SCANNED]
+                    .iter()
+                    .map(|weekly| weekly.scan(black_box(START)))
+                    .collect::<Vec<_>>()
+            })
+        },
+    );
+
+    let series = series();
+    group.bench_function(format!("a day of {} series", SERIES).as_str(), |b| {
+        b.iter_batched(
+            || wheel(&series),
+            |mut wheel| run_day(&mut wheel, &series),
+            BatchSize::PerIteration,
+        )
+    });
+    group.finish();
+}
+
+criterion_group!(benches, schedule);
+criterion_main!(benches);
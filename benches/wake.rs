@@ -0,0 +1,52 @@
+//! Latency of waking a waiting sender from a delegate callback, or by cancelling it.
+//!
+//! Runs without the notification center: a fake delegate thread completes the waiter or
+//! cancels it, and a `Parker` stands in for the run loop.
+
+use criterion::{criterion_group, criterion_main, Criterion};
+use std::sync::mpsc;
+use std::sync::Arc;
+use std::thread;
+
+use mac_notification_sys::internals::{EventLoop, Parker, Waiter};
+use mac_notification_sys::CancelHandle;
+
+fn wake_from_delegate(c: &mut Criterion) {
+    let event_loop: Arc<dyn EventLoop> = Arc::new(Parker::default());
+    let (to_delegate, delegate_inbox) = mpsc::channel::<Arc<Waiter<u32>>>();
+    thread::spawn(move || {
+        for waiter in delegate_inbox {
+            waiter.complete(1);
+        }
+    });
+
+    c.bench_function("wake from delegate", |b| {
+        b.iter(|| {
+            let waiter = Arc::new(Waiter::new(Arc::clone(&event_loop)));
+            to_delegate.send(Arc::clone(&waiter)).unwrap();
+            waiter.wait(None)
+        })
+    });
+}
+
+fn cancel_from_another_thread(c: &mut Criterion) {
+    let event_loop: Arc<dyn EventLoop> = Arc::new(Parker::default());
+    let (to_canceller, canceller_inbox) = mpsc::channel::<CancelHandle>();
+    thread::spawn(move || {
+        for cancel in canceller_inbox {
+            cancel.cancel();
+        }
+    });
+
+    c.bench_function("cancel from another thread", |b| {
+        b.iter(|| {
+            let cancel = CancelHandle::new();
+            let waiter = Waiter::<u32>::new(Arc::clone(&event_loop));
+            to_canceller.send(cancel.clone()).unwrap();
+            cancel.wait(&waiter, None)
+        })
+    });
+}
+
+criterion_group!(benches, wake_from_delegate, cancel_from_another_thread);
+criterion_main!(benches);
@@ -1,4 +1,5 @@
 use mac_notification_sys::*;
+use std::time::Duration;
 
 fn main() {
     let bundle = get_bundle_identifier_or_default("firefox");
@@ -13,19 +14,22 @@ fn main() {
                     "Dropdown",
                     &["Action 1", "Action 2"],
                 ))
-                .close_button("Nevermind..."),
+                .close_button("Nevermind...")
+                .timeout(Duration::from_secs(60)),
         ),
     )
     .unwrap();
 
     match response {
-        // Requires main_button to be a MainButton::SingleAction or MainButton::DropdownActions
+        // Requires main_button to be a MainButton::SingleAction
         NotificationResponse::ActionButton(action_name) => {
-            if action_name == "Action 1" {
-                println!("Clicked on Action 1")
-            } else if action_name == "Action 2" {
-                println!("Clicked on Action 2")
-            }
+            println!("Clicked on the action button called {}", action_name)
+        }
+        // Requires main_button to be a MainButton::DropdownActions, the index is into its actions
+        NotificationResponse::DropdownAction(0, _) => println!("Clicked on Action 1"),
+        NotificationResponse::DropdownAction(1, _) => println!("Clicked on Action 2"),
+        NotificationResponse::DropdownAction(_, action_name) => {
+            println!("Clicked on {}", action_name)
         }
         NotificationResponse::Click => println!("Clicked on the notification itself"),
         NotificationResponse::CloseButton(close_name) => println!(
@@ -36,6 +40,12 @@ fn main() {
         NotificationResponse::Reply(response) => {
             println!("Replied to the notification with {}", response)
         }
+        // Requires a timeout
+        NotificationResponse::TimedOut => println!("Nobody responded within a minute"),
+        // Requires a cancel handle
+        NotificationResponse::Cancelled => println!("Cancelled from another thread"),
+        // Requires a delivery date
+        NotificationResponse::Scheduled(_) => println!("Scheduled for later"),
         NotificationResponse::None => println!("No interaction with the notification occured"),
     };
 }
@@ -6,11 +6,15 @@ fn main() {
     println!("{:?}", stamp);
     let bundle = get_bundle_identifier_or_default("firefox");
     set_application(&bundle).unwrap();
-    send_notification(
+    let response = send_notification(
         "Danger",
         Some("Will Robinson"),
         "Run away as fast as you can",
         Some(Notification::new().sound("Blow").delivery_date(stamp + 5.)),
     )
     .unwrap();
+    // The notification is held by this process until it is due
+    if let NotificationResponse::Scheduled(handle) = response {
+        handle.wait();
+    }
 }
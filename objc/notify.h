@@ -1,6 +1,7 @@
 #import <Cocoa/Cocoa.h>
 #import <CoreServices/CoreServices.h>
 #import <Foundation/Foundation.h>
+#import <ImageIO/ImageIO.h>
 #import <objc/runtime.h>
 
 NSString* fakeBundleIdentifier = nil;
@@ -19,6 +20,8 @@ NSString* fakeBundleIdentifier = nil;
 }
 @end
 
+// installNSBundleHook() -> bool
+// Not idempotent, a second exchange removes the hook again. Only called through the guard on the Rust side.
 BOOL installNSBundleHook()
 {
     Class class = objc_getClass("NSBundle");
@@ -31,28 +34,285 @@ BOOL installNSBundleHook()
     return NO;
 }
 
+// Result of sendNotifications for every notification, tells the caller how long to wait on the delegate
+typedef NS_ENUM(NSInteger, NotificationDelivery) {
+    NotificationDeliveryFailed = -1,
+    NotificationDeliveryDelivered = 0,
+    NotificationDeliveryAwaitingResponse = 1,
+};
+
+// A UTF-8 string borrowed from the Rust side, RawStr there. data is NULL for none
+typedef struct
+{
+    const char* data;
+    NSUInteger length;
+} RustStr;
+
+// A byte buffer shared with the Rust side, RawBytes there. data is NULL for none
+typedef struct
+{
+    const uint8_t* data;
+    NSUInteger length;
+} RustBytes;
+
+// Options of a notification, RawOptions on the Rust side
+typedef struct
+{
+    RustStr mainButtonLabel;
+    const RustStr* actions;
+    NSUInteger actionCount;
+    RustStr closeButtonLabel;
+    RustStr appIcon;
+    RustStr contentImage;
+    // Encoded images, take precedence over appIcon and contentImage
+    RustBytes appIconBytes;
+    RustBytes contentImageBytes;
+    // Images decoded by the image cache of the Rust side, nil to load appIcon and contentImage
+    NSImage* decodedAppIcon;
+    NSImage* decodedContentImage;
+    // Images that are not decoded yet are scaled down to this size, 0 for full resolution
+    NSUInteger maxImagePixelSize;
+    RustStr sound;
+    double deliveryDate;
+    bool isScheduled;
+    bool isResponse;
+    bool isAsynchronous;
+} NotificationOptions;
+
+// How the user interacted with a notification
+typedef NS_ENUM(NSInteger, NotificationActivationType) {
+    NotificationActivationNone = 0,
+    NotificationActivationActionClicked = 1,
+    NotificationActivationCloseClicked = 2,
+    NotificationActivationContentsClicked = 3,
+    NotificationActivationReplied = 4,
+};
+
+static const NSInteger NotificationNoAction = -1;
+
+// The response to a notification, RawResponse on the Rust side
+typedef struct
+{
+    NotificationActivationType type;
+    // Index of the dropdown action that was clicked, NotificationNoAction otherwise
+    NSInteger actionIndex;
+    // Borrowed for the duration of notificationDidComplete
+    RustStr value;
+} NotificationActivation;
+
+// Implemented on the Rust side, hands the response to the waiting thread and wakes it up
+extern void notificationDidComplete(const void* waiter, const NotificationActivation* activation);
+// Implemented on the Rust side, drops the reference to the waiter held by a PendingNotification
+extern void notificationWaiterRelease(const void* waiter);
+// Implemented on the Rust side, keep a buffer passed as RustBytes alive until it is released again
+extern void imageBytesRetain(const uint8_t* data, NSUInteger length);
+extern void imageBytesRelease(const uint8_t* data, NSUInteger length);
+
+// Borrow the UTF-8 contents of an autoreleased string
+static NotificationActivation activationWithValue(NotificationActivationType type, NSString* value, NSInteger actionIndex)
+{
+    NotificationActivation activation = {type, actionIndex, {NULL, 0}};
+    if (value)
+    {
+        activation.value.data = value.UTF8String;
+        activation.value.length = [value lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+    }
+    return activation;
+}
+
+static NotificationActivation activationWithType(NotificationActivationType type)
+{
+    return activationWithValue(type, nil, NotificationNoAction);
+}
+
+// Autoreleased copy of a Rust string, nil for none
+static NSString* stringFromRust(RustStr string)
+{
+    if (!string.data)
+    {
+        return nil;
+    }
+    return [[[NSString alloc] initWithBytes:string.data length:string.length encoding:NSUTF8StringEncoding] autorelease];
+}
+
+// A NotificationCenter on the Rust side, tags the notifications sent through it
+@interface NotificationSession : NSObject
+@end
+
+@implementation NotificationSession
+@end
+
+// A delivered notification the delegate still has to report back on
+@interface PendingNotification : NSObject
+@property(nonatomic, assign) BOOL awaitsInteraction;
+@property(nonatomic, assign) const void* waiter;
+@property(nonatomic, assign) NotificationSession* session;
+@end
+
+@implementation PendingNotification
+- (void)dealloc
+{
+    notificationWaiterRelease(_waiter);
+    [super dealloc];
+}
+@end
+
+// Only one delegate is ever installed, it is shared by all sessions of the process.
+// Callbacks are routed to the waiter of a notification by its identifier.
 @interface NotificationCenterDelegate : NSObject <NSUserNotificationCenterDelegate>
-@property(nonatomic, assign) BOOL keepRunning;
-@property(nonatomic, retain) NSDictionary* actionData;
+@property(nonatomic, retain) NSMutableDictionary<NSString*, PendingNotification*>* pending;
+@property(nonatomic, retain) NSMutableDictionary<NSValue*, NSString*>* identifiersByWaiter;
+@property(nonatomic, assign) NSUserNotificationCenter* center;
++ (instancetype)shared;
+- (PendingNotification*)pendingForIdentifier:(NSString*)identifier;
+- (void)addPending:(PendingNotification*)pending forIdentifier:(NSString*)identifier;
+- (void)finishIdentifier:(NSString*)identifier withActivation:(NotificationActivation)activation;
+- (void)finishSession:(NotificationSession*)session withActivation:(NotificationActivation)activation;
+- (void)detachWaiter:(const void*)waiter;
+- (NSString*)identifierForWaiter:(const void*)waiter;
 @end
 
 // Delegate to respond to events in the NSUserNotificationCenter
 // See https://developer.apple.com/documentation/foundation/nsusernotificationcenterdelegate?language=objc
 @implementation NotificationCenterDelegate
++ (instancetype)shared
+{
+    static NotificationCenterDelegate* shared = nil;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+      shared = [[NotificationCenterDelegate alloc] init];
+      shared.center = [NSUserNotificationCenter defaultUserNotificationCenter];
+    });
+    return shared;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self)
+    {
+        _pending = [[NSMutableDictionary alloc] init];
+        _identifiersByWaiter = [[NSMutableDictionary alloc] init];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [_pending release];
+    [_identifiersByWaiter release];
+    [super dealloc];
+}
+
+// Sessions on different threads send through the same delegate, every access to the maps is locked
+
+- (PendingNotification*)pendingForIdentifier:(NSString*)identifier
+{
+    @synchronized(self)
+    {
+        return [[self.pending[identifier] retain] autorelease];
+    }
+}
+
+// Replaces the pending notification of the same identifier, whose waiter is no longer reported back on
+- (void)addPending:(PendingNotification*)pending forIdentifier:(NSString*)identifier
+{
+    @synchronized(self)
+    {
+        [self removeIdentifier:identifier];
+        self.pending[identifier] = pending;
+        self.identifiersByWaiter[[NSValue valueWithPointer:pending.waiter]] = identifier;
+    }
+}
+
+// Callers hold the lock
+- (void)removeIdentifier:(NSString*)identifier
+{
+    PendingNotification* pending = self.pending[identifier];
+    if (pending)
+    {
+        [self.identifiersByWaiter removeObjectForKey:[NSValue valueWithPointer:pending.waiter]];
+        [self.pending removeObjectForKey:identifier];
+    }
+}
+
+// Wake the thread waiting on the notification with the response, at most once
+- (void)finish:(NSUserNotification*)notification withActivation:(NotificationActivation)activation
+{
+    [self finishIdentifier:notification.identifier withActivation:activation];
+}
+
+- (void)finishIdentifier:(NSString*)identifier withActivation:(NotificationActivation)activation
+{
+    @synchronized(self)
+    {
+        PendingNotification* pending = self.pending[identifier];
+        if (pending)
+        {
+            notificationDidComplete(pending.waiter, &activation);
+            [self removeIdentifier:identifier];
+        }
+    }
+}
+
+// Wake every waiter of the session that is still pending, e.g. when the session goes away
+- (void)finishSession:(NotificationSession*)session withActivation:(NotificationActivation)activation
+{
+    @synchronized(self)
+    {
+        for (NSString* identifier in self.pending.allKeys)
+        {
+            if (self.pending[identifier].session == session)
+            {
+                [self finishIdentifier:identifier withActivation:activation];
+            }
+        }
+    }
+}
+
+- (NSString*)identifierForWaiter:(const void*)waiter
+{
+    @synchronized(self)
+    {
+        return [[self.identifiersByWaiter[[NSValue valueWithPointer:waiter]] retain] autorelease];
+    }
+}
+
+// Stop reporting back on a waiter without completing it
+- (void)detachWaiter:(const void*)waiter
+{
+    @synchronized(self)
+    {
+        NSString* identifier = self.identifiersByWaiter[[NSValue valueWithPointer:waiter]];
+        if (identifier)
+        {
+            [self removeIdentifier:identifier];
+        }
+    }
+}
+
 - (void)userNotificationCenter:(NSUserNotificationCenter*)center didDeliverNotification:(NSUserNotification*)notification
 {
-    // Stop running if we're not expecting a response
-    if (!notification.hasActionButton && !notification.hasReplyButton)
+    // Stop waiting if we're not expecting a response
+    PendingNotification* pending = [self pendingForIdentifier:notification.identifier];
+    if (pending && !pending.awaitsInteraction)
     {
-        self.keepRunning = NO;
+        [self finish:notification withActivation:activationWithType(NotificationActivationNone)];
     }
 }
 
 // Most typical actions
 - (void)userNotificationCenter:(NSUserNotificationCenter*)center didActivateNotification:(NSUserNotification*)notification
 {
-    unsigned long long additionalActionIndex = ULLONG_MAX;
+    // Callbacks can still arrive for notifications that are no longer waited on
+    if (![self pendingForIdentifier:notification.identifier])
+    {
+        return;
+    }
+
+    NSInteger additionalActionIndex = NotificationNoAction;
     NSString* ActionsClicked = @"";
+    NotificationActivation actionData;
 
     // Switch on how the notification was interacted with
     // See https://developer.apple.com/documentation/foundation/nsusernotification/1416143-activationtype?language=objc
@@ -64,39 +324,40 @@ BOOL installNSBundleHook()
             if ([[(NSObject*)notification valueForKey:@"_alternateActionButtonTitles"] count] > 1)
             {
                 NSNumber* alternateActionIndex = [(NSObject*)notification valueForKey:@"_alternateActionIndex"];
-                additionalActionIndex = [alternateActionIndex unsignedLongLongValue];
+                // The titles are the actions array of the options, so this is the index into the Rust slice
+                additionalActionIndex = [alternateActionIndex integerValue];
                 ActionsClicked = [(NSObject*)notification valueForKey:@"_alternateActionButtonTitles"][additionalActionIndex];
 
-                self.actionData = @{@"activationType" : @"actionClicked", @"activationValue" : ActionsClicked, @"activationValueIndex" : [NSString stringWithFormat:@"%llu", additionalActionIndex]};
+                actionData = activationWithValue(NotificationActivationActionClicked, ActionsClicked, additionalActionIndex);
             }
             else
             {
-                self.actionData = @{@"activationType" : @"actionClicked", @"activationValue" : notification.actionButtonTitle};
+                actionData = activationWithValue(NotificationActivationActionClicked, notification.actionButtonTitle, NotificationNoAction);
             }
             break;
         }
 
         case NSUserNotificationActivationTypeContentsClicked:
         {
-            self.actionData = @{@"activationType" : @"contentsClicked"};
+            actionData = activationWithType(NotificationActivationContentsClicked);
             break;
         }
 
         case NSUserNotificationActivationTypeReplied:
         {
-            self.actionData = @{@"activationType" : @"replied", @"activationValue" : notification.response.string};
+            actionData = activationWithValue(NotificationActivationReplied, notification.response.string, NotificationNoAction);
             break;
         }
         case NSUserNotificationActivationTypeNone:
         default:
         {
-            self.actionData = @{@"activationType" : @"none"};
+            actionData = activationWithType(NotificationActivationNone);
             break;
         }
     }
 
-    // Stop running after interacting with the notification
-    self.keepRunning = NO;
+    // Wake the waiting thread after interacting with the notification
+    [self finish:notification withActivation:actionData];
 
     // Force-close the notification after interacting with it
     [center removeDeliveredNotification:notification];
@@ -105,18 +366,22 @@ BOOL installNSBundleHook()
 // Specific to the close/other button
 - (void)userNotificationCenter:(NSUserNotificationCenter*)center didDismissAlert:(NSUserNotification*)notification
 {
-    self.actionData = @{@"activationType" : @"closeClicked", @"activationValue" : notification.otherButtonTitle};
+    // Callbacks can still arrive for notifications that are no longer waited on
+    if (![self pendingForIdentifier:notification.identifier])
+    {
+        return;
+    }
 
-    // Stop running after interacting with the notification
-    self.keepRunning = NO;
+    // Wake the waiting thread after interacting with the notification
+    [self finish:notification withActivation:activationWithValue(NotificationActivationCloseClicked, notification.otherButtonTitle, NotificationNoAction)];
 
     // Force-close the notification after interacting with it
     [center removeDeliveredNotification:notification];
 }
 @end
 
-// Utility function to create an NSImage from an url
-NSImage* getImageFromURL(NSString* url)
+// The URL of an image given as an url or a path
+static NSURL* imageURLFromString(NSString* url)
 {
     NSURL* imageURL = [NSURL URLWithString:url];
     if ([[imageURL scheme] length] == 0)
@@ -124,5 +389,208 @@ NSImage* getImageFromURL(NSString* url)
         // Prefix 'file://' if no scheme
         imageURL = [NSURL fileURLWithPath:url];
     }
-    return [[NSImage alloc] initWithContentsOfURL:imageURL];
-}
\ No newline at end of file
+    return imageURL;
+}
+
+// Decodes the image at most maxPixelSize wide and high, without decoding it at full size first.
+// Returns a retained image or nil
+static NSImage* thumbnailFromData(NSData* data, NSUInteger maxPixelSize)
+{
+    if (!data)
+    {
+        return nil;
+    }
+    CGImageSourceRef source = CGImageSourceCreateWithData((CFDataRef)data, NULL);
+    if (!source)
+    {
+        return nil;
+    }
+    NSDictionary* thumbnailOptions = @{
+        (id)kCGImageSourceCreateThumbnailFromImageAlways : @YES,
+        (id)kCGImageSourceCreateThumbnailWithTransform : @YES,
+        (id)kCGImageSourceShouldCacheImmediately : @YES,
+        (id)kCGImageSourceThumbnailMaxPixelSize : @(maxPixelSize),
+    };
+    CGImageRef thumbnail = CGImageSourceCreateThumbnailAtIndex(source, 0, (CFDictionaryRef)thumbnailOptions);
+    CFRelease(source);
+    if (!thumbnail)
+    {
+        return nil;
+    }
+    NSImage* image = [[NSImage alloc] initWithCGImage:thumbnail size:NSZeroSize];
+    CGImageRelease(thumbnail);
+    return image;
+}
+
+// Scaled down to maxPixelSize if it is not 0, returns a retained image or nil
+static NSImage* imageFromURL(NSURL* url, NSUInteger maxPixelSize)
+{
+    if (maxPixelSize == 0)
+    {
+        return [[NSImage alloc] initWithContentsOfURL:url];
+    }
+    // Mapped files are paged in by the decoder instead of being read up front
+    return thumbnailFromData([NSData dataWithContentsOfURL:url options:NSDataReadingMappedIfSafe error:nil], maxPixelSize);
+}
+
+// loadImage(path: &str, max_pixel_size: usize) -> NSImage
+// Decodes the image file for the image cache, returns a retained image or nil
+NSImage* loadImage(NSString* path, NSUInteger maxPixelSize)
+{
+    NSImage* image = imageFromURL([NSURL fileURLWithPath:path], maxPixelSize);
+    // Decode the bitmap now instead of on first draw, so the cost is known and paid once
+    [image CGImageForProposedRect:NULL context:nil hints:nil];
+    return image;
+}
+
+// imageByteCost(image: &NSImage) -> usize
+// Bytes the decoded representations of the image take, 4 bytes per pixel
+NSUInteger imageByteCost(NSImage* image)
+{
+    NSUInteger bytes = 0;
+    for (NSImageRep* representation in image.representations)
+    {
+        bytes += (NSUInteger)representation.pixelsWide * (NSUInteger)representation.pixelsHigh * 4;
+    }
+    if (bytes == 0)
+    {
+        // Vector images have no pixel size, count them at their point size
+        bytes = (NSUInteger)(image.size.width * image.size.height * 4);
+    }
+    return bytes;
+}
+
+// Autoreleased NSData around a Rust buffer, without copying it. nil for none
+// The buffer stays alive as long as the NSData, which may outlive the notification that was sent with it
+static NSData* dataFromRust(RustBytes bytes)
+{
+    if (!bytes.data)
+    {
+        return nil;
+    }
+    imageBytesRetain(bytes.data, bytes.length);
+    return [[[NSData alloc] initWithBytesNoCopy:(void*)bytes.data
+                                         length:bytes.length
+                                    deallocator:^(void* data, NSUInteger length) {
+                                        imageBytesRelease(data, length);
+                                    }] autorelease];
+}
+
+// The autoreleased image of an app icon or content image, from its bytes, the image cache or its URL, in that order.
+// Images that are not decoded yet are scaled down to maxPixelSize if it is not 0
+static NSImage* imageFromOptions(RustBytes bytes, NSImage* decoded, RustStr url, NSUInteger maxPixelSize)
+{
+    if (bytes.data)
+    {
+        if (maxPixelSize > 0)
+        {
+            return [thumbnailFromData(dataFromRust(bytes), maxPixelSize) autorelease];
+        }
+        return [[[NSImage alloc] initWithData:dataFromRust(bytes)] autorelease];
+    }
+    if (decoded)
+    {
+        return decoded;
+    }
+    NSString* path = stringFromRust(url);
+    if (path.length > 0)
+    {
+        return [imageFromURL(imageURLFromString(path), maxPixelSize) autorelease];
+    }
+    return nil;
+}
+
+// Result of fetchURL if there is no HTTP status
+typedef NS_ENUM(NSInteger, FetchStatus) {
+    FetchFailed = -1,
+    FetchTimedOut = -2,
+    FetchTooLarge = -3,
+};
+
+// The response to fetchURL, every object is retained and may be nil
+typedef struct
+{
+    NSData* body;
+    NSString* etag;
+    NSString* lastModified;
+    NSString* cacheControl;
+} FetchedURL;
+
+// Collects the body of a single data task, cancels the task once the body grows past maxBytes
+@interface BoundedFetch : NSObject <NSURLSessionDataDelegate>
+@property(nonatomic) NSUInteger maxBytes;
+@property(nonatomic, retain) NSMutableData* body;
+@property(nonatomic, retain) NSHTTPURLResponse* response;
+@property(nonatomic) BOOL tooLarge;
+// Signalled once the task completed, whether it succeeded or not
+@property(nonatomic, readonly) dispatch_semaphore_t done;
+@end
+
+@implementation BoundedFetch
+- (id)init
+{
+    if (self = [super init])
+    {
+        _body = [[NSMutableData alloc] init];
+        _done = dispatch_semaphore_create(0);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [_body release];
+    [_response release];
+    dispatch_release(_done);
+    [super dealloc];
+}
+
+- (void)URLSession:(NSURLSession*)session dataTask:(NSURLSessionDataTask*)dataTask didReceiveResponse:(NSURLResponse*)response completionHandler:(void (^)(NSURLSessionResponseDisposition))completionHandler
+{
+    if ([response isKindOfClass:[NSHTTPURLResponse class]])
+    {
+        self.response = (NSHTTPURLResponse*)response;
+    }
+    // expectedContentLength is -1 if the server did not tell
+    if (response.expectedContentLength > (long long)self.maxBytes)
+    {
+        self.tooLarge = YES;
+        completionHandler(NSURLSessionResponseCancel);
+        return;
+    }
+    completionHandler(NSURLSessionResponseAllow);
+}
+
+- (void)URLSession:(NSURLSession*)session dataTask:(NSURLSessionDataTask*)dataTask didReceiveData:(NSData*)data
+{
+    if (self.body.length + data.length > self.maxBytes)
+    {
+        self.tooLarge = YES;
+        [dataTask cancel];
+        return;
+    }
+    [self.body appendData:data];
+}
+
+- (void)URLSession:(NSURLSession*)session task:(NSURLSessionTask*)task didCompleteWithError:(NSError*)error
+{
+    if (error)
+    {
+        self.response = nil;
+    }
+    dispatch_semaphore_signal(self.done);
+}
+@end
+
+// The value of a response header, whatever the case of its name
+static NSString* headerValue(NSHTTPURLResponse* response, NSString* name)
+{
+    for (NSString* header in response.allHeaderFields)
+    {
+        if ([header caseInsensitiveCompare:name] == NSOrderedSame)
+        {
+            return response.allHeaderFields[header];
+        }
+    }
+    return nil;
+}
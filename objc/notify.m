@@ -9,6 +9,33 @@ NSString* getBundleIdentifier(NSString* appName)
     return [resultDescriptor stringValue];
 }
 
+// getBundleIdentifiers(app_names: &[&str]) -> Vec<String>
+// Runs a single script for all names, names without an application get an empty string.
+// Returns a retained array
+NSArray* getBundleIdentifiers(NSArray* appNames)
+{
+    NSMutableArray* identifiers = [[NSMutableArray alloc] initWithCapacity:appNames.count];
+    @autoreleasepool
+    {
+        NSMutableString* findString = [NSMutableString stringWithString:@"set ids to {}\n"];
+        for (NSString* appName in appNames)
+        {
+            NSString* quoted = [[appName stringByReplacingOccurrencesOfString:@"\\" withString:@"\\\\"] stringByReplacingOccurrencesOfString:@"\"" withString:@"\\\""];
+            [findString appendFormat:@"try\nset end of ids to id of application \"%@\"\non error\nset end of ids to \"\"\nend try\n", quoted];
+        }
+        [findString appendString:@"return ids\n"];
+        NSAppleScript* findScript = [[NSAppleScript alloc] initWithSource:findString];
+        NSAppleEventDescriptor* resultDescriptor = [findScript executeAndReturnError:nil];
+        [findScript release];
+        for (NSInteger index = 1; index <= (NSInteger)appNames.count; index++)
+        {
+            NSString* identifier = [[resultDescriptor descriptorAtIndex:index] stringValue];
+            [identifiers addObject:identifier ? identifier : @""];
+        }
+    }
+    return identifiers;
+}
+
 // setApplication(new_bundle_identifier: &str) -> Result<()>
 BOOL setApplication(NSString* newbundleIdentifier)
 {
@@ -20,133 +47,356 @@ BOOL setApplication(NSString* newbundleIdentifier)
     return NO;
 }
 
-// sendNotification(title: &str, subtitle: &str, message: &str, options: Notification) -> NotificationResult<()>
-NSDictionary* sendNotification(NSString* title, NSString* subtitle, NSString* message, NSDictionary* options)
+// createNotificationCenter() -> NotificationCenter
+NotificationSession* createNotificationCenter()
+{
+    NotificationCenterDelegate* ncDelegate = [NotificationCenterDelegate shared];
+    ncDelegate.center.delegate = ncDelegate;
+    return [[NotificationSession alloc] init];
+}
+
+// closeNotificationCenter(center: &NotificationCenter)
+void closeNotificationCenter(NotificationSession* session)
 {
+    // Nothing reports back on outstanding notifications of the session after this,
+    // the delegate stays installed for the other sessions
     @autoreleasepool
     {
-        if (!installNSBundleHook())
-        {
-            // TODO: Could potentially have different error messages
-            return @{@"error" : @""};
-        }
+        [[NotificationCenterDelegate shared] finishSession:session withActivation:activationWithType(NotificationActivationNone)];
+    }
+}
 
-        // For a list of available notification options, see https://developer.apple.com/documentation/foundation/nsusernotification?language=objc
+// Delivers a single notification, sendNotifications provides the autorelease pool
+static NotificationDelivery deliverNotification(NotificationCenterDelegate* ncDelegate, NotificationSession* session, NSString* identifier, RustStr title, RustStr subtitle, RustStr message, const NotificationOptions* options, const void* waiter)
+{
+    // For a list of available notification options, see https://developer.apple.com/documentation/foundation/nsusernotification?language=objc
 
-        NSUserNotificationCenter* notificationCenter = [NSUserNotificationCenter defaultUserNotificationCenter];
-        NotificationCenterDelegate* ncDelegate = [[NotificationCenterDelegate alloc] init];
-        notificationCenter.delegate = ncDelegate;
+    NSUserNotificationCenter* notificationCenter = ncDelegate.center;
 
-        // By default, do not wait for interaction unless an action or schedule is set.
-        // This can be overriden with `asynchronous` in order to always "fire and forget"
-        ncDelegate.keepRunning = NO;
+    // By default, do not wait for interaction unless an action or schedule is set.
+    // This can be overriden with `asynchronous` in order to always "fire and forget"
+    BOOL awaitsInteraction = NO;
 
-        NSUserNotification* userNotification = [[NSUserNotification alloc] init];
-        BOOL isScheduled = NO;
+    NSUserNotification* userNotification = [[[NSUserNotification alloc] init] autorelease];
+    BOOL isScheduled = NO;
 
-        // Basic text
-        userNotification.title = title;
-        if (![subtitle isEqualToString:@""])
-        {
-            userNotification.subtitle = subtitle;
-        }
-        userNotification.informativeText = message;
+    // Lets the delegate route callbacks to the waiter of this notification,
+    // delivering under an existing identifier replaces that notification
+    userNotification.identifier = identifier ? identifier : [[NSUUID UUID] UUIDString];
 
-        // Notification sound
-        if (options[@"sound"] && ![options[@"sound"] isEqualToString:@""] && ![options[@"sound"] isEqualToString:@"_mute"])
-        {
-            userNotification.soundName = options[@"sound"];
-        }
+    // Basic text
+    userNotification.title = stringFromRust(title);
+    NSString* subtitleString = stringFromRust(subtitle);
+    if (subtitleString.length > 0)
+    {
+        userNotification.subtitle = subtitleString;
+    }
+    userNotification.informativeText = stringFromRust(message);
 
-        // Delivery Date/Schedule
-        if (options[@"deliveryDate"] && ![options[@"deliveryDate"] isEqualToString:@""])
-        {
-            ncDelegate.keepRunning = YES;
-            double deliveryDate = [options[@"deliveryDate"] doubleValue];
-            NSDate* scheduleTime = [NSDate dateWithTimeIntervalSince1970:deliveryDate];
-            userNotification.deliveryDate = scheduleTime;
-            NSLog(@"Delivery date option passed as %@ converted to %f resulting in %@", options[@"deliveryDate"], deliveryDate, scheduleTime);
-            isScheduled = YES;
-        }
+    // Notification sound, the Rust side leaves out sounds that do not exist
+    NSString* sound = stringFromRust(options->sound);
+    if (sound.length > 0)
+    {
+        userNotification.soundName = sound;
+    }
 
-        // Main Actions Button (defaults to "Show")
-        if (options[@"mainButtonLabel"] && ![options[@"mainButtonLabel"] isEqualToString:@""])
-        {
-            ncDelegate.keepRunning = YES;
-            userNotification.actionButtonTitle = options[@"mainButtonLabel"];
-            userNotification.hasActionButton = 1;
-        }
+    // Delivery Date/Schedule
+    if (options->isScheduled)
+    {
+        NSDate* scheduleTime = [NSDate dateWithTimeIntervalSince1970:options->deliveryDate];
+        userNotification.deliveryDate = scheduleTime;
+        isScheduled = YES;
+    }
 
-        // Dropdown actions
-        if (options[@"actions"] && ![options[@"actions"] isEqualToString:@""])
-        {
-            ncDelegate.keepRunning = YES;
-            [userNotification setValue:@YES forKey:@"_showsButtons"];
+    // Main Actions Button (defaults to "Show")
+    NSString* mainButtonLabel = stringFromRust(options->mainButtonLabel);
+    if (mainButtonLabel.length > 0)
+    {
+        awaitsInteraction = YES;
+        userNotification.actionButtonTitle = mainButtonLabel;
+        userNotification.hasActionButton = 1;
+    }
 
-            NSArray* myActions = [options[@"actions"] componentsSeparatedByString:@","];
+    // Dropdown actions
+    if (options->actionCount > 0)
+    {
+        awaitsInteraction = YES;
+        [userNotification setValue:@YES forKey:@"_showsButtons"];
 
-            if (myActions.count > 1)
+        if (options->actionCount > 1)
+        {
+            NSMutableArray* myActions = [NSMutableArray arrayWithCapacity:options->actionCount];
+            for (NSUInteger i = 0; i < options->actionCount; i++)
             {
-                [userNotification setValue:@YES forKey:@"_alwaysShowAlternateActionMenu"];
-                [userNotification setValue:myActions forKey:@"_alternateActionButtonTitles"];
+                [myActions addObject:stringFromRust(options->actions[i])];
             }
+            [userNotification setValue:@YES forKey:@"_alwaysShowAlternateActionMenu"];
+            [userNotification setValue:myActions forKey:@"_alternateActionButtonTitles"];
         }
+    }
+
+    // Close/Other button (defaults to "Cancel")
+    NSString* closeButtonLabel = stringFromRust(options->closeButtonLabel);
+    if (closeButtonLabel.length > 0)
+    {
+        awaitsInteraction = YES;
+        [userNotification setValue:@YES forKey:@"_showsButtons"];
+        userNotification.otherButtonTitle = closeButtonLabel;
+    }
+
+    // Reply to the notification with a text field
+    if (options->isResponse)
+    {
+        awaitsInteraction = YES;
+        userNotification.hasReplyButton = 1;
+        userNotification.responsePlaceholder = mainButtonLabel;
+    }
+
+    // Change the icon of the app in the notification
+    NSImage* icon = imageFromOptions(options->appIconBytes, options->decodedAppIcon, options->appIcon, options->maxImagePixelSize);
+    if (icon)
+    {
+        // replacement app icon
+        [userNotification setValue:icon forKey:@"_identityImage"];
+        [userNotification setValue:@(false) forKey:@"_identityImageHasBorder"];
+    }
+    // Change the additional content image
+    NSImage* contentImage = imageFromOptions(options->contentImageBytes, options->decodedContentImage, options->contentImage, options->maxImagePixelSize);
+    if (contentImage)
+    {
+        userNotification.contentImage = contentImage;
+    }
+
+    // If set to asynchronous, do not wait for actions
+    BOOL isAsynchronous = options->isAsynchronous;
+    if (isAsynchronous)
+    {
+        awaitsInteraction = NO;
+    }
+
+    // Without a waiter the replaced notification keeps reporting to its own
+    PendingNotification* pending = [ncDelegate pendingForIdentifier:userNotification.identifier];
+    if (waiter)
+    {
+        pending = [[[PendingNotification alloc] init] autorelease];
+        pending.waiter = waiter;
+        pending.session = session;
+        [ncDelegate addPending:pending forIdentifier:userNotification.identifier];
+    }
+    pending.awaitsInteraction = awaitsInteraction;
+
+    // Send or schedule notification
+    if (isScheduled)
+    {
+        [notificationCenter scheduleNotification:userNotification];
+    }
+    else
+    {
+        [notificationCenter deliverNotification:userNotification];
+    }
+
+    // The caller waits on the run loop until the delegate completes the waiter,
+    // scheduled notifications are waited for until they have been delivered.
+    // Senders without a run loop of their own go through the thread of a NotificationService.
+    if ((awaitsInteraction || isScheduled) && !isAsynchronous)
+    {
+        return NotificationDeliveryAwaitingResponse;
+    }
+    return NotificationDeliveryDelivered;
+}
 
-        // Close/Other button (defaults to "Cancel")
-        if (options[@"closeButtonLabel"] && ![options[@"closeButtonLabel"] isEqualToString:@""])
+// sendNotifications(center: &NotificationCenter, count: usize, identifiers: Option<&[Option<&str>]>, titles: &[&str], subtitles: &[Option<&str>], messages: &[&str], options: &[RawOptions], waiters: &[Option<Waiter>], deliveries: &mut [NotificationDelivery])
+void sendNotifications(NotificationSession* session, NSUInteger count, NSString* const* identifiers, const RustStr* titles, const RustStr* subtitles, const RustStr* messages, const NotificationOptions* options, const void* const* waiters, NotificationDelivery* deliveries)
+{
+    @autoreleasepool
+    {
+        // Other code in the process may have replaced the delegate in the meantime
+        NotificationCenterDelegate* ncDelegate = [NotificationCenterDelegate shared];
+        if (ncDelegate.center.delegate != ncDelegate)
         {
-            ncDelegate.keepRunning = YES;
-            [userNotification setValue:@YES forKey:@"_showsButtons"];
-            userNotification.otherButtonTitle = options[@"closeButtonLabel"];
+            ncDelegate.center.delegate = ncDelegate;
         }
 
-        // Reply to the notification with a text field
-        if (options[@"response"] && ![options[@"response"] isEqualToString:@""])
+        for (NSUInteger i = 0; i < count; i++)
         {
-            ncDelegate.keepRunning = YES;
-            userNotification.hasReplyButton = 1;
-            userNotification.responsePlaceholder = options[@"mainButtonLabel"];
+            deliveries[i] = deliverNotification(ncDelegate, session, identifiers ? identifiers[i] : nil, titles[i], subtitles[i], messages[i], &options[i], waiters[i]);
         }
+    }
+}
+
+// detachWaiters(center: &NotificationCenter, count: usize, waiters: &[Waiter])
+void detachWaiters(NotificationSession* session, NSUInteger count, const void* const* waiters)
+{
+    NotificationCenterDelegate* ncDelegate = [NotificationCenterDelegate shared];
+    for (NSUInteger i = 0; i < count; i++)
+    {
+        [ncDelegate detachWaiter:waiters[i]];
+    }
+}
 
-        // Change the icon of the app in the notification
-        if (options[@"appIcon"] && ![options[@"appIcon"] isEqualToString:@""])
+// Takes the notification with the identifier off the screen, or out of the schedule
+static void removeFromCenter(NSUserNotificationCenter* notificationCenter, NSString* identifier)
+{
+    for (NSUserNotification* notification in notificationCenter.deliveredNotifications)
+    {
+        if ([notification.identifier isEqualToString:identifier])
         {
-            NSImage* icon = getImageFromURL(options[@"appIcon"]);
-            // replacement app icon
-            [userNotification setValue:icon forKey:@"_identityImage"];
-            [userNotification setValue:@(false) forKey:@"_identityImageHasBorder"];
+            [notificationCenter removeDeliveredNotification:notification];
         }
-        // Change the additional content image
-        if (options[@"contentImage"] && ![options[@"contentImage"] isEqualToString:@""])
+    }
+    for (NSUserNotification* notification in notificationCenter.scheduledNotifications)
+    {
+        if ([notification.identifier isEqualToString:identifier])
         {
-            userNotification.contentImage = getImageFromURL(options[@"contentImage"]);
+            [notificationCenter removeScheduledNotification:notification];
         }
+    }
+}
 
-        // If set to asynchronous, do not wait for actions
-        if (options[@"asynchronous"] && [options[@"asynchronous"] isEqualToString:@"yes"])
+// removeNotification(center: &NotificationCenter, identifier: &str)
+void removeNotification(NotificationSession* session, NSString* identifier)
+{
+    @autoreleasepool
+    {
+        NotificationCenterDelegate* ncDelegate = [NotificationCenterDelegate shared];
+        removeFromCenter(ncDelegate.center, identifier);
+
+        // Nothing reports back on a removed notification
+        [ncDelegate finishIdentifier:identifier withActivation:activationWithType(NotificationActivationNone)];
+    }
+}
+
+// withdrawWaiter(center: &NotificationCenter, waiter: &Waiter)
+// Removes the notification of a waiter nobody waits on anymore, without completing the waiter
+void withdrawWaiter(NotificationSession* session, const void* waiter)
+{
+    @autoreleasepool
+    {
+        NotificationCenterDelegate* ncDelegate = [NotificationCenterDelegate shared];
+        NSString* identifier = [ncDelegate identifierForWaiter:waiter];
+        [ncDelegate detachWaiter:waiter];
+        if (identifier)
         {
-            ncDelegate.keepRunning = NO;
+            removeFromCenter(ncDelegate.center, identifier);
         }
+    }
+}
 
-        // Send or schedule notification
-        if (isScheduled)
+// deliveredNotificationIdentifiers(center: &NotificationCenter) -> Vec<String>
+// Returns a retained array
+NSArray* deliveredNotificationIdentifiers(NotificationSession* session)
+{
+    NSMutableArray* identifiers = [[NSMutableArray alloc] init];
+    @autoreleasepool
+    {
+        for (NSUserNotification* notification in [NotificationCenterDelegate shared].center.deliveredNotifications)
         {
-            [notificationCenter scheduleNotification:userNotification];
+            if (notification.identifier)
+            {
+                [identifiers addObject:notification.identifier];
+            }
         }
-        else
+    }
+    return identifiers;
+}
+
+static void wakeSourcePerform(void* info)
+{
+    // Only there to make CFRunLoopRunInMode return
+}
+
+// currentRunLoop() -> RunLoop
+// Returns the retained wake source of the current thread's run loop, the run loop itself is its info.
+// A signalled source stays signalled until the run loop handles it, so a wake-up is not lost
+// when it happens before the thread started waiting.
+CFRunLoopSourceRef currentRunLoop()
+{
+    NSMutableDictionary* threadDictionary = [[NSThread currentThread] threadDictionary];
+    CFRunLoopSourceRef source = (CFRunLoopSourceRef)threadDictionary[@"mac-notification-sys.wake"];
+    if (!source)
+    {
+        CFRunLoopRef runLoop = CFRunLoopGetCurrent();
+        CFRunLoopSourceContext context = {0};
+        context.info = runLoop;
+        context.retain = CFRetain;
+        context.release = CFRelease;
+        context.perform = wakeSourcePerform;
+        source = CFRunLoopSourceCreate(NULL, 0, &context);
+        // A run loop without any source returns immediately instead of waiting
+        CFRunLoopAddSource(runLoop, source, kCFRunLoopDefaultMode);
+        threadDictionary[@"mac-notification-sys.wake"] = (id)source;
+        CFRelease(source);
+    }
+    CFRetain(source);
+    return source;
+}
+
+// runLoopRunOnce(seconds: f64)
+void runLoopRunOnce(double seconds)
+{
+    @autoreleasepool
+    {
+        CFRunLoopRunInMode(kCFRunLoopDefaultMode, seconds, true);
+    }
+}
+
+// runLoopWake(run_loop: &RunLoop)
+void runLoopWake(CFRunLoopSourceRef source)
+{
+    CFRunLoopSourceContext context = {0};
+    CFRunLoopSourceGetContext(source, &context);
+    CFRunLoopSourceSignal(source);
+    CFRunLoopWakeUp((CFRunLoopRef)context.info);
+}
+
+// runLoopRelease(run_loop: RunLoop)
+void runLoopRelease(CFRunLoopSourceRef source)
+{
+    CFRelease(source);
+}
+
+// fetchURL(url: &str, etag: Option<&str>, last_modified: Option<&str>, timeout: f64, max_bytes: usize, fetched: &mut FetchedURL) -> isize
+// Blocks until the response arrived or timeout seconds passed, returns the HTTP status or a FetchStatus.
+// The fetched objects are only set for a status
+NSInteger fetchURL(NSString* url, NSString* etag, NSString* lastModified, double timeout, NSUInteger maxBytes, FetchedURL* fetched)
+{
+    @autoreleasepool
+    {
+        NSURL* requestURL = [NSURL URLWithString:url];
+        if (!requestURL)
         {
-            [notificationCenter deliverNotification:userNotification];
+            return FetchFailed;
         }
+        NSMutableURLRequest* request = [NSMutableURLRequest requestWithURL:requestURL cachePolicy:NSURLRequestReloadIgnoringLocalCacheData timeoutInterval:timeout];
+        [request setValue:etag forHTTPHeaderField:@"If-None-Match"];
+        [request setValue:lastModified forHTTPHeaderField:@"If-Modified-Since"];
 
-        [NSThread sleepForTimeInterval:0.1f];
+        BoundedFetch* fetch = [[[BoundedFetch alloc] init] autorelease];
+        fetch.maxBytes = maxBytes;
+        NSURLSessionConfiguration* configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+        configuration.timeoutIntervalForResource = timeout;
+        // The session holds on to its delegate until it was invalidated
+        NSURLSession* session = [NSURLSession sessionWithConfiguration:configuration delegate:fetch delegateQueue:nil];
+        [[session dataTaskWithRequest:request] resume];
+        long timedOut = dispatch_semaphore_wait(fetch.done, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * NSEC_PER_SEC)));
+        [session invalidateAndCancel];
 
-        // TODO: Issue #4 mentions an issue with multithreading, perhaps there could be an overall "synchronous" option (instead of deliveryDate's synchronous section)
-        // Loop/wait for a user action if needed
-        while (ncDelegate.keepRunning)
+        if (timedOut)
         {
-            [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+            return FetchTimedOut;
         }
-
-        return ncDelegate.actionData;
+        if (fetch.tooLarge)
+        {
+            return FetchTooLarge;
+        }
+        if (!fetch.response)
+        {
+            return FetchFailed;
+        }
+        fetched->body = [fetch.body copy];
+        fetched->etag = [headerValue(fetch.response, @"ETag") retain];
+        fetched->lastModified = [headerValue(fetch.response, @"Last-Modified") retain];
+        fetched->cacheControl = [headerValue(fetch.response, @"Cache-Control") retain];
+        return fetch.response.statusCode;
     }
 }
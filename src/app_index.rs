@@ -0,0 +1,847 @@
+//! Index of the installed applications, from their names to their bundle identifiers.
+//!
+//! The application directories are scanned for `.app` bundles, and the `Contents/Info.plist`
+//! of every bundle is read on a few threads in parallel. A bundle is found by the name of its
+//! directory, its `CFBundleName` and its `CFBundleDisplayName`, ignoring case.
+//!
+//! The index is written to a compact file that is mapped into memory, and looked up there with
+//! a binary search. It holds a fingerprint of the modification times of the application
+//! directories and of the folders in them that are searched, and is built again once one of
+//! them changed.
+
+use crate::remote::fnv1a;
+use std::fs;
+use std::io;
+use std::ops::Deref;
+use std::path::{Path, PathBuf};
+use std::process;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::mpsc;
+use std::thread;
+use std::time::{Duration, Instant, UNIX_EPOCH};
+
+/// Threads that read the `Info.plist` files of the bundles
+const INDEX_THREADS: usize = 4;
+
+/// How deep folders in the application directories are searched for bundles
+const MAX_DEPTH: usize = 3;
+
+/// How often the modification times of the searched directories are checked at most
+const RECHECK_INTERVAL: Duration = Duration::from_secs(1);
+
+const MAGIC: &[u8; 8] = b"MNSAPPS1";
+const HEADER_LEN: usize = 20;
+const ENTRY_LEN: usize = 16;
+
+/// The identity of an application bundle, as its `Info.plist` gives it
+#[derive(Debug, Default, PartialEq)]
+pub(crate) struct BundleInfo {
+    pub(crate) identifier: Option<String>,
+    pub(crate) name: Option<String>,
+    pub(crate) display_name: Option<String>,
+}
+
+impl BundleInfo {
+    fn set(&mut self, key: &str, value: String) {
+        match key {
+            "CFBundleIdentifier" => self.identifier = Some(value),
+            "CFBundleName" => self.name = Some(value),
+            "CFBundleDisplayName" => self.display_name = Some(value),
+            _ => {}
+        }
+    }
+}
+
+/// Read the bundle keys of an XML or binary property list
+pub(crate) fn parse_info_plist(plist: &[u8]) -> Option<BundleInfo> {
+    if plist.starts_with(b"bplist00") {
+        parse_binary_plist(plist)
+    } else {
+        parse_xml_plist(std::str::from_utf8(plist).ok()?)
+    }
+}
+
+/// The string values of the top level dictionary of an XML property list
+fn parse_xml_plist(plist: &str) -> Option<BundleInfo> {
+    let mut info = BundleInfo::default();
+    let mut rest = plist;
+    // dictionaries and arrays the parser is in, the top level dictionary is 1
+    let mut depth = 0;
+    let mut key: Option<String> = None;
+    while let Some(start) = rest.find('<') {
+        rest = &rest[start..];
+        if rest.starts_with("<!--") {
+            rest = &rest[rest.find("-->")? + 3..];
+            continue;
+        }
+        let end = rest.find('>')?;
+        let tag = &rest[1..end];
+        rest = &rest[end + 1..];
+        if tag.starts_with('?') || tag.starts_with('!') {
+            continue;
+        }
+
+        let closing = tag.starts_with('/');
+        let empty = tag.ends_with('/');
+        let name = tag
+            .trim_matches('/')
+            .split(char::is_whitespace)
+            .next()
+            .unwrap_or("");
+        match (name, closing, empty) {
+            ("dict", false, false) | ("array", false, false) => {
+                if depth == 1 {
+                    key = None;
+                }
+                depth += 1;
+            }
+            ("dict", true, _) | ("array", true, _) => {
+                depth -= 1;
+                if depth == 0 {
+                    break;
+                }
+            }
+            ("key", false, false) if depth == 1 => {
+                let end = rest.find("</key>")?;
+                key = Some(unescape(&rest[..end]));
+                rest = &rest[end + 6..];
+                continue;
+            }
+            ("string", false, false) => {
+                let end = rest.find("</string>")?;
+                if depth == 1 {
+                    if let Some(key) = key.take() {
+                        info.set(&key, unescape(&rest[..end]));
+                    }
+                }
+                rest = &rest[end + 9..];
+                continue;
+            }
+            ("string", false, true) if depth == 1 => {
+                if let Some(key) = key.take() {
+                    info.set(&key, String::new());
+                }
+                continue;
+            }
+            _ => {}
+        }
+        if depth == 1 && !closing {
+            // the value of the key is not a string
+            key = None;
+        }
+    }
+    Some(info)
+}
+
+fn unescape(text: &str) -> String {
+    text.replace("&lt;", "<")
+        .replace("&gt;", ">")
+        .replace("&quot;", "\"")
+        .replace("&apos;", "'")
+        .replace("&amp;", "&")
+}
+
+/// The string values of the top level dictionary of a binary property list
+fn parse_binary_plist(plist: &[u8]) -> Option<BundleInfo> {
+    let trailer = plist.get(plist.len().checked_sub(32)?..)?;
+    let offset_size = usize::from(trailer[6]);
+    let ref_size = usize::from(trailer[7]);
+    let objects = be_uint(&trailer[8..16])? as usize;
+    let top = be_uint(&trailer[16..24])? as usize;
+    let offset_table = be_uint(&trailer[24..32])? as usize;
+
+    let object = |index: usize| -> Option<usize> {
+        if index >= objects {
+            return None;
+        }
+        let start = offset_table.checked_add(index.checked_mul(offset_size)?)?;
+        be_uint(plist.get(start..start.checked_add(offset_size)?)?).map(|offset| offset as usize)
+    };
+    // the marker of an object, and the count it holds, which may follow as an integer
+    let header = |offset: usize| -> Option<(u8, usize, usize)> {
+        let marker = *plist.get(offset)?;
+        let count = usize::from(marker & 0x0f);
+        if count != 0x0f {
+            return Some((marker >> 4, count, offset + 1));
+        }
+        let int = *plist.get(offset + 1)?;
+        if int >> 4 != 0x1 {
+            return None;
+        }
+        let len = 1usize.checked_shl(u32::from(int & 0x0f))?;
+        let count = be_uint(plist.get(offset + 2..offset + 2 + len)?)? as usize;
+        Some((marker >> 4, count, offset + 2 + len))
+    };
+    let string = |index: usize| -> Option<String> {
+        let (kind, count, start) = header(object(index)?)?;
+        match kind {
+            0x5 => Some(
+                plist
+                    .get(start..start.checked_add(count)?)?
+                    .iter()
+                    .map(|byte| char::from(*byte))
+                    .collect(),
+            ),
+            0x6 => {
+                let bytes = plist.get(start..start.checked_add(count.checked_mul(2)?)?)?;
+                let units: Vec<u16> = bytes
+                    .chunks(2)
+                    .map(|unit| u16::from_be_bytes([unit[0], unit[1]]))
+                    .collect();
+                String::from_utf16(&units).ok()
+            }
+            _ => None,
+        }
+    };
+    let reference = |at: usize| -> Option<usize> {
+        be_uint(plist.get(at..at.checked_add(ref_size)?)?).map(|index| index as usize)
+    };
+
+    let (kind, count, start) = header(object(top)?)?;
+    if kind != 0xd {
+        return None;
+    }
+    let mut info = BundleInfo::default();
+    for entry in 0..count {
+        let key = reference(start + entry * ref_size)?;
+        let value = reference(start + (count + entry) * ref_size)?;
+        if let (Some(key), Some(value)) = (string(key), string(value)) {
+            info.set(&key, value);
+        }
+    }
+    Some(info)
+}
+
+/// A big endian unsigned integer of up to 8 bytes
+fn be_uint(bytes: &[u8]) -> Option<u64> {
+    if bytes.is_empty() || bytes.len() > 8 {
+        return None;
+    }
+    Some(
+        bytes
+            .iter()
+            .fold(0, |value, byte| (value << 8) | u64::from(*byte)),
+    )
+}
+
+/// Search `dir` and its folders down to `MAX_DEPTH` for `.app` bundles, in a stable order,
+/// calling `searched` with every directory read and `found` with every bundle
+fn walk(dir: &Path, depth: usize, searched: &mut dyn FnMut(&Path), found: &mut dyn FnMut(PathBuf)) {
+    searched(dir);
+    let mut entries: Vec<PathBuf> = match fs::read_dir(dir) {
+        Ok(entries) => entries
+            .filter_map(Result::ok)
+            .filter(|entry| matches!(entry.file_type(), Ok(file_type) if !file_type.is_file()))
+            .map(|entry| entry.path())
+            .collect(),
+        Err(_) => return,
+    };
+    entries.sort();
+    for path in entries {
+        let hidden = path
+            .file_name()
+            .and_then(|name| name.to_str())
+            .filter(|name| !name.starts_with('.'))
+            .is_none();
+        if hidden {
+            continue;
+        }
+        if path.extension().and_then(|extension| extension.to_str()) == Some("app") {
+            found(path);
+        } else if depth < MAX_DEPTH {
+            walk(&path, depth + 1, searched, found);
+        }
+    }
+}
+
+/// The `.app` bundles in the application directories, the first directory first
+pub(crate) fn find_bundles(roots: &[PathBuf]) -> Vec<PathBuf> {
+    let mut bundles = Vec::new();
+    for root in roots {
+        walk(root, 1, &mut |_| {}, &mut |bundle| bundles.push(bundle));
+    }
+    bundles
+}
+
+/// Read the `Info.plist` files of the bundles on `threads` threads,
+/// returns the sorted lowercase names and identifiers of the bundles
+pub(crate) fn index_bundles(bundles: Vec<PathBuf>, threads: usize) -> Vec<(String, String)> {
+    let threads = threads.max(1);
+    let (found, received) = mpsc::channel();
+    // every thread takes every `threads`th bundle
+    let mut shares = vec![Vec::new(); threads];
+    for (index, bundle) in bundles.into_iter().enumerate() {
+        shares[index % threads].push((index, bundle));
+    }
+    let workers: Vec<_> = shares
+        .into_iter()
+        .filter(|share| !share.is_empty())
+        .map(|share| {
+            let found = found.clone();
+            thread::spawn(move || {
+                for (index, bundle) in share {
+                    let info = fs::read(bundle.join("Contents/Info.plist"))
+                        .ok()
+                        .and_then(|plist| parse_info_plist(&plist));
+                    let _ = found.send((index, bundle, info));
+                }
+            })
+        })
+        .collect();
+    drop(found);
+    let mut infos: Vec<_> = received.iter().collect();
+    for worker in workers {
+        let _ = worker.join();
+    }
+
+    // the first bundle with a name keeps it
+    infos.sort_by_key(|(index, _, _)| *index);
+    let mut entries: Vec<(String, String)> = Vec::new();
+    for (_, bundle, info) in infos {
+        let info = match info {
+            Some(info) => info,
+            None => continue,
+        };
+        let identifier = match info.identifier {
+            Some(identifier) if !identifier.is_empty() => identifier,
+            _ => continue,
+        };
+        let stem = bundle
+            .file_stem()
+            .and_then(|stem| stem.to_str())
+            .map(String::from);
+        for name in vec![stem, info.name, info.display_name]
+            .into_iter()
+            .flatten()
+            .filter(|name| !name.is_empty())
+        {
+            entries.push((name.to_lowercase(), identifier.clone()));
+        }
+    }
+    // stable, so the first bundle stays in front of later ones of the same name
+    entries.sort_by(|a, b| a.0.cmp(&b.0));
+    entries.dedup_by(|later, first| later.0 == first.0);
+    entries
+}
+
+/// Changes whenever one of the directories searched for bundles gets a different modification
+/// time, which it does when an entry in it is added, removed or renamed
+///
+/// That covers the application directories and their folders down to `MAX_DEPTH`, so
+/// an application installed into `/Applications/Utilities` is found as well. Bundles
+/// themselves are not looked into: an application whose `Info.plist` changed in place
+/// keeps its old names until one of these directories changes.
+pub(crate) fn fingerprint(roots: &[PathBuf]) -> u64 {
+    let mut stamp = Vec::new();
+    let mut searched = |dir: &Path| {
+        stamp.extend_from_slice(dir.to_string_lossy().as_bytes());
+        let modified = fs::metadata(dir)
+            .and_then(|metadata| metadata.modified())
+            .ok()
+            .and_then(|modified| modified.duration_since(UNIX_EPOCH).ok());
+        match modified {
+            Some(since) => stamp.extend_from_slice(
+                format!("\0{}.{:09}\0", since.as_secs(), since.subsec_nanos()).as_bytes(),
+            ),
+            None => stamp.extend_from_slice(b"\0missing\0"),
+        }
+    };
+    for root in roots {
+        walk(root, 1, &mut searched, &mut |_| {});
+    }
+    fnv1a(&stamp)
+}
+
+/// Lay out the index: the header, the sorted entries and the strings they point at
+///
+/// The header holds the magic, the fingerprint and the number of entries. Every entry holds
+/// the offset and length of its name and of its identifier in the strings. Numbers are
+/// little endian.
+pub(crate) fn serialize(fingerprint: u64, entries: &[(String, String)]) -> Vec<u8> {
+    let strings_start = HEADER_LEN + entries.len() * ENTRY_LEN;
+    let mut index = Vec::with_capacity(strings_start);
+    index.extend_from_slice(MAGIC);
+    index.extend_from_slice(&fingerprint.to_le_bytes());
+    index.extend_from_slice(&(entries.len() as u32).to_le_bytes());
+    let mut strings = Vec::new();
+    for (name, identifier) in entries {
+        for string in &[name, identifier] {
+            index.extend_from_slice(&((strings_start + strings.len()) as u32).to_le_bytes());
+            index.extend_from_slice(&(string.len() as u32).to_le_bytes());
+            strings.extend_from_slice(string.as_bytes());
+        }
+    }
+    index.extend_from_slice(&strings);
+    index
+}
+
+/// The bytes of an index file, mapped into memory where that is supported
+enum Bytes {
+    #[cfg(all(unix, target_pointer_width = "64"))]
+    Mapped(map::Mapped),
+    Owned(Vec<u8>),
+}
+
+impl Deref for Bytes {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match self {
+            #[cfg(all(unix, target_pointer_width = "64"))]
+            Bytes::Mapped(mapped) => mapped,
+            Bytes::Owned(bytes) => bytes,
+        }
+    }
+}
+
+/// A read-only index, looked up without copying it out of the file
+pub(crate) struct Index {
+    bytes: Bytes,
+}
+
+impl Index {
+    /// Map the index file, `None` if it does not exist or is not an index
+    pub(crate) fn open(path: &Path) -> Option<Self> {
+        let file = fs::File::open(path).ok()?;
+        #[cfg(all(unix, target_pointer_width = "64"))]
+        let bytes = map::Mapped::new(&file).map(Bytes::Mapped);
+        #[cfg(not(all(unix, target_pointer_width = "64")))]
+        let bytes = {
+            use std::io::Read;
+            let mut bytes = Vec::new();
+            let mut file = file;
+            file.read_to_end(&mut bytes).map(|_| Bytes::Owned(bytes))
+        };
+        Index::from_bytes(bytes.ok()?)
+    }
+
+    fn from_bytes(bytes: Bytes) -> Option<Self> {
+        let index = Index { bytes };
+        let entries = HEADER_LEN.checked_add(index.len().checked_mul(ENTRY_LEN)?)?;
+        if !index.bytes.starts_with(MAGIC) || index.bytes.len() < entries {
+            return None;
+        }
+        Some(index)
+    }
+
+    /// Fingerprint of the application directories the index was built from
+    pub(crate) fn fingerprint(&self) -> u64 {
+        let mut fingerprint = [0; 8];
+        fingerprint.copy_from_slice(&self.bytes[8..16]);
+        u64::from_le_bytes(fingerprint)
+    }
+
+    /// Number of names in the index
+    pub(crate) fn len(&self) -> usize {
+        self.u32_at(16).unwrap_or(0) as usize
+    }
+
+    /// The bundle identifier of the application with the given name, ignoring case
+    pub(crate) fn lookup(&self, app_name: &str) -> Option<&str> {
+        let app_name = app_name.to_lowercase();
+        let (mut low, mut high) = (0, self.len());
+        while low < high {
+            let middle = low + (high - low) / 2;
+            let entry = HEADER_LEN + middle * ENTRY_LEN;
+            match self.string_at(entry)?.cmp(app_name.as_str()) {
+                std::cmp::Ordering::Less => low = middle + 1,
+                std::cmp::Ordering::Greater => high = middle,
+                std::cmp::Ordering::Equal => return self.string_at(entry + 8),
+            }
+        }
+        None
+    }
+
+    fn u32_at(&self, at: usize) -> Option<u32> {
+        let mut value = [0; 4];
+        value.copy_from_slice(self.bytes.get(at..at + 4)?);
+        Some(u32::from_le_bytes(value))
+    }
+
+    /// The string whose offset and length are at `at`, `None` if the file is broken
+    fn string_at(&self, at: usize) -> Option<&str> {
+        let start = self.u32_at(at)? as usize;
+        let len = self.u32_at(at + 4)? as usize;
+        std::str::from_utf8(self.bytes.get(start..start.checked_add(len)?)?).ok()
+    }
+}
+
+/// The index of the application directories, built again when they changed
+pub struct AppIndex {
+    roots: Vec<PathBuf>,
+    // `None` keeps the index in memory only
+    file: Option<PathBuf>,
+    index: Option<Index>,
+    checked: Option<Instant>,
+    threads: usize,
+    builds: u64,
+}
+
+impl AppIndex {
+    /// Index the bundles in `roots`, kept in `file`, which is read or built on first use
+    pub fn new(roots: Vec<PathBuf>, file: Option<PathBuf>) -> Self {
+        AppIndex {
+            roots,
+            file,
+            index: None,
+            checked: None,
+            threads: INDEX_THREADS,
+            builds: 0,
+        }
+    }
+
+    /// The bundle identifier of the application with the given name, ignoring case
+    pub fn lookup(&mut self, app_name: &str) -> Option<String> {
+        self.refresh();
+        self.index.as_ref()?.lookup(app_name).map(String::from)
+    }
+
+    /// The bundle identifiers of all `app_names`, in the same order, with the index checked once
+    pub fn lookup_all(&mut self, app_names: &[&str]) -> Vec<Option<String>> {
+        self.refresh();
+        app_names
+            .iter()
+            .map(|app_name| self.index.as_ref()?.lookup(app_name).map(String::from))
+            .collect()
+    }
+
+    /// Use the index file if it is up to date, and build it otherwise
+    fn refresh(&mut self) {
+        let due = match self.checked {
+            Some(checked) => checked.elapsed() >= RECHECK_INTERVAL,
+            None => true,
+        };
+        if !due {
+            return;
+        }
+        self.checked = Some(Instant::now());
+        let fingerprint = fingerprint(&self.roots);
+        let current = |index: &Option<Index>| matches!(index, Some(index) if index.fingerprint() == fingerprint);
+        if current(&self.index) {
+            return;
+        }
+        self.index = self.file.as_ref().and_then(|file| Index::open(file));
+        if current(&self.index) {
+            return;
+        }
+
+        let entries = index_bundles(find_bundles(&self.roots), self.threads);
+        let bytes = serialize(fingerprint, &entries);
+        self.builds += 1;
+        let written = match &self.file {
+            Some(file) => write(file, &bytes).ok().and_then(|_| Index::open(file)),
+            None => None,
+        };
+        self.index = written.or_else(|| Index::from_bytes(Bytes::Owned(bytes)));
+    }
+}
+
+/// Write the file as a whole, mappings of the previous file keep seeing the previous file
+fn write(path: &Path, contents: &[u8]) -> io::Result<()> {
+    static TEMP_FILES: AtomicUsize = AtomicUsize::new(0);
+    let dir = path.parent().unwrap_or_else(|| Path::new("."));
+    fs::create_dir_all(dir)?;
+    let temp = dir.join(format!(
+        ".app-index-{}-{}.tmp",
+        process::id(),
+        TEMP_FILES.fetch_add(1, Ordering::Relaxed)
+    ));
+    fs::write(&temp, contents)?;
+    if let Err(error) = fs::rename(&temp, path) {
+        let _ = fs::remove_file(&temp);
+        return Err(error);
+    }
+    Ok(())
+}
+
+/// The directories applications are installed in, the user's own last
+pub(crate) fn application_dirs() -> Vec<PathBuf> {
+    [
+        "/Applications",
+        "/System/Applications",
+        "/System/Library/CoreServices",
+    ]
+    .iter()
+    .map(PathBuf::from)
+    .chain(dirs_next::home_dir().map(|home| home.join("Applications")))
+    .collect()
+}
+
+/// Read-only memory mappings of whole files
+#[cfg(all(unix, target_pointer_width = "64"))]
+mod map {
+    use std::fs::File;
+    use std::io;
+    use std::ops::Deref;
+    use std::os::raw::{c_int, c_void};
+    use std::os::unix::io::AsRawFd;
+
+    const PROT_READ: c_int = 1;
+    const MAP_PRIVATE: c_int = 2;
+
+    extern "C" {
+        fn mmap(
+            addr: *mut c_void,
+            len: usize,
+            prot: c_int,
+            flags: c_int,
+            fd: c_int,
+            offset: i64,
+        ) -> *mut c_void;
+        fn munmap(addr: *mut c_void, len: usize) -> c_int;
+    }
+
+    pub(crate) struct Mapped {
+        ptr: *mut c_void,
+        len: usize,
+    }
+
+    // the mapping is read-only
+    unsafe impl Send for Mapped {}
+    unsafe impl Sync for Mapped {}
+
+    impl Mapped {
+        pub(crate) fn new(file: &File) -> io::Result<Self> {
+            let len = file.metadata()?.len() as usize;
+            if len == 0 {
+                return Err(io::Error::new(io::ErrorKind::InvalidData, "empty file"));
+            }
+            let ptr = unsafe {
+                mmap(
+                    std::ptr::null_mut(),
+                    len,
+                    PROT_READ,
+                    MAP_PRIVATE,
+                    file.as_raw_fd(),
+                    0,
+                )
+            };
+            // MAP_FAILED
+            if ptr as usize == usize::MAX {
+                return Err(io::Error::last_os_error());
+            }
+            Ok(Mapped { ptr, len })
+        }
+    }
+
+    impl Deref for Mapped {
+        type Target = [u8];
+
+        fn deref(&self) -> &[u8] {
+            unsafe { std::slice::from_raw_parts(self.ptr as *const u8, self.len) }
+        }
+    }
+
+    impl Drop for Mapped {
+        fn drop(&mut self) {
+            unsafe {
+                munmap(self.ptr, self.len);
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::env;
+
+    fn temp_dir(name: &str) -> PathBuf {
+        let dir = env::temp_dir().join(format!("mac-notification-sys-{}-{}", name, process::id()));
+        let _ = fs::remove_dir_all(&dir);
+        fs::create_dir_all(&dir).unwrap();
+        dir
+    }
+
+    fn xml_plist(identifier: &str, name: &str) -> String {
+        format!(
+            r#"<?xml version="1.0" encoding="UTF-8"?>
+<!DOCTYPE plist PUBLIC "-//Apple//DTD PLIST 1.0//EN" "http://www.apple.com/DTDs/PropertyList-1.0.dtd">
+<plist version="1.0">
+<dict>
+	<key>CFBundleDocumentTypes</key>
+	<array>
+		<dict>
+			<key>CFBundleTypeName</key>
+			<string>Document</string>
+			<key>CFBundleIdentifier</key>
+			<string>com.example.nested</string>
+		</dict>
+	</array>
+	<key>LSUIElement</key>
+	<true/>
+	<!-- <key>CFBundleName</key><string>Commented</string> -->
+	<key>CFBundleIdentifier</key>
+	<string>{}</string>
+	<key>CFBundleName</key>
+	<string>{}</string>
+	<key>CFBundleDisplayName</key>
+	<string/>
+</dict>
+</plist>
+"#,
+            identifier, name
+        )
+    }
+
+    /// A binary property list of a dictionary of strings, the values as UTF-16
+    fn binary_plist(pairs: &[(&str, &str)]) -> Vec<u8> {
+        let mut plist = b"bplist00".to_vec();
+        let mut offsets = vec![plist.len()];
+        // the dictionary is object 0, then the keys, then the values
+        plist.push(0xd0 | pairs.len() as u8);
+        plist.extend((1..=pairs.len() * 2).map(|index| index as u8));
+        for (key, _) in pairs {
+            offsets.push(plist.len());
+            plist.extend_from_slice(&[0x5f, 0x10, key.len() as u8]);
+            plist.extend_from_slice(key.as_bytes());
+        }
+        for (_, value) in pairs {
+            offsets.push(plist.len());
+            let units: Vec<u16> = value.encode_utf16().collect();
+            plist.extend_from_slice(&[0x6f, 0x10, units.len() as u8]);
+            for unit in units {
+                plist.extend_from_slice(&unit.to_be_bytes());
+            }
+        }
+        let offset_table = plist.len();
+        plist.extend(offsets.iter().map(|offset| *offset as u8));
+        plist.extend_from_slice(&[0, 0, 0, 0, 0, 0, 1, 1]);
+        plist.extend_from_slice(&(offsets.len() as u64).to_be_bytes());
+        plist.extend_from_slice(&0u64.to_be_bytes());
+        plist.extend_from_slice(&(offset_table as u64).to_be_bytes());
+        plist
+    }
+
+    fn bundle(dir: &Path, plist: &[u8]) {
+        fs::create_dir_all(dir.join("Contents")).unwrap();
+        fs::write(dir.join("Contents/Info.plist"), plist).unwrap();
+    }
+
+    #[test]
+    fn parses_xml_and_binary_plists() {
+        let xml = parse_info_plist(xml_plist("org.mozilla.firefox", "Firefox &amp; Co").as_bytes());
+        assert_eq!(
+            xml,
+            Some(BundleInfo {
+                identifier: Some("org.mozilla.firefox".into()),
+                name: Some("Firefox & Co".into()),
+                display_name: Some(String::new()),
+            })
+        );
+
+        let binary = binary_plist(&[
+            ("CFBundleIdentifier", "com.apple.Safari"),
+            ("CFBundleVersion", "17"),
+            ("CFBundleDisplayName", "Säfari"),
+        ]);
+        assert_eq!(
+            parse_info_plist(&binary),
+            Some(BundleInfo {
+                identifier: Some("com.apple.Safari".into()),
+                name: None,
+                display_name: Some("Säfari".into()),
+            })
+        );
+        assert_eq!(parse_info_plist(b"bplist00 but broken"), None);
+    }
+
+    #[test]
+    fn indexes_bundles_by_every_name() {
+        let dir = temp_dir("app-index-names");
+        let (applications, user) = (dir.join("Applications"), dir.join("user"));
+        bundle(
+            &applications.join("Firefox.app"),
+            xml_plist("org.mozilla.firefox", "Firefox Browser").as_bytes(),
+        );
+        bundle(
+            &applications.join("Utilities/Terminal.app"),
+            &binary_plist(&[("CFBundleIdentifier", "com.apple.Terminal")]),
+        );
+        bundle(
+            &applications.join("Firefox.app/Contents/Helper.app"),
+            xml_plist("org.mozilla.helper", "Helper").as_bytes(),
+        );
+        bundle(
+            &user.join("Firefox.app"),
+            xml_plist("org.mozilla.other", "Other").as_bytes(),
+        );
+        bundle(&user.join("Broken.app"), b"not a plist");
+
+        let roots = vec![applications, user];
+        let bundles = find_bundles(&roots);
+        assert_eq!(bundles.len(), 4);
+        let entries = index_bundles(bundles, 3);
+        let index = Index::from_bytes(Bytes::Owned(serialize(7, &entries))).unwrap();
+        assert_eq!(index.fingerprint(), 7);
+        assert_eq!(index.len(), 4);
+        assert_eq!(index.lookup("Firefox"), Some("org.mozilla.firefox"));
+        assert_eq!(index.lookup("firefox browser"), Some("org.mozilla.firefox"));
+        assert_eq!(index.lookup("TERMINAL"), Some("com.apple.Terminal"));
+        assert_eq!(index.lookup("Other"), Some("org.mozilla.other"));
+        assert_eq!(index.lookup("Helper"), None);
+        assert_eq!(index.lookup("Broken"), None);
+        fs::remove_dir_all(dir).unwrap();
+    }
+
+    #[test]
+    fn maps_the_file_and_builds_again_when_applications_change() {
+        let dir = temp_dir("app-index-file");
+        let applications = dir.join("Applications");
+        bundle(
+            &applications.join("Firefox.app"),
+            xml_plist("org.mozilla.firefox", "Firefox").as_bytes(),
+        );
+        let file = dir.join("cache/app-index");
+        let mut index = AppIndex::new(vec![applications.clone()], Some(file.clone()));
+        assert_eq!(
+            index.lookup("firefox").as_deref(),
+            Some("org.mozilla.firefox")
+        );
+        assert_eq!(index.builds, 1);
+        assert!(file.is_file());
+
+        let mut next_run = AppIndex::new(vec![applications.clone()], Some(file.clone()));
+        assert_eq!(
+            next_run.lookup("Firefox").as_deref(),
+            Some("org.mozilla.firefox")
+        );
+        assert_eq!(next_run.builds, 0);
+
+        // the modification time has to tick over
+        thread::sleep(Duration::from_millis(20));
+        bundle(
+            &applications.join("Safari.app"),
+            &binary_plist(&[("CFBundleIdentifier", "com.apple.Safari")]),
+        );
+        next_run.checked = None;
+        assert_eq!(
+            next_run.lookup("Safari").as_deref(),
+            Some("com.apple.Safari")
+        );
+        assert_eq!(next_run.builds, 1);
+
+        // installing into a folder changes only that folder, not the application directory
+        fs::create_dir_all(applications.join("Utilities")).unwrap();
+        next_run.checked = None;
+        assert_eq!(next_run.lookup("Terminal"), None);
+        assert_eq!(next_run.builds, 2);
+        thread::sleep(Duration::from_millis(20));
+        bundle(
+            &applications.join("Utilities/Terminal.app"),
+            &binary_plist(&[("CFBundleIdentifier", "com.apple.Terminal")]),
+        );
+        next_run.checked = None;
+        assert_eq!(
+            next_run.lookup("Terminal").as_deref(),
+            Some("com.apple.Terminal")
+        );
+        assert_eq!(next_run.builds, 3);
+
+        fs::write(&file, b"MNSAPPS1 but broken").unwrap();
+        let mut broken = AppIndex::new(vec![applications], Some(file));
+        assert_eq!(broken.lookup("Safari").as_deref(), Some("com.apple.Safari"));
+        assert_eq!(broken.builds, 1);
+        fs::remove_dir_all(dir).unwrap();
+    }
+}
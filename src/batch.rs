@@ -0,0 +1,298 @@
+//! Delivering many notifications in one pass.
+//!
+//! All notifications of a batch are handed to the notification center before the
+//! sender starts waiting, so their delivery callbacks are collected by a single wait.
+
+use crate::cancel::CancelHandle;
+use crate::wait::{EventLoop, Waiter};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+/// How the notification center took a notification
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum Delivery {
+    /// The notification could not be delivered
+    Failed,
+    /// Delivered, the delegate completes the waiter once the center confirmed it
+    Delivered,
+    /// Delivered, the delegate completes the waiter once the user interacted with it
+    AwaitingResponse,
+}
+
+/// Why the sender stopped waiting for the user to respond
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum GaveUp {
+    /// The response timeout passed
+    TimedOut,
+    /// The cancel handle of the notification was cancelled
+    Cancelled,
+}
+
+/// A notification center that batches can be delivered through
+pub trait Deliver<N, T> {
+    /// Hand all notifications to the center, each of them completes the waiter at the same index
+    fn deliver_all(&self, notifications: &[N], waiters: &[Arc<Waiter<T>>]) -> Vec<Delivery>;
+
+    /// Stop reporting back on the waiters, once nobody waits on them anymore
+    fn detach_all(&self, waiters: &[Arc<Waiter<T>>]);
+
+    /// How long to wait for the user to respond to the notification, `None` waits until they do
+    fn response_timeout(&self, notification: &N) -> Option<Duration>;
+
+    /// The handle that cancels waiting for the user to respond to the notification
+    fn cancel_handle<'a>(&self, notification: &'a N) -> Option<&'a CancelHandle>;
+
+    /// The response to a notification the sender stopped waiting on,
+    /// after taking it off the screen if it was cancelled or asks for that
+    fn gave_up(&self, notification: &N, waiter: &Arc<Waiter<T>>, reason: GaveUp) -> T;
+}
+
+/// Deliver all notifications and wait for their responses.
+///
+/// Responses are returned in input order, notifications that were only delivered are
+/// waited for until `ack_timeout` after the whole batch went out. Notifications awaiting a
+/// response are waited for until their response timeout, counted from the same moment,
+/// or until they are cancelled.
+/// Returns `None` if any of them could not be delivered.
+pub fn send_all<N, T, D: Deliver<N, T>>(
+    center: &D,
+    event_loop: Arc<dyn EventLoop>,
+    notifications: &[N],
+    ack_timeout: Duration,
+) -> Option<Vec<Option<T>>> {
+    let waiters: Vec<Arc<Waiter<T>>> = notifications
+        .iter()
+        .map(|_| Arc::new(Waiter::new(Arc::clone(&event_loop))))
+        .collect();
+
+    let deliveries = center.deliver_all(notifications, &waiters);
+    if deliveries.contains(&Delivery::Failed) {
+        center.detach_all(&waiters);
+        return None;
+    }
+
+    let delivered_at = Instant::now();
+    let ack_deadline = delivered_at + ack_timeout;
+    let responses = notifications
+        .iter()
+        .zip(&waiters)
+        .zip(deliveries)
+        .map(|((notification, waiter), delivery)| match delivery {
+            Delivery::AwaitingResponse => {
+                let deadline = center
+                    .response_timeout(notification)
+                    .map(|timeout| delivered_at + timeout);
+                let cancel = center.cancel_handle(notification);
+                let response = match cancel {
+                    Some(cancel) => cancel.wait(waiter, deadline),
+                    None => waiter.wait(deadline),
+                };
+                match response {
+                    Some(response) => Some(response),
+                    None if matches!(cancel, Some(cancel) if cancel.is_cancelled()) => {
+                        Some(center.gave_up(notification, waiter, GaveUp::Cancelled))
+                    }
+                    None if deadline.is_some() => {
+                        Some(center.gave_up(notification, waiter, GaveUp::TimedOut))
+                    }
+                    None => None,
+                }
+            }
+            _ => waiter.wait(Some(ack_deadline)),
+        })
+        .collect();
+    center.detach_all(&waiters);
+
+    Some(responses)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::wait::Parker;
+    use std::sync::Mutex;
+    use std::thread;
+
+    /// Event loop for a center that completes everything synchronously
+    struct NoopLoop;
+
+    impl EventLoop for NoopLoop {
+        fn run_once(&self, _timeout: Option<Duration>) {}
+        fn wake(&self) {}
+    }
+
+    /// Confirms notifications right away, answers interactive ones with their index
+    #[derive(Default)]
+    struct FakeCenter {
+        detached: Mutex<usize>,
+    }
+
+    /// A notification that is waited on for the given milliseconds, or until it is cancelled
+    type Ignored = (Option<u64>, Option<CancelHandle>);
+
+    /// Never answers interactive notifications, answers the ones it gave up on with their
+    /// timeout, or 0 once cancelled
+    #[derive(Default)]
+    struct IgnoredCenter {
+        gave_up: Mutex<Vec<u64>>,
+    }
+
+    impl Deliver<Ignored, u64> for IgnoredCenter {
+        fn deliver_all(
+            &self,
+            notifications: &[Ignored],
+            waiters: &[Arc<Waiter<u64>>],
+        ) -> Vec<Delivery> {
+            let _ = waiters;
+            notifications
+                .iter()
+                .map(|notification| match notification {
+                    (None, None) => Delivery::Delivered,
+                    _ => Delivery::AwaitingResponse,
+                })
+                .collect()
+        }
+
+        fn detach_all(&self, _waiters: &[Arc<Waiter<u64>>]) {}
+
+        fn response_timeout(&self, notification: &Ignored) -> Option<Duration> {
+            notification.0.map(Duration::from_millis)
+        }
+
+        fn cancel_handle<'a>(&self, notification: &'a Ignored) -> Option<&'a CancelHandle> {
+            notification.1.as_ref()
+        }
+
+        fn gave_up(
+            &self,
+            notification: &Ignored,
+            _waiter: &Arc<Waiter<u64>>,
+            reason: GaveUp,
+        ) -> u64 {
+            let response = match reason {
+                GaveUp::TimedOut => notification.0.unwrap(),
+                GaveUp::Cancelled => 0,
+            };
+            self.gave_up.lock().unwrap().push(response);
+            response
+        }
+    }
+
+    impl Deliver<Option<bool>, usize> for FakeCenter {
+        fn deliver_all(
+            &self,
+            notifications: &[Option<bool>],
+            waiters: &[Arc<Waiter<usize>>],
+        ) -> Vec<Delivery> {
+            notifications
+                .iter()
+                .zip(waiters)
+                .enumerate()
+                .map(|(index, (interactive, waiter))| match interactive {
+                    None => Delivery::Failed,
+                    Some(true) => {
+                        waiter.complete(index);
+                        Delivery::AwaitingResponse
+                    }
+                    Some(false) => Delivery::Delivered,
+                })
+                .collect()
+        }
+
+        fn detach_all(&self, waiters: &[Arc<Waiter<usize>>]) {
+            *self.detached.lock().unwrap() += waiters.len();
+        }
+
+        fn response_timeout(&self, _notification: &Option<bool>) -> Option<Duration> {
+            None
+        }
+
+        fn cancel_handle<'a>(&self, _notification: &'a Option<bool>) -> Option<&'a CancelHandle> {
+            None
+        }
+
+        fn gave_up(
+            &self,
+            _notification: &Option<bool>,
+            _waiter: &Arc<Waiter<usize>>,
+            _reason: GaveUp,
+        ) -> usize {
+            unreachable!("interactive notifications are answered right away")
+        }
+    }
+
+    #[test]
+    fn responses_in_input_order() {
+        let center = FakeCenter::default();
+        let notifications = [Some(true), Some(false), Some(true)];
+        let responses = send_all(
+            &center,
+            Arc::new(NoopLoop),
+            &notifications,
+            Duration::from_millis(1),
+        );
+        assert_eq!(responses, Some(vec![Some(0), None, Some(2)]));
+        assert_eq!(*center.detached.lock().unwrap(), 3);
+    }
+
+    #[test]
+    fn failed_delivery_fails_batch() {
+        let center = FakeCenter::default();
+        let notifications = [Some(true), None];
+        assert_eq!(
+            send_all(
+                &center,
+                Arc::new(NoopLoop),
+                &notifications,
+                Duration::from_millis(1)
+            ),
+            None
+        );
+        assert_eq!(*center.detached.lock().unwrap(), 2);
+    }
+
+    #[test]
+    fn ignored_notifications_time_out_together() {
+        let center = IgnoredCenter::default();
+        let notifications = [
+            (Some(30), None),
+            (None, None),
+            (Some(20), None),
+            (Some(30), None),
+        ];
+        let start = Instant::now();
+        let responses = send_all(
+            &center,
+            Arc::new(Parker::default()),
+            &notifications,
+            Duration::from_millis(1),
+        );
+        let elapsed = start.elapsed();
+        assert_eq!(responses, Some(vec![Some(30), None, Some(20), Some(30)]));
+        assert_eq!(*center.gave_up.lock().unwrap(), vec![30, 20, 30]);
+        // the deadlines count from the delivery of the batch, not from the previous wait
+        assert!(elapsed >= Duration::from_millis(30) && elapsed < Duration::from_millis(500));
+    }
+
+    #[test]
+    fn cancelled_notifications_stop_waiting() {
+        let center = IgnoredCenter::default();
+        let cancel = CancelHandle::new();
+        let notifications = [(None, Some(cancel.clone())), (Some(20), None)];
+        let canceller = thread::spawn(move || {
+            thread::sleep(Duration::from_millis(10));
+            cancel.cancel();
+        });
+        let start = Instant::now();
+        let responses = send_all(
+            &center,
+            Arc::new(Parker::default()),
+            &notifications,
+            Duration::from_millis(1),
+        );
+        assert_eq!(responses, Some(vec![Some(0), Some(20)]));
+        assert_eq!(*center.gave_up.lock().unwrap(), vec![0, 20]);
+        assert!(start.elapsed() < Duration::from_millis(500));
+        canceller.join().unwrap();
+    }
+}
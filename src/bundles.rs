@@ -0,0 +1,446 @@
+//! Cache of the bundle identifiers of applications, by application name.
+//!
+//! Resolving a name asks the system through AppleScript, which takes hundreds of milliseconds
+//! and may launch the application. Results are kept in memory and in a file, so later runs
+//! of the process do not resolve them again. Names without an application are cached too,
+//! for a shorter time, so the system may pick up applications that were installed since.
+
+use std::collections::HashMap;
+use std::fs;
+use std::io;
+use std::path::{Path, PathBuf};
+use std::process;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex};
+use std::thread;
+use std::time::{Duration, SystemTime, UNIX_EPOCH};
+
+/// How long a resolved bundle identifier is used without resolving it again
+const TTL: Duration = Duration::from_secs(7 * 24 * 60 * 60);
+
+/// How long a name without an application is not resolved again
+const NEGATIVE_TTL: Duration = Duration::from_secs(24 * 60 * 60);
+
+/// Looks up the bundle identifier of an application by its name
+pub trait Resolve {
+    /// The bundle identifier, `None` if there is no such application
+    fn resolve(&self, app_name: &str) -> Option<String>;
+
+    /// The bundle identifiers of all names in one go, one after the other unless overridden
+    fn resolve_all(&self, app_names: &[&str]) -> Vec<Option<String>> {
+        app_names
+            .iter()
+            .map(|app_name| self.resolve(app_name))
+            .collect()
+    }
+}
+
+struct Entry {
+    bundle: Option<String>,
+    // unix time in seconds
+    resolved_at: u64,
+}
+
+/// Bundle identifiers resolved before, in memory and persisted to a file
+pub struct BundleCache<R: Resolve> {
+    resolver: Arc<R>,
+    // `None` keeps the cache in memory only
+    file: Option<PathBuf>,
+    entries: HashMap<String, Entry>,
+    loaded: bool,
+}
+
+impl<R: Resolve> BundleCache<R> {
+    /// Create a cache persisted to `file`, which is read on first use
+    pub fn new(resolver: R, file: Option<PathBuf>) -> Self {
+        BundleCache {
+            resolver: Arc::new(resolver),
+            file,
+            entries: HashMap::new(),
+            loaded: false,
+        }
+    }
+
+    /// The bundle identifier of `app_name`, resolved if it is not cached or expired.
+    ///
+    /// The cache is not held while resolving, so lookups of other names are not held up by it.
+    pub fn get(cache: &Mutex<Self>, app_name: &str) -> Option<String> {
+        if let Some(bundle) = cache.lock().unwrap().cached(app_name) {
+            return bundle;
+        }
+        let resolver = Arc::clone(&cache.lock().unwrap().resolver);
+        let bundle = resolver.resolve(app_name);
+        let mut cache = cache.lock().unwrap();
+        cache.insert(app_name, bundle.clone());
+        let _ = cache.save();
+        bundle
+    }
+
+    /// The bundle identifiers of all `app_names`, in the same order.
+    ///
+    /// Names that are not cached are resolved together, with one `resolve_all` for each of up to
+    /// `threads` threads, and the file is written once for all of them.
+    pub fn get_all(cache: &Mutex<Self>, app_names: &[&str], threads: usize) -> Vec<Option<String>>
+    where
+        R: Send + Sync + 'static,
+    {
+        let cached: Vec<Option<Option<String>>> = {
+            let mut cache = cache.lock().unwrap();
+            app_names
+                .iter()
+                .map(|app_name| cache.cached(app_name))
+                .collect()
+        };
+        let mut missing: Vec<&str> = app_names
+            .iter()
+            .zip(&cached)
+            .filter(|(_, cached)| cached.is_none())
+            .map(|(app_name, _)| *app_name)
+            .collect();
+        missing.sort();
+        missing.dedup();
+        if missing.is_empty() {
+            return cached.into_iter().map(Option::flatten).collect();
+        }
+
+        let resolver = Arc::clone(&cache.lock().unwrap().resolver);
+        let resolved = resolve_in_parallel(resolver, &missing, threads);
+        let mut cache = cache.lock().unwrap();
+        for (app_name, bundle) in missing.iter().zip(resolved) {
+            cache.insert(app_name, bundle);
+        }
+        let _ = cache.save();
+        app_names
+            .iter()
+            .zip(cached)
+            .map(|(app_name, cached)| match cached {
+                Some(bundle) => bundle,
+                None => cache
+                    .entries
+                    .get(*app_name)
+                    .and_then(|entry| entry.bundle.clone()),
+            })
+            .collect()
+    }
+
+    /// The fresh cached result for `app_name`, `Some(None)` for a name without an application
+    fn cached(&mut self, app_name: &str) -> Option<Option<String>> {
+        self.load();
+        let entry = self.entries.get(app_name)?;
+        let ttl = if entry.bundle.is_some() {
+            TTL
+        } else {
+            NEGATIVE_TTL
+        };
+        if unix_time() < entry.resolved_at.saturating_add(ttl.as_secs()) {
+            Some(entry.bundle.clone())
+        } else {
+            None
+        }
+    }
+
+    fn insert(&mut self, app_name: &str, bundle: Option<String>) {
+        let entry = Entry {
+            bundle,
+            resolved_at: unix_time(),
+        };
+        self.entries.insert(app_name.to_string(), entry);
+    }
+
+    /// Drop all cached results, in memory and in the file
+    pub(crate) fn clear(&mut self) {
+        self.entries.clear();
+        self.loaded = true;
+        if let Some(file) = &self.file {
+            let _ = fs::remove_file(file);
+        }
+    }
+
+    /// Read the entries of the file once, entries in memory take precedence
+    fn load(&mut self) {
+        if self.loaded {
+            return;
+        }
+        self.loaded = true;
+        let contents = match self.file.as_ref().map(fs::read_to_string) {
+            Some(Ok(contents)) => contents,
+            _ => return,
+        };
+        for line in contents.lines() {
+            let mut fields = line.split('\t');
+            let (resolved_at, name, bundle) = match (fields.next(), fields.next(), fields.next()) {
+                (Some(resolved_at), Some(name), Some(bundle)) => (resolved_at, name, bundle),
+                _ => continue,
+            };
+            let resolved_at = match resolved_at.parse() {
+                Ok(resolved_at) => resolved_at,
+                Err(_) => continue,
+            };
+            let bundle = if bundle.is_empty() {
+                None
+            } else {
+                Some(bundle.to_string())
+            };
+            self.entries.entry(name.to_string()).or_insert(Entry {
+                bundle,
+                resolved_at,
+            });
+        }
+    }
+
+    /// Write all entries to the file as a whole, so readers never see half of it
+    fn save(&self) -> io::Result<()> {
+        static TEMP_FILES: AtomicUsize = AtomicUsize::new(0);
+        let file = match &self.file {
+            Some(file) => file,
+            None => return Ok(()),
+        };
+        let mut contents = String::new();
+        for (name, entry) in &self.entries {
+            let bundle = entry.bundle.as_deref().unwrap_or("");
+            // names that would break the line format are only kept in memory
+            if [name.as_str(), bundle]
+                .iter()
+                .any(|field| field.contains(&['\t', '\n', '\r'][..]))
+            {
+                continue;
+            }
+            contents.push_str(&format!("{}\t{}\t{}\n", entry.resolved_at, name, bundle));
+        }
+
+        let dir = file.parent().unwrap_or_else(|| Path::new("."));
+        fs::create_dir_all(dir)?;
+        let temp = dir.join(format!(
+            ".bundle-identifiers-{}-{}.tmp",
+            process::id(),
+            TEMP_FILES.fetch_add(1, Ordering::Relaxed)
+        ));
+        fs::write(&temp, contents)?;
+        if let Err(error) = fs::rename(&temp, file) {
+            let _ = fs::remove_file(&temp);
+            return Err(error);
+        }
+        Ok(())
+    }
+}
+
+/// Split the names into up to `threads` shares and resolve each share on a thread of its own
+fn resolve_in_parallel<R: Resolve + Send + Sync + 'static>(
+    resolver: Arc<R>,
+    app_names: &[&str],
+    threads: usize,
+) -> Vec<Option<String>> {
+    let threads = threads.max(1).min(app_names.len());
+    if threads <= 1 {
+        return resolver.resolve_all(app_names);
+    }
+    let share_len = (app_names.len() - 1) / threads + 1;
+    let workers: Vec<_> = app_names
+        .chunks(share_len)
+        .map(|share| {
+            let resolver = Arc::clone(&resolver);
+            let share: Vec<String> = share.iter().map(|app_name| app_name.to_string()).collect();
+            thread::spawn(move || {
+                let share: Vec<&str> = share.iter().map(String::as_str).collect();
+                resolver.resolve_all(&share)
+            })
+        })
+        .collect();
+    let mut resolved = Vec::with_capacity(app_names.len());
+    for (worker, share) in workers.into_iter().zip(app_names.chunks(share_len)) {
+        // a share whose thread panicked is left unresolved
+        resolved.extend(worker.join().unwrap_or_else(|_| vec![None; share.len()]));
+    }
+    resolved
+}
+
+fn unix_time() -> u64 {
+    SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .map_or(0, |since| since.as_secs())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::env;
+
+    /// Knows a fixed set of applications, and counts how often it was asked
+    #[derive(Default)]
+    struct FakeResolver {
+        resolved: AtomicUsize,
+        batches: AtomicUsize,
+    }
+
+    impl Resolve for FakeResolver {
+        fn resolve(&self, app_name: &str) -> Option<String> {
+            self.resolved.fetch_add(1, Ordering::SeqCst);
+            match app_name {
+                "Safari" => Some("com.apple.Safari".into()),
+                "Terminal" => Some("com.apple.Terminal".into()),
+                _ => None,
+            }
+        }
+
+        fn resolve_all(&self, app_names: &[&str]) -> Vec<Option<String>> {
+            self.batches.fetch_add(1, Ordering::SeqCst);
+            app_names
+                .iter()
+                .map(|app_name| self.resolve(app_name))
+                .collect()
+        }
+    }
+
+    fn resolved(cache: &Mutex<BundleCache<FakeResolver>>) -> usize {
+        cache
+            .lock()
+            .unwrap()
+            .resolver
+            .resolved
+            .load(Ordering::SeqCst)
+    }
+
+    fn temp_file(name: &str) -> PathBuf {
+        let dir = env::temp_dir().join(format!("mac-notification-sys-{}-{}", name, process::id()));
+        let _ = fs::remove_dir_all(&dir);
+        dir.join("bundle-identifiers")
+    }
+
+    fn cache(file: &Path) -> Mutex<BundleCache<FakeResolver>> {
+        Mutex::new(BundleCache::new(
+            FakeResolver::default(),
+            Some(file.to_path_buf()),
+        ))
+    }
+
+    #[test]
+    fn resolves_each_name_once_across_runs() {
+        let file = temp_file("bundles-runs");
+        let first_run = cache(&file);
+        for _ in 0..2 {
+            assert_eq!(
+                BundleCache::get(&first_run, "Safari").as_deref(),
+                Some("com.apple.Safari")
+            );
+            assert_eq!(BundleCache::get(&first_run, "use_default"), None);
+        }
+        assert_eq!(resolved(&first_run), 2);
+
+        let second_run = cache(&file);
+        assert_eq!(
+            BundleCache::get(&second_run, "Safari").as_deref(),
+            Some("com.apple.Safari")
+        );
+        assert_eq!(BundleCache::get(&second_run, "use_default"), None);
+        assert_eq!(resolved(&second_run), 0);
+
+        second_run.lock().unwrap().clear();
+        assert!(!file.exists());
+        assert_eq!(BundleCache::get(&second_run, "use_default"), None);
+        assert_eq!(resolved(&second_run), 1);
+        fs::remove_dir_all(file.parent().unwrap()).unwrap();
+    }
+
+    #[test]
+    fn expired_entries_are_resolved_again() {
+        let file = temp_file("bundles-expired");
+        fs::create_dir_all(file.parent().unwrap()).unwrap();
+        let now = unix_time();
+        let contents = format!(
+            "{}\tSafari\tcom.apple.Safari\n{}\tTerminal\tcom.example.Outdated\n{}\tSlack\t\n{}\tZoom\t\nnot an entry\n",
+            now,
+            now - TTL.as_secs() - 1,
+            now,
+            now - NEGATIVE_TTL.as_secs() - 1,
+        );
+        fs::write(&file, contents).unwrap();
+        let cache = cache(&file);
+
+        assert_eq!(
+            BundleCache::get(&cache, "Safari").as_deref(),
+            Some("com.apple.Safari")
+        );
+        assert_eq!(BundleCache::get(&cache, "Slack"), None);
+        assert_eq!(resolved(&cache), 0);
+
+        assert_eq!(
+            BundleCache::get(&cache, "Terminal").as_deref(),
+            Some("com.apple.Terminal")
+        );
+        assert_eq!(BundleCache::get(&cache, "Zoom"), None);
+        assert_eq!(resolved(&cache), 2);
+        fs::remove_dir_all(file.parent().unwrap()).unwrap();
+    }
+
+    #[test]
+    fn names_that_break_the_file_stay_in_memory() {
+        let file = temp_file("bundles-names");
+        let first_run = cache(&file);
+        assert_eq!(BundleCache::get(&first_run, "Two\nLines"), None);
+        assert_eq!(
+            BundleCache::get(&first_run, "Terminal").as_deref(),
+            Some("com.apple.Terminal")
+        );
+        assert_eq!(BundleCache::get(&first_run, "Two\nLines"), None);
+        assert_eq!(resolved(&first_run), 2);
+
+        let second_run = cache(&file);
+        assert_eq!(BundleCache::get(&second_run, "Two\nLines"), None);
+        assert_eq!(
+            BundleCache::get(&second_run, "Terminal").as_deref(),
+            Some("com.apple.Terminal")
+        );
+        assert_eq!(resolved(&second_run), 1);
+        fs::remove_dir_all(file.parent().unwrap()).unwrap();
+    }
+
+    #[test]
+    fn resolves_missing_names_together() {
+        let file = temp_file("bundles-batch");
+        let cache = cache(&file);
+        assert_eq!(
+            BundleCache::get(&cache, "Terminal").as_deref(),
+            Some("com.apple.Terminal")
+        );
+
+        let names = ["Safari", "Zoom", "Terminal", "Safari", "Slack"];
+        let expected = vec![
+            Some("com.apple.Safari".to_string()),
+            None,
+            Some("com.apple.Terminal".to_string()),
+            Some("com.apple.Safari".to_string()),
+            None,
+        ];
+        assert_eq!(BundleCache::get_all(&cache, &names, 1), expected);
+        // Terminal was cached, Safari is resolved once
+        assert_eq!(resolved(&cache), 4);
+        assert_eq!(
+            cache
+                .lock()
+                .unwrap()
+                .resolver
+                .batches
+                .load(Ordering::SeqCst),
+            1
+        );
+        assert_eq!(BundleCache::get_all(&cache, &names, 1), expected);
+        assert_eq!(resolved(&cache), 4);
+
+        let next_run = self::cache(&file);
+        assert_eq!(BundleCache::get_all(&next_run, &names, 2), expected);
+        assert_eq!(resolved(&next_run), 0);
+        next_run.lock().unwrap().clear();
+        assert_eq!(BundleCache::get_all(&next_run, &names, 2), expected);
+        assert_eq!(resolved(&next_run), 4);
+        assert_eq!(
+            next_run
+                .lock()
+                .unwrap()
+                .resolver
+                .batches
+                .load(Ordering::SeqCst),
+            2
+        );
+        fs::remove_dir_all(file.parent().unwrap()).unwrap();
+    }
+}
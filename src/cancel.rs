@@ -0,0 +1,229 @@
+//! Cancelling sends that wait for the user to respond.
+//!
+//! A `CancelHandle` is a flag shared by the sending thread and whoever cancels it. While
+//! waiting, the sending thread keeps its event loop in the handle's list of loops to wake,
+//! and takes it out again once the wait returns. Cancelling sets the flag and wakes every
+//! loop in the list, it only holds the list's lock for that and never waits for the sending
+//! thread, which takes the notification off the screen itself.
+
+use crate::wait::{EventLoop, Waiter};
+use std::fmt;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Arc, Mutex};
+use std::time::Instant;
+
+/// The event loops of the sends that are waiting on the handle, by the id of their wait
+#[derive(Default)]
+struct Watchers {
+    next_id: u64,
+    event_loops: Vec<(u64, Arc<dyn EventLoop>)>,
+}
+
+#[derive(Default)]
+struct Cancellation {
+    cancelled: AtomicBool,
+    watchers: Mutex<Watchers>,
+}
+
+/// Takes the event loop of a wait out of the list once the wait returns
+pub(crate) struct Watch {
+    cancellation: Arc<Cancellation>,
+    id: u64,
+}
+
+impl Drop for Watch {
+    fn drop(&mut self) {
+        let mut watchers = self.cancellation.watchers.lock().unwrap();
+        let id = self.id;
+        if let Some(index) = watchers
+            .event_loops
+            .iter()
+            .position(|(watch, _)| *watch == id)
+        {
+            watchers.event_loops.swap_remove(index);
+        }
+    }
+}
+
+/// Cancels the sends of the notifications it was passed to, from any thread
+///
+/// See [`Notification::cancel_handle`]. Clones cancel the same sends.
+///
+/// [`Notification::cancel_handle`]: crate::Notification::cancel_handle
+///
+/// # Example:
+///
+/// ```no_run
+/// # use mac_notification_sys::*;
+/// # use std::thread;
+/// let cancel = CancelHandle::new();
+/// let approved_elsewhere = {
+///     let cancel = cancel.clone();
+///     thread::spawn(move || cancel.cancel())
+/// };
+/// let response = send_notification(
+///     "Deploy",
+///     None,
+///     "Approve deployment?",
+///     Some(
+///         Notification::new()
+///             .main_button(MainButton::SingleAction("Approve"))
+///             .cancel_handle(&cancel),
+///     ),
+/// );
+/// # let _ = (response, approved_elsewhere);
+/// ```
+#[derive(Clone)]
+pub struct CancelHandle {
+    inner: Arc<Cancellation>,
+}
+
+impl Default for CancelHandle {
+    fn default() -> Self {
+        CancelHandle {
+            inner: Arc::new(Cancellation::default()),
+        }
+    }
+}
+
+// Handles are equal when they cancel the same sends
+impl PartialEq for CancelHandle {
+    fn eq(&self, other: &Self) -> bool {
+        Arc::ptr_eq(&self.inner, &other.inner)
+    }
+}
+
+impl Eq for CancelHandle {}
+
+impl fmt::Debug for CancelHandle {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("CancelHandle")
+            .field("cancelled", &self.is_cancelled())
+            .finish()
+    }
+}
+
+impl CancelHandle {
+    /// Create a handle that has not been cancelled yet
+    pub fn new() -> Self {
+        Default::default()
+    }
+
+    /// Stop waiting for the user to respond, the sends return `NotificationResponse::Cancelled`
+    ///
+    /// Sends that already returned are not affected, later sends return right away.
+    /// Cancelling more than once does nothing.
+    pub fn cancel(&self) {
+        if self.inner.cancelled.swap(true, Ordering::SeqCst) {
+            return;
+        }
+        let watchers = self.inner.watchers.lock().unwrap();
+        for (_, event_loop) in &watchers.event_loops {
+            event_loop.wake();
+        }
+    }
+
+    /// Whether `cancel` has been called
+    pub fn is_cancelled(&self) -> bool {
+        self.inner.cancelled.load(Ordering::SeqCst)
+    }
+
+    /// Wait like `Waiter::wait`, and also return `None` once the handle is cancelled
+    #[doc(hidden)]
+    pub fn wait<T>(&self, waiter: &Waiter<T>, deadline: Option<Instant>) -> Option<T> {
+        let _watch = waiter.event_loop().map(|event_loop| self.watch(event_loop));
+        waiter.wait_unless(deadline, || self.is_cancelled())
+    }
+
+    /// Wake the given event loop on cancellation until the returned watch is dropped
+    ///
+    /// Either `cancel` finds the new entry, or the flag it set before taking the lock is
+    /// seen by the waiting thread before it blocks.
+    pub(crate) fn watch(&self, event_loop: &Arc<dyn EventLoop>) -> Watch {
+        let mut watchers = self.inner.watchers.lock().unwrap();
+        let id = watchers.next_id;
+        watchers.next_id += 1;
+        watchers.event_loops.push((id, Arc::clone(event_loop)));
+        Watch {
+            cancellation: Arc::clone(&self.inner),
+            id,
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::wait::Parker;
+    use std::thread;
+    use std::time::Duration;
+
+    fn waiter() -> Waiter<u32> {
+        Waiter::new(Arc::new(Parker::default()))
+    }
+
+    #[test]
+    fn cancel_wakes_the_waiting_thread() {
+        let cancel = CancelHandle::new();
+        let canceller = {
+            let cancel = cancel.clone();
+            thread::spawn(move || {
+                thread::sleep(Duration::from_millis(5));
+                cancel.cancel();
+                cancel.cancel();
+            })
+        };
+
+        let start = Instant::now();
+        assert_eq!(cancel.wait(&waiter(), None), None);
+        assert!(start.elapsed() < Duration::from_secs(1));
+        assert!(cancel.is_cancelled());
+        canceller.join().unwrap();
+    }
+
+    #[test]
+    fn responses_and_deadlines_still_count() {
+        let cancel = CancelHandle::new();
+        let answered = waiter();
+        answered.complete(1);
+        assert_eq!(cancel.wait(&answered, None), Some(1));
+
+        let deadline = Instant::now() + Duration::from_millis(20);
+        assert_eq!(cancel.wait(&waiter(), Some(deadline)), None);
+        assert!(Instant::now() >= deadline && !cancel.is_cancelled());
+
+        // a handle cancelled before the send makes it return right away
+        cancel.cancel();
+        assert_eq!(cancel.wait(&waiter(), None), None);
+    }
+
+    #[test]
+    fn one_handle_cancels_many_threads() {
+        let cancel = CancelHandle::new();
+        let waiting: Vec<_> = (0..8)
+            .map(|_| {
+                let cancel = cancel.clone();
+                thread::spawn(move || cancel.wait(&waiter(), None))
+            })
+            .collect();
+        thread::sleep(Duration::from_millis(5));
+        cancel.cancel();
+        for waiting in waiting {
+            assert_eq!(waiting.join().unwrap(), None);
+        }
+        assert!(cancel.inner.watchers.lock().unwrap().event_loops.is_empty());
+    }
+
+    #[test]
+    fn finished_waits_leave_no_event_loop_behind() {
+        let cancel = CancelHandle::new();
+        for value in 0..1_000 {
+            let answered = waiter();
+            answered.complete(value);
+            assert_eq!(cancel.wait(&answered, None), Some(value));
+            let deadline = Instant::now();
+            assert_eq!(cancel.wait(&waiter(), Some(deadline)), None);
+        }
+        assert!(cancel.inner.watchers.lock().unwrap().event_loops.is_empty());
+    }
+}
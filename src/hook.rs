@@ -0,0 +1,128 @@
+//! One-time installation of the NSBundle hook.
+//!
+//! Swapping the `bundleIdentifier` implementation is its own inverse, so installing
+//! the hook a second time would remove it again. `HookGuard` makes sure the exchange
+//! happens exactly once per process.
+
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::thread;
+
+const UNINSTALLED: usize = 0;
+const INSTALLING: usize = 1;
+const INSTALLED: usize = 2;
+
+/// The class table the hook is installed into
+pub(crate) trait ClassTable {
+    /// Exchange the implementations of `bundleIdentifier` and the hook.
+    ///
+    /// Returns `false` if the class could not be found.
+    fn exchange_implementations(&self) -> bool;
+}
+
+/// Lock-free guard around the installation of the hook
+pub(crate) struct HookGuard {
+    state: AtomicUsize,
+}
+
+impl HookGuard {
+    /// Create a guard for a hook that has not been installed yet
+    pub(crate) const fn new() -> Self {
+        HookGuard {
+            state: AtomicUsize::new(UNINSTALLED),
+        }
+    }
+
+    /// Install the hook unless it already is.
+    ///
+    /// Concurrent callers wait until the installing thread is done, and retry if it failed.
+    pub(crate) fn install(&self, classes: &dyn ClassTable) -> bool {
+        loop {
+            match self.state.compare_exchange(
+                UNINSTALLED,
+                INSTALLING,
+                Ordering::Acquire,
+                Ordering::Acquire,
+            ) {
+                Ok(_) => {
+                    let installed = classes.exchange_implementations();
+                    let state = if installed { INSTALLED } else { UNINSTALLED };
+                    self.state.store(state, Ordering::Release);
+                    return installed;
+                }
+                Err(INSTALLING) => thread::yield_now(),
+                Err(_) => return true,
+            }
+        }
+    }
+
+    /// Whether the hook is currently installed
+    pub(crate) fn is_active(&self) -> bool {
+        self.state.load(Ordering::Acquire) == INSTALLED
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::atomic::AtomicBool;
+    use std::sync::Arc;
+
+    /// Stand-in for the Objective C runtime that counts exchanges
+    #[derive(Default)]
+    struct FakeClassTable {
+        missing: AtomicBool,
+        exchanges: AtomicUsize,
+    }
+
+    impl ClassTable for FakeClassTable {
+        fn exchange_implementations(&self) -> bool {
+            if self.missing.load(Ordering::SeqCst) {
+                return false;
+            }
+            self.exchanges.fetch_add(1, Ordering::SeqCst);
+            true
+        }
+    }
+
+    #[test]
+    fn installs_once() {
+        let guard = HookGuard::new();
+        let classes = FakeClassTable::default();
+        assert!(!guard.is_active());
+        assert!(guard.install(&classes));
+        assert!(guard.install(&classes));
+        assert!(guard.is_active());
+        assert_eq!(classes.exchanges.load(Ordering::SeqCst), 1);
+    }
+
+    #[test]
+    fn installs_once_across_threads() {
+        let guard = Arc::new(HookGuard::new());
+        let classes = Arc::new(FakeClassTable::default());
+        let threads: Vec<_> = (0..8)
+            .map(|_| {
+                let guard = Arc::clone(&guard);
+                let classes = Arc::clone(&classes);
+                thread::spawn(move || guard.install(&*classes))
+            })
+            .collect();
+
+        for thread in threads {
+            assert!(thread.join().unwrap());
+        }
+        assert_eq!(classes.exchanges.load(Ordering::SeqCst), 1);
+    }
+
+    #[test]
+    fn missing_class_can_be_retried() {
+        let guard = HookGuard::new();
+        let classes = FakeClassTable::default();
+        classes.missing.store(true, Ordering::SeqCst);
+        assert!(!guard.install(&classes));
+        assert!(!guard.is_active());
+
+        classes.missing.store(false, Ordering::SeqCst);
+        assert!(guard.install(&classes));
+        assert_eq!(classes.exchanges.load(Ordering::SeqCst), 1);
+    }
+}
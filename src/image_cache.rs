@@ -0,0 +1,584 @@
+//! Cache of decoded images for app icons and content images.
+//!
+//! Images are keyed by their path and stay valid as long as the modification time and size
+//! of the file do not change. The least recently used images are dropped once the decoded
+//! images take more than the byte budget.
+//! With a maximum pixel size set, images are decoded as thumbnails of that size instead,
+//! and the thumbnails are what is cached.
+//!
+//! Images are decoded without holding the cache, so they can be prefetched on other threads.
+//! An image that is being decoded is not decoded a second time, whoever needs it waits for it.
+
+use std::borrow::Cow;
+use std::collections::{BTreeMap, HashMap};
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::sync::{Arc, Condvar, Mutex};
+use std::time::{Duration, Instant, SystemTime};
+
+/// Decodes image files for the cache
+pub trait Decode {
+    /// Handle to a decoded image
+    type Image: Clone;
+
+    /// Decode the image file at most `max_pixel_size` wide and high,
+    /// returns the image and the bytes it takes in memory
+    fn decode(&self, path: &Path, max_pixel_size: Option<u32>) -> Option<(Self::Image, usize)>;
+}
+
+/// Counters of the image cache, see `image_cache_stats`
+#[derive(Clone, Copy, Debug, Default, PartialEq)]
+pub struct ImageCacheStats {
+    /// Images that were taken from the cache when sending
+    pub hits: u64,
+    /// Images that had to be decoded when sending
+    pub misses: u64,
+    /// Images that were decoded ahead of time by a prefetch
+    pub prefetches: u64,
+    /// Images whose prefetch was still running when sending, so the send waited for it
+    pub waits: u64,
+    /// Time spent decoding images, whether when sending or prefetching
+    pub decode_time: Duration,
+    /// Time sends spent waiting for prefetches that were still running
+    pub wait_time: Duration,
+    /// Images currently in the cache
+    pub images: usize,
+    /// Bytes the cached images take in memory
+    pub bytes: usize,
+}
+
+/// What a cached image was decoded from
+#[derive(Clone, Copy, PartialEq)]
+struct FileStamp {
+    modified: Option<SystemTime>,
+    len: u64,
+}
+
+impl FileStamp {
+    fn of(path: &Path) -> Option<Self> {
+        let metadata = fs::metadata(path).ok()?;
+        Some(FileStamp {
+            modified: metadata.modified().ok(),
+            len: metadata.len(),
+        })
+    }
+}
+
+struct Entry<I> {
+    image: I,
+    stamp: FileStamp,
+    bytes: usize,
+    last_used: u64,
+}
+
+/// An image that is being decoded, any number of threads can wait for it
+pub(crate) struct Decoding<I> {
+    // `Some` once done, holding `None` if the image could not be decoded
+    image: Mutex<Option<Option<I>>>,
+    done: Condvar,
+}
+
+impl<I: Clone> Decoding<I> {
+    fn new() -> Self {
+        Decoding {
+            image: Mutex::new(None),
+            done: Condvar::new(),
+        }
+    }
+
+    fn complete(&self, image: Option<I>) {
+        *self.image.lock().unwrap() = Some(image);
+        self.done.notify_all();
+    }
+
+    /// Whether decoding is done
+    pub(crate) fn is_complete(&self) -> bool {
+        self.image.lock().unwrap().is_some()
+    }
+
+    /// Block until decoding is done, returns the image if it could be decoded
+    pub(crate) fn wait(&self) -> Option<I> {
+        let mut image = self.image.lock().unwrap();
+        while image.is_none() {
+            image = self.done.wait(image).unwrap();
+        }
+        image.clone().and_then(|image| image)
+    }
+}
+
+/// Where an image that was looked up comes from
+pub(crate) enum Lookup<D: Decode> {
+    /// The cached image, `None` if the file does not exist
+    Ready(Option<D::Image>),
+    /// Someone else is decoding the image
+    Decoding(Arc<Decoding<D::Image>>),
+    /// Nobody is decoding the image yet, the caller has to run the job
+    Decode(DecodeJob<D>),
+}
+
+/// Decodes an image without holding the cache, and puts it into the cache when done
+pub(crate) struct DecodeJob<D: Decode> {
+    decoder: Arc<D>,
+    path: PathBuf,
+    stamp: FileStamp,
+    max_pixel_size: Option<u32>,
+    decoding: Arc<Decoding<D::Image>>,
+}
+
+impl<D: Decode> DecodeJob<D> {
+    /// Completed once the job was run
+    pub(crate) fn decoding(&self) -> &Arc<Decoding<D::Image>> {
+        &self.decoding
+    }
+
+    /// Decode the image and hand it to the cache and everyone waiting for it
+    pub(crate) fn run(self, cache: &Mutex<ImageCache<D>>) -> Option<D::Image> {
+        let start = Instant::now();
+        let decoded = self.decoder.decode(&self.path, self.max_pixel_size);
+        cache.lock().unwrap().finish(self, decoded, start.elapsed())
+    }
+}
+
+/// Bounded least recently used cache of decoded images
+pub struct ImageCache<D: Decode> {
+    decoder: Arc<D>,
+    budget: usize,
+    max_pixel_size: Option<u32>,
+    bytes: usize,
+    entries: HashMap<PathBuf, Entry<D::Image>>,
+    // last use of every entry, the first one is evicted first
+    recency: BTreeMap<u64, PathBuf>,
+    // images that are being decoded right now
+    decoding: HashMap<PathBuf, Arc<Decoding<D::Image>>>,
+    clock: u64,
+    stats: ImageCacheStats,
+}
+
+impl<D: Decode> ImageCache<D> {
+    /// Create an empty cache that holds at most `budget` bytes of decoded images
+    pub fn new(decoder: D, budget: usize) -> Self {
+        ImageCache {
+            decoder: Arc::new(decoder),
+            budget,
+            max_pixel_size: None,
+            bytes: 0,
+            entries: HashMap::new(),
+            recency: BTreeMap::new(),
+            decoding: HashMap::new(),
+            clock: 0,
+            stats: ImageCacheStats::default(),
+        }
+    }
+
+    /// The decoded image at `path` for a send, decoded anew if the file changed since it was cached.
+    ///
+    /// Waits for the image if it is being prefetched. The cache is not held while decoding or waiting.
+    /// Returns `None` if the file does not exist or could not be decoded.
+    pub fn get(cache: &Mutex<Self>, path: &Path) -> Option<D::Image> {
+        let lookup = cache.lock().unwrap().lookup(path, false);
+        match lookup {
+            Lookup::Ready(image) => image,
+            Lookup::Decoding(decoding) => {
+                let start = Instant::now();
+                let image = decoding.wait();
+                cache.lock().unwrap().stats.wait_time += start.elapsed();
+                image
+            }
+            Lookup::Decode(job) => job.run(cache),
+        }
+    }
+
+    /// Look up the image at `path` for a send, or for a prefetch if `prefetch` is set
+    pub(crate) fn lookup(&mut self, path: &Path, prefetch: bool) -> Lookup<D> {
+        let stamp = match FileStamp::of(path) {
+            Some(stamp) => stamp,
+            None => return Lookup::Ready(None),
+        };
+
+        if let Some(entry) = self.entries.get_mut(path) {
+            if entry.stamp == stamp {
+                self.clock += 1;
+                self.recency.remove(&entry.last_used);
+                self.recency.insert(self.clock, path.to_path_buf());
+                entry.last_used = self.clock;
+                if !prefetch {
+                    self.stats.hits += 1;
+                }
+                return Lookup::Ready(Some(entry.image.clone()));
+            }
+        }
+
+        if let Some(decoding) = self.decoding.get(path) {
+            if !prefetch {
+                self.stats.waits += 1;
+            }
+            return Lookup::Decoding(Arc::clone(decoding));
+        }
+
+        if prefetch {
+            self.stats.prefetches += 1;
+        } else {
+            self.stats.misses += 1;
+        }
+        self.invalidate(path);
+        let decoding = Arc::new(Decoding::new());
+        self.decoding
+            .insert(path.to_path_buf(), Arc::clone(&decoding));
+        Lookup::Decode(DecodeJob {
+            decoder: Arc::clone(&self.decoder),
+            path: path.to_path_buf(),
+            stamp,
+            max_pixel_size: self.max_pixel_size,
+            decoding,
+        })
+    }
+
+    /// Cache the image decoded by the job, unless the cache was cleared in the meantime
+    fn finish(
+        &mut self,
+        job: DecodeJob<D>,
+        decoded: Option<(D::Image, usize)>,
+        took: Duration,
+    ) -> Option<D::Image> {
+        self.stats.decode_time += took;
+        let current = match self.decoding.get(&job.path) {
+            Some(decoding) => Arc::ptr_eq(decoding, &job.decoding),
+            None => false,
+        };
+        if current {
+            self.decoding.remove(&job.path);
+        }
+
+        let image = decoded.map(|(image, bytes)| {
+            if current && job.max_pixel_size == self.max_pixel_size && bytes <= self.budget {
+                self.clock += 1;
+                self.bytes += bytes;
+                self.recency.insert(self.clock, job.path.clone());
+                self.entries.insert(
+                    job.path.clone(),
+                    Entry {
+                        image: image.clone(),
+                        stamp: job.stamp,
+                        bytes,
+                        last_used: self.clock,
+                    },
+                );
+                self.evict();
+            }
+            image
+        });
+        job.decoding.complete(image.clone());
+        image
+    }
+
+    /// Change the byte budget, drops images until the cache fits into it
+    pub(crate) fn set_budget(&mut self, budget: usize) {
+        self.budget = budget;
+        self.evict();
+    }
+
+    /// The size images are scaled down to, `None` for full resolution
+    pub(crate) fn max_pixel_size(&self) -> Option<u32> {
+        self.max_pixel_size
+    }
+
+    /// Change the size images are scaled down to, drops all images if it changed
+    pub fn set_max_pixel_size(&mut self, max_pixel_size: Option<u32>) {
+        if self.max_pixel_size != max_pixel_size {
+            self.max_pixel_size = max_pixel_size;
+            self.clear();
+        }
+    }
+
+    /// Drop the image of the given path, so it is decoded again on the next use
+    pub(crate) fn invalidate(&mut self, path: &Path) {
+        self.decoding.remove(path);
+        if let Some(entry) = self.entries.remove(path) {
+            self.recency.remove(&entry.last_used);
+            self.bytes -= entry.bytes;
+        }
+    }
+
+    /// Drop all images, images that are being decoded are not cached once they are done
+    pub(crate) fn clear(&mut self) {
+        self.entries.clear();
+        self.recency.clear();
+        self.decoding.clear();
+        self.bytes = 0;
+    }
+
+    /// Current counters of the cache
+    pub(crate) fn stats(&self) -> ImageCacheStats {
+        ImageCacheStats {
+            images: self.entries.len(),
+            bytes: self.bytes,
+            ..self.stats
+        }
+    }
+
+    fn evict(&mut self) {
+        while self.bytes > self.budget {
+            let oldest = match self.recency.keys().next() {
+                Some(&oldest) => oldest,
+                None => break,
+            };
+            if let Some(path) = self.recency.remove(&oldest) {
+                if let Some(entry) = self.entries.remove(&path) {
+                    self.bytes -= entry.bytes;
+                }
+            }
+        }
+    }
+}
+
+/// The path of an image given as a path or a `file://` URL, `None` for remote URLs
+///
+/// URLs are percent-decoded, paths are taken as they are.
+pub(crate) fn local_path(url: &str) -> Option<Cow<'_, Path>> {
+    let mut parts = url.splitn(2, "://");
+    match (parts.next(), parts.next()) {
+        (Some("file"), Some(path)) => Some(match percent_decode(path) {
+            Cow::Borrowed(path) => Cow::Borrowed(Path::new(path)),
+            Cow::Owned(path) => Cow::Owned(PathBuf::from(path)),
+        }),
+        (_, Some(_)) => None,
+        _ => Some(Cow::Borrowed(Path::new(url))),
+    }
+}
+
+/// Decode the `%XX` escapes of the path of an URL
+///
+/// Malformed escapes are kept as they are, and so is a path that does not decode to UTF-8.
+fn percent_decode(path: &str) -> Cow<'_, str> {
+    if !path.contains('%') {
+        return Cow::Borrowed(path);
+    }
+    let hex = |digit: u8| (digit as char).to_digit(16).map(|value| value as u8);
+    let bytes = path.as_bytes();
+    let mut decoded = Vec::with_capacity(bytes.len());
+    let mut at = 0;
+    while at < bytes.len() {
+        let escaped = match (bytes[at], bytes.get(at + 1), bytes.get(at + 2)) {
+            (b'%', Some(&high), Some(&low)) => {
+                hex(high).and_then(|high| Some(high << 4 | hex(low)?))
+            }
+            _ => None,
+        };
+        match escaped {
+            Some(byte) => {
+                decoded.push(byte);
+                at += 3;
+            }
+            None => {
+                decoded.push(bytes[at]);
+                at += 1;
+            }
+        }
+    }
+    match String::from_utf8(decoded) {
+        Ok(decoded) => Cow::Owned(decoded),
+        Err(_) => Cow::Borrowed(path),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::env;
+    use std::process;
+    use std::sync::atomic::{AtomicUsize, Ordering};
+    use std::sync::mpsc::{self, Receiver};
+    use std::thread;
+
+    /// "Decodes" a file to its contents, which take as many bytes as the file is long.
+    /// Thumbnails are the first `max_pixel_size` characters.
+    #[derive(Default)]
+    struct FakeDecoder {
+        decoded: AtomicUsize,
+        // decoding blocks until it receives a go-ahead
+        gate: Option<Mutex<Receiver<()>>>,
+    }
+
+    impl Decode for FakeDecoder {
+        type Image = String;
+
+        fn decode(&self, path: &Path, max_pixel_size: Option<u32>) -> Option<(String, usize)> {
+            if let Some(gate) = &self.gate {
+                gate.lock().unwrap().recv().unwrap();
+            }
+            self.decoded.fetch_add(1, Ordering::SeqCst);
+            let mut contents = fs::read_to_string(path).ok()?;
+            if let Some(max_pixel_size) = max_pixel_size {
+                contents.truncate(max_pixel_size as usize);
+            }
+            let bytes = contents.len();
+            Some((contents, bytes))
+        }
+    }
+
+    fn decoded(cache: &Mutex<ImageCache<FakeDecoder>>) -> usize {
+        cache.lock().unwrap().decoder.decoded.load(Ordering::SeqCst)
+    }
+
+    fn temp_dir(name: &str) -> PathBuf {
+        let dir = env::temp_dir().join(format!("mac-notification-sys-{}-{}", name, process::id()));
+        let _ = fs::remove_dir_all(&dir);
+        fs::create_dir_all(&dir).unwrap();
+        dir
+    }
+
+    #[test]
+    fn hits_until_file_changes() {
+        let dir = temp_dir("image-cache-hits");
+        let icon = dir.join("icon.png");
+        fs::write(&icon, "icon").unwrap();
+        let cache = Mutex::new(ImageCache::new(FakeDecoder::default(), 100));
+
+        assert_eq!(ImageCache::get(&cache, &icon).as_deref(), Some("icon"));
+        assert_eq!(ImageCache::get(&cache, &icon).as_deref(), Some("icon"));
+        assert_eq!(decoded(&cache), 1);
+
+        fs::write(&icon, "new icon").unwrap();
+        assert_eq!(ImageCache::get(&cache, &icon).as_deref(), Some("new icon"));
+        let stats = cache.lock().unwrap().stats();
+        assert_eq!((stats.hits, stats.misses), (1, 2));
+        assert_eq!((stats.images, stats.bytes), (1, 8));
+
+        cache.lock().unwrap().invalidate(&icon);
+        assert_eq!(ImageCache::get(&cache, &icon).as_deref(), Some("new icon"));
+        assert_eq!(decoded(&cache), 3);
+        fs::remove_dir_all(dir).unwrap();
+    }
+
+    #[test]
+    fn evicts_least_recently_used() {
+        let dir = temp_dir("image-cache-evicts");
+        let paths: Vec<PathBuf> = ["a", "b", "c"].iter().map(|name| dir.join(name)).collect();
+        for path in &paths {
+            fs::write(path, "1234").unwrap();
+        }
+        let cache = Mutex::new(ImageCache::new(FakeDecoder::default(), 8));
+        let get = |index: usize| ImageCache::get(&cache, &paths[index]);
+
+        get(0);
+        get(1);
+        get(0);
+        get(2);
+        assert_eq!(cache.lock().unwrap().stats().images, 2);
+        assert_eq!(cache.lock().unwrap().stats().bytes, 8);
+
+        // b was used least recently and had to go
+        get(0);
+        get(2);
+        assert_eq!(decoded(&cache), 3);
+        get(1);
+        assert_eq!(decoded(&cache), 4);
+
+        cache.lock().unwrap().set_budget(4);
+        assert_eq!(cache.lock().unwrap().stats().images, 1);
+        fs::remove_dir_all(dir).unwrap();
+    }
+
+    #[test]
+    fn caches_thumbnails_of_the_maximum_size() {
+        let dir = temp_dir("image-cache-thumbnails");
+        let screenshot = dir.join("screenshot.png");
+        fs::write(&screenshot, "full resolution").unwrap();
+        let cache = Mutex::new(ImageCache::new(FakeDecoder::default(), 100));
+        ImageCache::get(&cache, &screenshot);
+
+        cache.lock().unwrap().set_max_pixel_size(Some(4));
+        assert_eq!(cache.lock().unwrap().stats().images, 0);
+        assert_eq!(
+            ImageCache::get(&cache, &screenshot).as_deref(),
+            Some("full")
+        );
+        assert_eq!(
+            ImageCache::get(&cache, &screenshot).as_deref(),
+            Some("full")
+        );
+        assert_eq!(cache.lock().unwrap().stats().bytes, 4);
+
+        // setting the same size keeps the thumbnails
+        cache.lock().unwrap().set_max_pixel_size(Some(4));
+        ImageCache::get(&cache, &screenshot);
+        assert_eq!(decoded(&cache), 2);
+        fs::remove_dir_all(dir).unwrap();
+    }
+
+    #[test]
+    fn send_waits_for_running_prefetch() {
+        let dir = temp_dir("image-cache-prefetch");
+        let image = dir.join("chart.png");
+        fs::write(&image, "chart").unwrap();
+        let (go, gate) = mpsc::channel();
+        let decoder = FakeDecoder {
+            gate: Some(Mutex::new(gate)),
+            ..FakeDecoder::default()
+        };
+        let cache = Arc::new(Mutex::new(ImageCache::new(decoder, 100)));
+
+        let job = match cache.lock().unwrap().lookup(&image, true) {
+            Lookup::Decode(job) => job,
+            _ => panic!("nothing to prefetch"),
+        };
+        let prefetched = Arc::clone(job.decoding());
+        let prefetch = {
+            let cache = Arc::clone(&cache);
+            thread::spawn(move || job.run(&cache))
+        };
+        // a second prefetch joins the first one
+        assert!(matches!(
+            cache.lock().unwrap().lookup(&image, true),
+            Lookup::Decoding(_)
+        ));
+
+        // the send does not decode again, it waits for the prefetch
+        let send = {
+            let cache = Arc::clone(&cache);
+            let image = image.clone();
+            thread::spawn(move || ImageCache::get(&cache, &image))
+        };
+        while cache.lock().unwrap().stats().waits == 0 {
+            thread::yield_now();
+        }
+        go.send(()).unwrap();
+        assert_eq!(send.join().unwrap().as_deref(), Some("chart"));
+        assert_eq!(prefetch.join().unwrap().as_deref(), Some("chart"));
+        assert!(prefetched.is_complete());
+
+        let stats = cache.lock().unwrap().stats();
+        assert_eq!((stats.prefetches, stats.waits, stats.misses), (1, 1, 0));
+        assert_eq!(decoded(&cache), 1);
+        fs::remove_dir_all(dir).unwrap();
+    }
+
+    #[test]
+    fn remote_urls_are_not_cached() {
+        let path = |url| local_path(url).map(Cow::into_owned);
+        assert_eq!(path("/tmp/icon.png"), Some(PathBuf::from("/tmp/icon.png")));
+        assert_eq!(
+            path("file:///tmp/icon.png"),
+            Some(PathBuf::from("/tmp/icon.png"))
+        );
+        assert_eq!(path("https://example.com/icon.png"), None);
+
+        // URLs are percent-decoded, paths are not
+        assert_eq!(
+            path("file:///Users/me/My%20Icon%e2%9C%93.png"),
+            Some(PathBuf::from("/Users/me/My Icon\u{2713}.png"))
+        );
+        assert_eq!(
+            path("/tmp/100%25.png"),
+            Some(PathBuf::from("/tmp/100%25.png"))
+        );
+        assert_eq!(
+            path("file:///tmp/100%.png"),
+            Some(PathBuf::from("/tmp/100%.png"))
+        );
+        assert_eq!(
+            path("file:///tmp/%ff%zz.png"),
+            Some(PathBuf::from("/tmp/%ff%zz.png"))
+        );
+    }
+}
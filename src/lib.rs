@@ -6,40 +6,876 @@
     unused_import_braces,
     unused_qualifications
 )]
-#![cfg(target_os = "macos")]
-#![allow(improper_ctypes)]
+#![cfg_attr(target_os = "macos", allow(improper_ctypes))]
 
+#[cfg_attr(not(target_os = "macos"), allow(dead_code))]
+mod app_index;
+#[cfg_attr(not(target_os = "macos"), allow(dead_code))]
+mod batch;
+#[cfg_attr(not(target_os = "macos"), allow(dead_code))]
+mod bundles;
+#[cfg_attr(not(target_os = "macos"), allow(dead_code))]
+mod cancel;
 pub mod error;
+#[cfg_attr(not(target_os = "macos"), allow(dead_code))]
+mod hook;
+#[cfg_attr(not(target_os = "macos"), allow(dead_code))]
+mod image_cache;
+#[cfg_attr(not(target_os = "macos"), allow(dead_code))]
 mod notification;
+#[cfg_attr(not(target_os = "macos"), allow(dead_code))]
+mod options;
+#[cfg_attr(not(target_os = "macos"), allow(dead_code))]
+mod outbox;
+#[cfg_attr(not(target_os = "macos"), allow(dead_code))]
+mod pool;
+#[cfg_attr(not(target_os = "macos"), allow(dead_code))]
+mod recurrence;
+#[cfg_attr(not(target_os = "macos"), allow(dead_code))]
+mod remote;
+#[cfg_attr(not(target_os = "macos"), allow(dead_code))]
+mod schedule;
+#[cfg_attr(not(target_os = "macos"), allow(dead_code))]
+mod service;
+#[cfg_attr(not(target_os = "macos"), allow(dead_code))]
+mod sounds;
+#[cfg_attr(not(target_os = "macos"), allow(dead_code))]
+mod wait;
 
+/// Internals measured by the benchmarks in `benches/`, not part of the API
+#[doc(hidden)]
+pub mod internals {
+    pub use crate::app_index::AppIndex;
+    pub use crate::batch::{send_all, Deliver, Delivery, GaveUp};
+    pub use crate::bundles::{BundleCache, Resolve};
+    pub use crate::image_cache::{Decode, ImageCache};
+    pub use crate::options::{OwnedOptions, RawOptions, RawStr};
+    pub use crate::outbox::Outbox;
+    pub use crate::schedule::TimerWheel;
+    pub use crate::wait::{EventLoop, Parker, Waiter};
+}
+
+#[cfg(target_os = "macos")]
+use app_index::AppIndex;
+#[cfg(target_os = "macos")]
+use batch::{Deliver, Delivery, GaveUp};
+#[cfg(target_os = "macos")]
+use bundles::{BundleCache, Resolve};
+pub use cancel::CancelHandle;
+#[cfg(target_os = "macos")]
 use chrono::offset::*;
-use error::{ApplicationError, NotificationError, NotificationResult};
-pub use notification::{MainButton, Notification, NotificationResponse};
-use objc_foundation::{INSDictionary, INSString, NSString};
+#[cfg(target_os = "macos")]
+use error::{ApplicationError, Error, NotificationError, NotificationResult};
+#[cfg(target_os = "macos")]
+use hook::{ClassTable, HookGuard};
+pub use image_cache::ImageCacheStats;
+#[cfg(target_os = "macos")]
+use image_cache::{Decode, Decoding, ImageCache, Lookup};
+#[cfg(target_os = "macos")]
+use notification::FirstDelivery;
+pub use notification::{MainButton, Notification, NotificationResponse, ScheduleHandle};
+#[cfg(target_os = "macos")]
+use objc_foundation::{INSArray, INSData, INSString, NSArray, NSData, NSObject, NSString};
+#[cfg(target_os = "macos")]
+use objc_id::{Id, ShareId};
+#[cfg(target_os = "macos")]
+use options::{OwnedOptions, RawOptions, RawResponse, RawStr};
+#[cfg(target_os = "macos")]
+use outbox::{Decoder, Encoder, Outbox};
+#[cfg(target_os = "macos")]
+use pool::Pool;
+pub use recurrence::{CalendarPattern, Recurrence};
+#[cfg(target_os = "macos")]
+use remote::{Cached, Http, Limits, RemoteCache, Request, Response, Transport};
+#[cfg(target_os = "macos")]
+use schedule::{Clock, Scheduler, Stage, SystemClock};
+#[cfg(target_os = "macos")]
+use service::{Center, Patience, Service};
+pub use sounds::AvailableSounds;
+#[cfg(target_os = "macos")]
+use sounds::SoundCatalog;
+#[cfg(target_os = "macos")]
+use std::future::Future;
+#[cfg(target_os = "macos")]
+use std::io;
+#[cfg(target_os = "macos")]
 use std::ops::Deref;
-use std::sync::Once;
+#[cfg(target_os = "macos")]
+use std::os::raw::c_void;
+#[cfg(target_os = "macos")]
+use std::path::Path;
+#[cfg(target_os = "macos")]
+use std::pin::Pin;
+#[cfg(target_os = "macos")]
+use std::sync::atomic::{AtomicBool, AtomicPtr, AtomicUsize, Ordering};
+#[cfg(target_os = "macos")]
+use std::sync::{mpsc, Arc, Mutex, Once};
+#[cfg(target_os = "macos")]
+use std::task::{Context, Poll};
+#[cfg(target_os = "macos")]
+use std::thread;
+#[cfg(target_os = "macos")]
+use std::time::{Duration, Instant};
+#[cfg(target_os = "macos")]
+use wait::{EventLoop, Parker, WaitFuture, Waiter};
+
+/// Claimed by the first `set_application`, released again if setting the application failed
+#[cfg(target_os = "macos")]
+static APPLICATION_SET: AtomicBool = AtomicBool::new(false);
+#[cfg(target_os = "macos")]
+static BUNDLE_HOOK: HookGuard = HookGuard::new();
+#[cfg(target_os = "macos")]
+static SERVICE_COUNT: AtomicUsize = AtomicUsize::new(0);
+#[cfg(target_os = "macos")]
+static INIT_IMAGE_CACHE: Once = Once::new();
+#[cfg(target_os = "macos")]
+static IMAGE_CACHE: AtomicPtr<Mutex<ImageCache<ImageLoader>>> =
+    AtomicPtr::new(std::ptr::null_mut());
+#[cfg(target_os = "macos")]
+static INIT_PREFETCH_POOL: Once = Once::new();
+#[cfg(target_os = "macos")]
+static PREFETCH_POOL: AtomicPtr<Pool> = AtomicPtr::new(std::ptr::null_mut());
+#[cfg(target_os = "macos")]
+static INIT_REMOTE_IMAGES: Once = Once::new();
+#[cfg(target_os = "macos")]
+static REMOTE_IMAGES: AtomicPtr<RemoteImages> = AtomicPtr::new(std::ptr::null_mut());
+#[cfg(target_os = "macos")]
+static INIT_APP_INDEX: Once = Once::new();
+#[cfg(target_os = "macos")]
+static APP_INDEX: AtomicPtr<Mutex<AppIndex>> = AtomicPtr::new(std::ptr::null_mut());
+#[cfg(target_os = "macos")]
+static INIT_BUNDLE_CACHE: Once = Once::new();
+#[cfg(target_os = "macos")]
+static BUNDLE_CACHE: AtomicPtr<Mutex<BundleCache<AppleScript>>> =
+    AtomicPtr::new(std::ptr::null_mut());
+#[cfg(target_os = "macos")]
+static INIT_SOUND_CATALOG: Once = Once::new();
+#[cfg(target_os = "macos")]
+static SOUND_CATALOG: AtomicPtr<Mutex<SoundCatalog>> = AtomicPtr::new(std::ptr::null_mut());
+#[cfg(target_os = "macos")]
+static INIT_SHARED_SERVICE: Once = Once::new();
+#[cfg(target_os = "macos")]
+static SHARED_SERVICE: AtomicPtr<Option<NotificationService>> =
+    AtomicPtr::new(std::ptr::null_mut());
+#[cfg(target_os = "macos")]
+static INIT_SCHEDULER: Once = Once::new();
+#[cfg(target_os = "macos")]
+static SCHEDULER: AtomicPtr<Option<Scheduler<ScheduledNotification>>> =
+    AtomicPtr::new(std::ptr::null_mut());
+#[cfg(target_os = "macos")]
+static INIT_OUTBOX: Once = Once::new();
+#[cfg(target_os = "macos")]
+static OUTBOX: AtomicPtr<Mutex<Option<Outbox>>> = AtomicPtr::new(std::ptr::null_mut());
+
+/// How long a fire-and-forget send waits for the notification center to confirm the delivery
+#[cfg(target_os = "macos")]
+const DELIVERY_ACK_TIMEOUT: Duration = Duration::from_millis(100);
+
+/// Bytes of decoded images the image cache keeps until [`set_image_cache_budget`] is called
+#[cfg(target_os = "macos")]
+const DEFAULT_IMAGE_CACHE_BUDGET: usize = 32 * 1024 * 1024;
+
+/// Threads that decode images for [`Notification::prefetch`]
+#[cfg(target_os = "macos")]
+const PREFETCH_THREADS: usize = 2;
 
-static mut APPLICATION_SET: bool = false;
-static INIT_APPLICATION_SET: Once = Once::new();
+/// Remote images without a cached copy that a send fetches at the same time, any more are
+/// fetched in the background and left out
+#[cfg(target_os = "macos")]
+const MAX_SEND_FETCHES: usize = 4;
 
+#[cfg(target_os = "macos")]
 mod sys {
-    use objc_foundation::{NSDictionary, NSString};
-    use objc_id::Id;
+    use crate::options::{RawOptions, RawStr};
+    use objc_foundation::{NSArray, NSData, NSObject, NSString};
+    use std::os::raw::c_void;
+
+    /// `NotificationDelivery` values reported by `sendNotifications`
+    pub const DELIVERY_FAILED: isize = -1;
+    pub const DELIVERY_AWAITING_RESPONSE: isize = 1;
+
+    /// `FetchStatus` values reported by `fetchURL`
+    pub const FETCH_TIMED_OUT: isize = -2;
+    pub const FETCH_TOO_LARGE: isize = -3;
+
+    /// The response to `fetchURL`, every object is retained and may be null
+    #[repr(C)]
+    pub struct FetchedURL {
+        pub body: *mut NSData,
+        pub etag: *mut NSString,
+        pub last_modified: *mut NSString,
+        pub cache_control: *mut NSString,
+    }
+
     #[link(name = "notify")]
     extern "C" {
-        pub fn sendNotification(
-            title: *const NSString,
-            subtitle: *const NSString,
-            message: *const NSString,
-            options: *const NSDictionary<NSString, NSString>,
-        ) -> Id<NSDictionary<NSString, NSString>>;
+        pub fn installNSBundleHook() -> bool;
+        pub fn createNotificationCenter() -> *mut NSObject;
+        pub fn closeNotificationCenter(session: *const NSObject);
+        pub fn sendNotifications(
+            session: *const NSObject,
+            count: usize,
+            identifiers: *const *const NSString,
+            titles: *const RawStr,
+            subtitles: *const RawStr,
+            messages: *const RawStr,
+            options: *const RawOptions,
+            waiters: *const *const c_void,
+            deliveries: *mut isize,
+        );
+        pub fn detachWaiters(session: *const NSObject, count: usize, waiters: *const *const c_void);
+        pub fn removeNotification(session: *const NSObject, identifier: *const NSString);
+        pub fn withdrawWaiter(session: *const NSObject, waiter: *const c_void);
+        pub fn deliveredNotificationIdentifiers(session: *const NSObject)
+            -> *mut NSArray<NSString>;
+        pub fn currentRunLoop() -> *mut c_void;
+        pub fn runLoopRunOnce(seconds: f64);
+        pub fn runLoopWake(run_loop: *mut c_void);
+        pub fn runLoopRelease(run_loop: *mut c_void);
         pub fn setApplication(newbundleIdentifier: *const NSString) -> bool;
         pub fn getBundleIdentifier(appName: *const NSString) -> *const NSString;
+        pub fn getBundleIdentifiers(appNames: *const NSArray<NSString>) -> *mut NSArray<NSString>;
+        pub fn loadImage(path: *const NSString, maxPixelSize: usize) -> *mut NSObject;
+        pub fn imageByteCost(image: *const NSObject) -> usize;
+        pub fn fetchURL(
+            url: *const NSString,
+            etag: *const NSString,
+            lastModified: *const NSString,
+            timeout: f64,
+            maxBytes: usize,
+            fetched: *mut FetchedURL,
+        ) -> isize;
+    }
+}
+
+#[cfg(target_os = "macos")]
+type ResponseWaiter = Waiter<NotificationResponse>;
+
+/// A notification waiting for its delivery date, or the next instance of a series
+#[cfg(target_os = "macos")]
+struct ScheduledNotification {
+    notification: PreparedNotification,
+    /// Completed by the first instance, see `ScheduleHandle::wait`
+    waiter: Arc<ResponseWaiter>,
+    /// Completed when the first instance goes out
+    delivered: Arc<Waiter<FirstDelivery>>,
+    /// When the instance is due, in milliseconds since the unix epoch
+    due: u64,
+    /// The id the notification is recorded under in the outbox, if there is one
+    outbox_id: Option<u64>,
+}
+
+/// The Objective C runtime, where NSBundle gets hooked
+#[cfg(target_os = "macos")]
+struct ObjcRuntime;
+
+#[cfg(target_os = "macos")]
+impl ClassTable for ObjcRuntime {
+    fn exchange_implementations(&self) -> bool {
+        unsafe { sys::installNSBundleHook() }
+    }
+}
+
+/// The run loop of the calling thread, which is where the notification center delivers its callbacks
+#[cfg(target_os = "macos")]
+struct CurrentRunLoop(*mut c_void);
+
+// Waking a run loop through its source is safe from any thread
+#[cfg(target_os = "macos")]
+unsafe impl Send for CurrentRunLoop {}
+#[cfg(target_os = "macos")]
+unsafe impl Sync for CurrentRunLoop {}
+
+#[cfg(target_os = "macos")]
+impl CurrentRunLoop {
+    fn new() -> Self {
+        CurrentRunLoop(unsafe { sys::currentRunLoop() })
+    }
+}
+
+#[cfg(target_os = "macos")]
+impl EventLoop for CurrentRunLoop {
+    fn run_once(&self, timeout: Option<Duration>) {
+        // CFRunLoopRunInMode has no "forever", a very long interval is the documented substitute
+        let seconds = timeout.map_or(1.0e10, |timeout| timeout.as_secs_f64());
+        unsafe { sys::runLoopRunOnce(seconds) }
+    }
+
+    fn wake(&self) {
+        unsafe { sys::runLoopWake(self.0) }
+    }
+}
+
+#[cfg(target_os = "macos")]
+impl Drop for CurrentRunLoop {
+    fn drop(&mut self) {
+        unsafe { sys::runLoopRelease(self.0) }
+    }
+}
+
+/// A decoded `NSImage`, never mutated once it is in the cache
+#[cfg(target_os = "macos")]
+#[derive(Clone)]
+struct CachedImage(ShareId<NSObject>);
+
+// NSImage is safe to pass between threads as long as nobody draws into it
+#[cfg(target_os = "macos")]
+unsafe impl Send for CachedImage {}
+
+/// Decodes images for the image cache with `NSImage`
+#[cfg(target_os = "macos")]
+struct ImageLoader;
+
+#[cfg(target_os = "macos")]
+impl Decode for ImageLoader {
+    type Image = CachedImage;
+
+    fn decode(&self, path: &Path, max_pixel_size: Option<u32>) -> Option<(CachedImage, usize)> {
+        let path = NSString::from_str(path.to_str()?);
+        let max_pixel_size = max_pixel_size.map_or(0, |size| size as usize);
+        unsafe {
+            let image = sys::loadImage(path.deref(), max_pixel_size);
+            if image.is_null() {
+                return None;
+            }
+            let bytes = sys::imageByteCost(image);
+            Some((CachedImage(ShareId::from_retained_ptr(image)), bytes))
+        }
+    }
+}
+
+/// The image cache of the process, created on first use
+#[cfg(target_os = "macos")]
+fn image_cache() -> &'static Mutex<ImageCache<ImageLoader>> {
+    INIT_IMAGE_CACHE.call_once(|| {
+        let cache = Box::new(Mutex::new(ImageCache::new(
+            ImageLoader,
+            DEFAULT_IMAGE_CACHE_BUDGET,
+        )));
+        IMAGE_CACHE.store(Box::into_raw(cache), Ordering::Release);
+    });
+    unsafe { &*IMAGE_CACHE.load(Ordering::Acquire) }
+}
+
+/// Fetches `https://` URLs with `NSURLSession`, and `http://` URLs itself
+#[cfg(target_os = "macos")]
+struct UrlSession;
+
+#[cfg(target_os = "macos")]
+impl Transport for UrlSession {
+    fn fetch(&self, request: &Request) -> io::Result<Response> {
+        if request.url.starts_with("http://") {
+            // App Transport Security may refuse plain HTTP
+            return Http.fetch(request);
+        }
+        let url = NSString::from_str(request.url);
+        let etag = request.etag.map(NSString::from_str);
+        let last_modified = request.last_modified.map(NSString::from_str);
+        let timeout = request.deadline.saturating_duration_since(Instant::now());
+        let mut fetched = sys::FetchedURL {
+            body: std::ptr::null_mut(),
+            etag: std::ptr::null_mut(),
+            last_modified: std::ptr::null_mut(),
+            cache_control: std::ptr::null_mut(),
+        };
+        let status = unsafe {
+            sys::fetchURL(
+                url.deref(),
+                string_ptr(etag.as_ref()),
+                string_ptr(last_modified.as_ref()),
+                timeout.as_secs_f64(),
+                request.max_bytes,
+                &mut fetched,
+            )
+        };
+        let take = |string: *mut NSString| {
+            if string.is_null() {
+                None
+            } else {
+                let string: Id<NSString> = unsafe { Id::from_retained_ptr(string) };
+                Some(string.as_str().to_string())
+            }
+        };
+        let body = if fetched.body.is_null() {
+            None
+        } else {
+            let body: Id<NSData> = unsafe { Id::from_retained_ptr(fetched.body) };
+            Some(body.bytes().to_vec())
+        };
+        let headers = [
+            ("etag", take(fetched.etag)),
+            ("last-modified", take(fetched.last_modified)),
+            ("cache-control", take(fetched.cache_control)),
+        ];
+        let headers = headers
+            .iter()
+            .filter_map(|(name, value)| Some((*name, value.as_deref()?)));
+
+        match status {
+            200 => Ok(Response::with_headers(body, headers)),
+            304 => Ok(Response::with_headers(None, headers)),
+            sys::FETCH_TIMED_OUT => Err(io::ErrorKind::TimedOut.into()),
+            sys::FETCH_TOO_LARGE => Err(io::ErrorKind::InvalidData.into()),
+            _ => Err(io::ErrorKind::Other.into()),
+        }
+    }
+}
+
+#[cfg(target_os = "macos")]
+fn string_ptr(string: Option<&Id<NSString>>) -> *const NSString {
+    match string {
+        Some(string) => string.deref(),
+        None => std::ptr::null(),
+    }
+}
+
+/// The on-disk cache of remote images and the limits of fetching them
+#[cfg(target_os = "macos")]
+struct RemoteImages {
+    cache: RemoteCache<UrlSession>,
+    limits: Mutex<Limits>,
+}
+
+/// The remote images of the process, kept in the user's cache directory
+#[cfg(target_os = "macos")]
+fn remote_images() -> &'static RemoteImages {
+    INIT_REMOTE_IMAGES.call_once(|| {
+        let dir = dirs_next::cache_dir()
+            .unwrap_or_else(std::env::temp_dir)
+            .join("mac-notification-sys")
+            .join("images");
+        let remote = Box::new(RemoteImages {
+            cache: RemoteCache::new(dir, UrlSession),
+            limits: Mutex::new(Limits::default()),
+        });
+        REMOTE_IMAGES.store(Box::into_raw(remote), Ordering::Release);
+    });
+    unsafe { &*REMOTE_IMAGES.load(Ordering::Acquire) }
+}
+
+/// The threads of the process that prefetch images, started on first use
+#[cfg(target_os = "macos")]
+fn prefetch_pool() -> &'static Pool {
+    INIT_PREFETCH_POOL.call_once(|| {
+        let pool = Box::new(Pool::new("mac-notification-sys-prefetch", PREFETCH_THREADS));
+        PREFETCH_POOL.store(Box::into_raw(pool), Ordering::Release);
+    });
+    unsafe { &*PREFETCH_POOL.load(Ordering::Acquire) }
+}
+
+/// Resolves bundle identifiers with `get id of application`
+#[cfg(target_os = "macos")]
+struct AppleScript;
+
+#[cfg(target_os = "macos")]
+impl Resolve for AppleScript {
+    fn resolve(&self, app_name: &str) -> Option<String> {
+        unsafe {
+            sys::getBundleIdentifier(NSString::from_str(app_name).deref()) // *const NSString
+                .as_ref() // Option<NSString>
+                .map(NSString::as_str)
+                .map(String::from)
+        }
+    }
+
+    fn resolve_all(&self, app_names: &[&str]) -> Vec<Option<String>> {
+        let names: Vec<Id<NSString>> = app_names
+            .iter()
+            .map(|app_name| NSString::from_str(app_name))
+            .collect();
+        let names = NSArray::from_vec(names);
+        let identifiers: Id<NSArray<NSString>> =
+            unsafe { Id::from_retained_ptr(sys::getBundleIdentifiers(names.deref())) };
+        identifiers
+            .to_vec()
+            .into_iter()
+            .map(|identifier| Some(identifier.as_str()).filter(|identifier| !identifier.is_empty()))
+            .map(|identifier| identifier.map(String::from))
+            .collect()
+    }
+}
+
+/// The index of the installed applications, kept in the user's cache directory
+#[cfg(target_os = "macos")]
+fn app_index() -> &'static Mutex<AppIndex> {
+    INIT_APP_INDEX.call_once(|| {
+        let file =
+            dirs_next::cache_dir().map(|dir| dir.join("mac-notification-sys").join("app-index"));
+        let index = Box::new(Mutex::new(AppIndex::new(
+            app_index::application_dirs(),
+            file,
+        )));
+        APP_INDEX.store(Box::into_raw(index), Ordering::Release);
+    });
+    unsafe { &*APP_INDEX.load(Ordering::Acquire) }
+}
+
+/// The bundle identifiers resolved before, kept in the user's cache directory
+#[cfg(target_os = "macos")]
+fn bundle_cache() -> &'static Mutex<BundleCache<AppleScript>> {
+    INIT_BUNDLE_CACHE.call_once(|| {
+        let file = dirs_next::cache_dir()
+            .map(|dir| dir.join("mac-notification-sys").join("bundle-identifiers"));
+        let cache = Box::new(Mutex::new(BundleCache::new(AppleScript, file)));
+        BUNDLE_CACHE.store(Box::into_raw(cache), Ordering::Release);
+    });
+    unsafe { &*BUNDLE_CACHE.load(Ordering::Acquire) }
+}
+
+/// The sound catalog of the process, scanned on first use
+#[cfg(target_os = "macos")]
+fn sound_catalog() -> &'static Mutex<SoundCatalog> {
+    INIT_SOUND_CATALOG.call_once(|| {
+        let catalog = Box::new(Mutex::new(SoundCatalog::new(sounds::sound_dirs())));
+        SOUND_CATALOG.store(Box::into_raw(catalog), Ordering::Release);
+    });
+    unsafe { &*SOUND_CATALOG.load(Ordering::Acquire) }
+}
+
+/// The notification service that asynchronous sends and due scheduled notifications go
+/// through, `None` if its thread could not be started
+#[cfg(target_os = "macos")]
+fn shared_service() -> Option<&'static NotificationService> {
+    INIT_SHARED_SERVICE.call_once(|| {
+        let service = NotificationService::spawn().ok();
+        SHARED_SERVICE.store(Box::into_raw(Box::new(service)), Ordering::Release);
+    });
+    unsafe { &*SHARED_SERVICE.load(Ordering::Acquire) }.as_ref()
+}
+
+/// Holds scheduled notifications until they are due, `None` if its thread could not be started
+///
+/// Due notifications are delivered through the shared `NotificationService`.
+#[cfg(target_os = "macos")]
+fn scheduler() -> Option<&'static Scheduler<ScheduledNotification>> {
+    INIT_SCHEDULER.call_once(|| {
+        let scheduler = Scheduler::spawn(SystemClock, move |scheduled, now| {
+            let ScheduledNotification {
+                notification,
+                waiter,
+                delivered,
+                due,
+                outbox_id,
+            } = scheduled;
+            // `ScheduleHandle::wait` gives up on the response itself
+            let sent = match shared_service() {
+                Some(service) => service
+                    .service
+                    .send(
+                        notification.clone(),
+                        Arc::clone(waiter),
+                        Patience::default(),
+                    )
+                    .map(|id| (service.service.clone(), id)),
+                None => None,
+            };
+            if sent.is_none() {
+                waiter.complete(NotificationResponse::None);
+            }
+            if !delivered.is_complete() {
+                let remove: Option<Box<dyn FnOnce() + Send>> = match sent {
+                    Some((service, id)) => Some(Box::new(move || {
+                        let _ = service.remove(id);
+                    })),
+                    None => None,
+                };
+                delivered.complete(FirstDelivery {
+                    at: Instant::now(),
+                    remove,
+                });
+            }
+            // only the next instance of a series is kept, missed ones are skipped
+            let next = notification
+                .options
+                .recurrence
+                .as_ref()
+                .and_then(|recurrence| recurrence.next_after(now, Some(*due), &Local));
+            if let (Some(id), Some(outbox)) = (*outbox_id, outbox().lock().unwrap().as_mut()) {
+                // a delivery that could not be recorded is repeated after a restart
+                let _ = outbox.delivered(id, next);
+            }
+            *due = next?;
+            Some(*due)
+        });
+        SCHEDULER.store(Box::into_raw(Box::new(scheduler)), Ordering::Release);
+    });
+    unsafe { &*SCHEDULER.load(Ordering::Acquire) }.as_ref()
+}
+
+/// The outbox scheduled notifications are recorded in, `None` until one is set
+#[cfg(target_os = "macos")]
+fn outbox() -> &'static Mutex<Option<Outbox>> {
+    INIT_OUTBOX.call_once(|| {
+        OUTBOX.store(Box::into_raw(Box::new(Mutex::new(None))), Ordering::Release);
+    });
+    unsafe { &*OUTBOX.load(Ordering::Acquire) }
+}
+
+/// Hand a notification with a delivery date or a recurrence to the scheduler,
+/// after recording it in the outbox if there is one
+///
+/// A series starts at its delivery date, or else at the first time its recurrence fires.
+#[cfg(target_os = "macos")]
+fn schedule(mut notification: PreparedNotification) -> NotificationResult<ScheduleHandle> {
+    let scheduler = scheduler().ok_or(NotificationError::UnableToDeliver)?;
+    let due = match (
+        notification.options.delivery_date.take(),
+        &notification.options.recurrence,
+    ) {
+        (Some(delivery_date), _) => (delivery_date * 1000.) as u64,
+        (None, Some(recurrence)) => recurrence
+            .next_after(SystemClock.now(), None, &Local)
+            .ok_or(NotificationError::UnableToDeliver)?,
+        (None, None) => 0,
+    };
+    let outbox_id = match outbox().lock().unwrap().as_mut() {
+        Some(outbox) => Some(
+            outbox
+                .schedule(due, notification.encode())
+                .map_err(|_| NotificationError::UnableToSchedule)?,
+        ),
+        None => None,
+    };
+    Ok(enqueue(scheduler, notification, due, outbox_id))
+}
+
+/// Hand a notification to the scheduler, due at `due`
+#[cfg(target_os = "macos")]
+fn enqueue(
+    scheduler: &Scheduler<ScheduledNotification>,
+    notification: PreparedNotification,
+    due: u64,
+    outbox_id: Option<u64>,
+) -> ScheduleHandle {
+    let waiter = Arc::new(Waiter::new(Arc::new(Parker::default())));
+    let delivered = Arc::new(Waiter::new(Arc::new(Parker::default())));
+    let repeats = notification.options.recurrence.is_some();
+    let timeout = notification.options.response_timeout;
+    let remove_on_timeout = notification.options.remove_on_timeout;
+    let cancel = notification.options.cancel_handle.clone();
+    let scheduled = ScheduledNotification {
+        notification,
+        waiter: Arc::clone(&waiter),
+        delivered: Arc::clone(&delivered),
+        due,
+        outbox_id,
+    };
+    let key = scheduler.schedule(due, scheduled);
+    ScheduleHandle {
+        key,
+        waiter,
+        outbox_id,
+        repeats,
+        delivered,
+        timeout,
+        remove_on_timeout,
+        cancel,
+    }
+}
+
+/// The decoded image for an app icon or content image, `None` for unreadable files and
+/// remote images without a cached copy
+///
+/// Never waits for the network: remote images that are no longer fresh are used as they are
+/// and revalidated on the prefetch threads.
+#[cfg(target_os = "macos")]
+fn cached_image(url: Option<&String>) -> Option<CachedImage> {
+    let url = url?;
+    if remote::is_remote(url) {
+        let path = match remote_images().cache.lookup(url) {
+            Cached::Fresh(path) => path,
+            Cached::Stale(path) => {
+                refresh_remote_image(url);
+                path
+            }
+            Cached::Missing => {
+                refresh_remote_image(url);
+                return None;
+            }
+        };
+        return ImageCache::get(image_cache(), &path);
+    }
+    ImageCache::get(image_cache(), &image_cache::local_path(url)?)
+}
+
+/// Fetch or revalidate a remote image on the prefetch threads, unless that is underway already
+#[cfg(target_os = "macos")]
+fn refresh_remote_image(url: &str) {
+    let remote = remote_images();
+    if remote.cache.claim_refresh(url) {
+        let url = url.to_string();
+        let limits = *remote.limits.lock().unwrap();
+        prefetch_pool().execute(move || {
+            remote_images().cache.fetch(&url, limits);
+        });
+    }
+}
+
+/// Fetch the remote images of the notifications that have no cached copy yet, so handing
+/// them over only ever uses cached copies
+///
+/// The images are fetched at the same time and waited for until one deadline, so a send is
+/// delayed by the fetch timeout at most however many images it has. Images that are not
+/// there by then are left out, their fetches go on in the background for the next send.
+#[cfg(target_os = "macos")]
+fn fetch_remote_images(notifications: &[(&str, Option<&str>, &str, Option<&Notification>)]) {
+    let remote = remote_images();
+    let mut missing: Vec<&str> = Vec::new();
+    for options in notifications
+        .iter()
+        .filter_map(|(_, _, _, options)| *options)
+    {
+        for url in [options.app_icon, options.content_image].iter().flatten() {
+            if remote::is_remote(url)
+                && !missing.contains(url)
+                && remote.cache.lookup(url) == Cached::Missing
+            {
+                missing.push(url);
+            }
+        }
+    }
+    if missing.is_empty() {
+        return;
+    }
+
+    let limits = *remote.limits.lock().unwrap();
+    let deadline = Instant::now() + limits.timeout;
+    let (fetched, arrived) = mpsc::channel();
+    let mut fetching = 0;
+    for url in missing {
+        let url = url.to_string();
+        let fetched = fetched.clone();
+        let fetch = move || {
+            remote_images().cache.fetch(&url, limits);
+            let _ = fetched.send(());
+        };
+        if fetching == MAX_SEND_FETCHES {
+            prefetch_pool().execute(fetch);
+            continue;
+        }
+        let spawned = thread::Builder::new()
+            .name("mac-notification-sys-fetch".into())
+            .spawn(fetch);
+        if spawned.is_ok() {
+            fetching += 1;
+        }
+    }
+    for _ in 0..fetching {
+        let left = deadline.saturating_duration_since(Instant::now());
+        if arrived.recv_timeout(left).is_err() {
+            break;
+        }
+    }
+}
+
+/// Decode the image on the prefetch threads unless it is cached already
+#[cfg(target_os = "macos")]
+fn prefetch_image(path: &Path) -> Option<Arc<Decoding<CachedImage>>> {
+    let lookup = image_cache().lock().unwrap().lookup(path, true);
+    match lookup {
+        Lookup::Ready(_) => None,
+        Lookup::Decoding(decoding) => Some(decoding),
+        Lookup::Decode(job) => {
+            let decoding = Arc::clone(job.decoding());
+            prefetch_pool().execute(move || {
+                job.run(image_cache());
+            });
+            Some(decoding)
+        }
+    }
+}
+
+#[cfg(target_os = "macos")]
+impl<'a> Notification<'a> {
+    /// Decode the app icon and content image on a background thread, ahead of sending
+    ///
+    /// The images go into the image cache, so sending the notification only attaches them.
+    /// A send that comes before they are decoded waits for the decode instead of decoding again.
+    /// Only images given as a path or `file://` URL are prefetched.
+    /// [`image_cache_stats`] tells how long decoding took and how often sends had to wait for it.
+    ///
+    /// # Example:
+    ///
+    /// ```no_run
+    /// # use mac_notification_sys::*;
+    /// let mut notification = Notification::new();
+    /// notification.content_image("/path/to/screenshot.png");
+    /// let _prefetch = notification.prefetch();
+    /// // ... gather the rest of the message
+    /// let _ = send_notification("Screenshot", None, "Saved", Some(&notification));
+    /// ```
+    pub fn prefetch(&self) -> ImagePrefetch {
+        let decoding = [self.app_icon, self.content_image]
+            .iter()
+            .filter_map(|url| image_cache::local_path((*url)?))
+            .filter_map(|path| prefetch_image(&path))
+            .collect();
+        ImagePrefetch { decoding }
+    }
+}
+
+/// The images of a notification being decoded in the background, see [`Notification::prefetch`]
+///
+/// Dropping it does not stop the decoding.
+#[cfg(target_os = "macos")]
+pub struct ImagePrefetch {
+    decoding: Vec<Arc<Decoding<CachedImage>>>,
+}
+
+#[cfg(target_os = "macos")]
+impl ImagePrefetch {
+    /// Whether all images are decoded
+    pub fn is_ready(&self) -> bool {
+        self.decoding.iter().all(|decoding| decoding.is_complete())
+    }
+
+    /// Blocks until all images are decoded
+    pub fn wait(&self) {
+        for decoding in &self.decoding {
+            decoding.wait();
+        }
     }
 }
 
+/// Called by the Objective C delegate once the notification was delivered or interacted with
+#[cfg(target_os = "macos")]
+#[no_mangle]
+#[allow(non_snake_case)]
+extern "C" fn notificationDidComplete(waiter: *const c_void, response: *const RawResponse) {
+    unsafe {
+        let waiter = &*(waiter as *const ResponseWaiter);
+        waiter.complete(NotificationResponse::from_raw(&*response));
+    }
+}
+
+/// Called by the Objective C delegate when it no longer holds on to the waiter
+#[cfg(target_os = "macos")]
+#[no_mangle]
+#[allow(non_snake_case)]
+extern "C" fn notificationWaiterRelease(waiter: *const c_void) {
+    unsafe { drop(Arc::from_raw(waiter as *const ResponseWaiter)) }
+}
+
+/// Called by the Objective C side when an NSData starts sharing the bytes of an image
+#[cfg(target_os = "macos")]
+#[no_mangle]
+#[allow(non_snake_case)]
+extern "C" fn imageBytesRetain(data: *const u8, len: usize) {
+    unsafe { options::retain_bytes(data, len) }
+}
+
+/// Called by the Objective C side when an NSData that shared the bytes of an image goes away
+#[cfg(target_os = "macos")]
+#[no_mangle]
+#[allow(non_snake_case)]
+extern "C" fn imageBytesRelease(data: *const u8, len: usize) {
+    unsafe { options::release_bytes(data, len) }
+}
+
 /// Delivers a new notification
 ///
+/// Every call sets up the notification center anew, use a [`NotificationCenter`] to send many notifications.
+///
 /// Returns a `NotificationError` if a notification could not be delivered
 ///
 /// # Example:
@@ -49,75 +885,1003 @@ mod sys {
 /// // deliver a silent notification
 /// let _ = send_notification("Title", None, "This is the body", None).unwrap();
 /// ```
+#[cfg(target_os = "macos")]
 pub fn send_notification(
     title: &str,
     subtitle: Option<&str>,
     message: &str,
     options: Option<&Notification>,
 ) -> NotificationResult<NotificationResponse> {
-    if let Some(options) = &options {
-        if let Some(delivery_date) = options.delivery_date {
+    NotificationCenter::new()?.send(title, subtitle, message, options)
+}
+
+/// Delivers many notifications at once
+///
+/// Takes the same arguments as [`send_notification`] for every notification.
+/// See [`NotificationCenter::send_all`].
+///
+/// # Example:
+///
+/// ```no_run
+/// # use mac_notification_sys::*;
+/// let _ = send_notifications(&[
+///     ("Disk", None, "Almost full", None),
+///     ("Memory", Some("Swap"), "In use", None),
+/// ])
+/// .unwrap();
+/// ```
+#[cfg(target_os = "macos")]
+pub fn send_notifications(
+    notifications: &[(&str, Option<&str>, &str, Option<&Notification>)],
+) -> NotificationResult<Vec<NotificationResponse>> {
+    NotificationCenter::new()?.send_all(notifications)
+}
+
+/// Delivers a new notification without blocking
+///
+/// Returns a future of the response, see [`NotificationCenter::send_async`]. Any executor
+/// thread can await it, no run loop has to run for it.
+///
+/// # Example:
+///
+/// ```no_run
+/// # use mac_notification_sys::*;
+/// async fn approve() -> bool {
+///     let mut options = Notification::new();
+///     options.main_button(MainButton::SingleAction("Approve"));
+///     match send_notification_async("Deploy", None, "Approve deployment?", Some(&options)).await {
+///         Ok(NotificationResponse::ActionButton(_)) => true,
+///         _ => false,
+///     }
+/// }
+/// ```
+#[cfg(target_os = "macos")]
+pub fn send_notification_async(
+    title: &str,
+    subtitle: Option<&str>,
+    message: &str,
+    options: Option<&Notification>,
+) -> NotificationFuture {
+    let service = match shared_service() {
+        Some(service) => service,
+        None => return NotificationFuture::failed(NotificationError::UnableToDeliver.into()),
+    };
+    let prepared = match prepare(&[(title, subtitle, message, options)]) {
+        Ok(mut prepared) => prepared.remove(0),
+        Err(error) => return NotificationFuture::failed(error),
+    };
+    let waiter = Arc::new(Waiter::new_async());
+    match service.send_prepared(prepared, Arc::clone(&waiter)) {
+        Ok(_) => NotificationFuture {
+            response: WaitFuture::new(waiter),
+            error: None,
+        },
+        Err(error) => NotificationFuture::failed(error),
+    }
+}
+
+/// A session with the notification center
+///
+/// Installs the bundle hook once and reuses it for every notification sent through it.
+/// All sessions of the process share one delegate, which routes the callbacks of every
+/// notification to whoever waits on it, so any number of sessions and notifications can be
+/// outstanding at the same time.
+///
+/// # Example:
+///
+/// ```no_run
+/// # use mac_notification_sys::*;
+/// let center = NotificationCenter::new().unwrap();
+/// for i in 0..3 {
+///     let _ = center.send("Title", None, &format!("Notification {}", i), None).unwrap();
+/// }
+/// ```
+#[cfg(target_os = "macos")]
+pub struct NotificationCenter {
+    session: Id<NSObject>,
+}
+
+/// A notification converted for the Objective C side
+#[cfg(target_os = "macos")]
+#[derive(Clone)]
+struct PreparedNotification {
+    title: String,
+    subtitle: Option<String>,
+    message: String,
+    options: OwnedOptions,
+}
+
+#[cfg(target_os = "macos")]
+impl PreparedNotification {
+    /// Lay out the notification for the outbox
+    fn encode(&self) -> Vec<u8> {
+        let mut encoder = Encoder::default();
+        encoder.str(&self.title);
+        encoder.option(self.subtitle.as_ref(), |encoder, subtitle| {
+            encoder.str(subtitle)
+        });
+        encoder.str(&self.message);
+        self.options.encode(&mut encoder);
+        encoder.finish()
+    }
+
+    /// Read back a notification laid out by `encode`, `None` if it is broken
+    fn decode(bytes: &[u8]) -> Option<Self> {
+        let mut decoder = Decoder::new(bytes);
+        Some(PreparedNotification {
+            title: decoder.string()?,
+            subtitle: decoder.option(Decoder::string)?,
+            message: decoder.string()?,
+            options: OwnedOptions::decode(&mut decoder)?,
+        })
+    }
+}
+
+#[cfg(target_os = "macos")]
+impl NotificationCenter {
+    /// Set up the notification center
+    ///
+    /// Uses the default application if none has been set yet.
+    pub fn new() -> NotificationResult<Self> {
+        if !APPLICATION_SET.load(Ordering::SeqCst) {
+            let bundle = get_bundle_identifier_or_default("use_default");
+            // another thread setting the application first is just as good
+            match set_application(&bundle) {
+                Ok(()) | Err(Error::Application(ApplicationError::AlreadySet(_))) => {}
+                Err(error) => return Err(error),
+            }
+        }
+        unsafe {
             ensure!(
-                delivery_date >= Utc::now().timestamp() as f64,
-                NotificationError::ScheduleInThePast
+                BUNDLE_HOOK.install(&ObjcRuntime),
+                NotificationError::UnableToDeliver
             );
+            let session = sys::createNotificationCenter();
+            ensure!(!session.is_null(), NotificationError::UnableToDeliver);
+            Ok(NotificationCenter {
+                session: Id::from_retained_ptr(session),
+            })
         }
-    };
+    }
 
-    let options = options.unwrap_or(&Notification::new()).to_dictionary();
+    /// Delivers a new notification
+    ///
+    /// Returns a `NotificationError` if a notification could not be delivered
+    pub fn send(
+        &self,
+        title: &str,
+        subtitle: Option<&str>,
+        message: &str,
+        options: Option<&Notification>,
+    ) -> NotificationResult<NotificationResponse> {
+        let mut responses = self.send_all(&[(title, subtitle, message, options)])?;
+        Ok(responses.remove(0))
+    }
 
-    unsafe {
-        if !APPLICATION_SET {
-            let bundle = get_bundle_identifier_or_default("use_default");
-            set_application(&bundle).unwrap();
+    /// Delivers many notifications at once
+    ///
+    /// All notifications are delivered in one pass before waiting for any of them,
+    /// the responses are returned in the same order. Notifications with a delivery date or a
+    /// recurrence are scheduled instead and answered with `NotificationResponse::Scheduled`
+    /// right away.
+    ///
+    /// Returns a `NotificationError` if any of the notifications could not be delivered
+    pub fn send_all(
+        &self,
+        notifications: &[(&str, Option<&str>, &str, Option<&Notification>)],
+    ) -> NotificationResult<Vec<NotificationResponse>> {
+        let mut responses: Vec<Option<NotificationResponse>> =
+            notifications.iter().map(|_| None).collect();
+        let mut indices = Vec::new();
+        let mut prepared = Vec::new();
+        for (index, notification) in prepare(notifications)?.into_iter().enumerate() {
+            if notification.options.delivery_date.is_some()
+                || notification.options.recurrence.is_some()
+            {
+                match schedule(notification) {
+                    Ok(handle) => responses[index] = Some(NotificationResponse::Scheduled(handle)),
+                    Err(error) => {
+                        cancel_scheduled(responses);
+                        return Err(error);
+                    }
+                }
+            } else {
+                indices.push(index);
+                prepared.push(notification);
+            }
         }
-        let dictionary_response = sys::sendNotification(
-            NSString::from_str(title).deref(),
-            NSString::from_str(subtitle.unwrap_or("")).deref(),
-            NSString::from_str(message).deref(),
-            options.deref(),
-        );
-        ensure!(
-            dictionary_response
-                .deref()
-                .object_for(NSString::from_str("error").deref())
-                .is_none(),
-            NotificationError::UnableToDeliver
+
+        if !prepared.is_empty() {
+            let run_loop: Arc<dyn EventLoop> = Arc::new(CurrentRunLoop::new());
+            let delivered = batch::send_all(self, run_loop, &prepared, DELIVERY_ACK_TIMEOUT);
+            let delivered = match delivered {
+                Some(delivered) => delivered,
+                None => {
+                    cancel_scheduled(responses);
+                    return Err(NotificationError::UnableToDeliver.into());
+                }
+            };
+            for (index, response) in indices.into_iter().zip(delivered) {
+                responses[index] = response;
+            }
+        }
+
+        Ok(responses
+            .into_iter()
+            .map(|response| response.unwrap_or(NotificationResponse::None))
+            .collect())
+    }
+
+    /// Delivers a new notification without blocking
+    ///
+    /// The returned future resolves once the user interacted with the notification,
+    /// fire-and-forget notifications resolve right after they were delivered. It resolves to
+    /// `NotificationResponse::TimedOut` once the [`Notification::timeout`] passed, and to
+    /// `NotificationResponse::Cancelled` once the [`Notification::cancel_handle`] was cancelled.
+    /// Any number of futures can be outstanding at the same time.
+    ///
+    /// The notification is sent through a [`NotificationService`] shared by the process, whose
+    /// thread runs the run loop the delegate callbacks arrive on and completes the futures,
+    /// so the thread that awaits them does not need a run loop of its own.
+    pub fn send_async(
+        &self,
+        title: &str,
+        subtitle: Option<&str>,
+        message: &str,
+        options: Option<&Notification>,
+    ) -> NotificationFuture {
+        send_notification_async(title, subtitle, message, options)
+    }
+}
+
+/// Take the notifications of a failed batch that were scheduled already out of the schedule,
+/// nothing of a failed batch is sent, neither now nor later
+#[cfg(target_os = "macos")]
+fn cancel_scheduled(responses: Vec<Option<NotificationResponse>>) {
+    for response in responses.into_iter().flatten() {
+        if let NotificationResponse::Scheduled(handle) = response {
+            handle.cancel();
+        }
+    }
+}
+
+/// Check and convert notifications for the Objective C side
+#[cfg(target_os = "macos")]
+fn prepare(
+    notifications: &[(&str, Option<&str>, &str, Option<&Notification>)],
+) -> NotificationResult<Vec<PreparedNotification>> {
+    let now = Utc::now().timestamp() as f64;
+    for (_, _, _, options) in notifications {
+        if let Some(delivery_date) = options.and_then(|options| options.delivery_date) {
+            ensure!(delivery_date >= now, NotificationError::ScheduleInThePast);
+        }
+    }
+    fetch_remote_images(notifications);
+
+    let sounds = available_sounds();
+    Ok(notifications
+        .iter()
+        .map(|(title, subtitle, message, options)| {
+            let mut options = options.map(Notification::to_options).unwrap_or_default();
+            // Sounds that do not exist are muted
+            options.sound = options.sound.filter(|sound| sounds.contains(sound));
+            PreparedNotification {
+                title: title.to_string(),
+                subtitle: subtitle.map(String::from),
+                message: message.to_string(),
+                options,
+            }
+        })
+        .collect())
+}
+
+/// Future of the response to a notification sent with [`send_notification_async`]
+/// or [`NotificationCenter::send_async`]
+#[cfg(target_os = "macos")]
+pub struct NotificationFuture {
+    response: WaitFuture<NotificationResponse>,
+    error: Option<Error>,
+}
+
+#[cfg(target_os = "macos")]
+impl NotificationFuture {
+    fn failed(error: Error) -> Self {
+        NotificationFuture {
+            response: WaitFuture::ready(),
+            error: Some(error),
+        }
+    }
+}
+
+#[cfg(target_os = "macos")]
+impl Future for NotificationFuture {
+    type Output = NotificationResult<NotificationResponse>;
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context) -> Poll<Self::Output> {
+        let this = self.get_mut();
+        if let Some(error) = this.error.take() {
+            return Poll::Ready(Err(error));
+        }
+        Pin::new(&mut this.response)
+            .poll(cx)
+            .map(|response| Ok(response.unwrap_or(NotificationResponse::None)))
+    }
+}
+
+#[cfg(target_os = "macos")]
+impl NotificationCenter {
+    /// Hand notifications to the delegate, under their own identifier if one is given.
+    ///
+    /// Every waiter that is given is held by the delegate until it reported back.
+    fn deliver_with(
+        &self,
+        notifications: &[PreparedNotification],
+        identifiers: Option<&[Id<NSString>]>,
+        waiters: &[Option<&Arc<ResponseWaiter>>],
+    ) -> Vec<Delivery> {
+        let titles: Vec<RawStr> = notifications
+            .iter()
+            .map(|n| RawStr::new(&n.title))
+            .collect();
+        let subtitles: Vec<RawStr> = notifications
+            .iter()
+            .map(|n| RawStr::from_option(n.subtitle.as_ref()))
+            .collect();
+        let messages: Vec<RawStr> = notifications
+            .iter()
+            .map(|n| RawStr::new(&n.message))
+            .collect();
+        let actions: Vec<Vec<RawStr>> = notifications
+            .iter()
+            .map(|n| n.options.raw_actions())
+            .collect();
+        // the cached images are held until the notifications were handed over
+        let images: Vec<(Option<CachedImage>, Option<CachedImage>)> = notifications
+            .iter()
+            .map(|n| {
+                (
+                    cached_image(n.options.app_icon.as_ref()),
+                    cached_image(n.options.content_image.as_ref()),
+                )
+            })
+            .collect();
+        let max_pixel_size = image_cache().lock().unwrap().max_pixel_size();
+        let options: Vec<RawOptions> = notifications
+            .iter()
+            .zip(&actions)
+            .zip(&images)
+            .map(|((n, actions), (app_icon, content_image))| {
+                let mut options = n.options.as_raw(actions);
+                options.app_icon = local_image(&n.options.app_icon);
+                options.content_image = local_image(&n.options.content_image);
+                options.decoded_app_icon = image_ptr(app_icon);
+                options.decoded_content_image = image_ptr(content_image);
+                options.max_image_pixel_size = max_pixel_size.map_or(0, |size| size as usize);
+                options
+            })
+            .collect();
+        let identifiers: Option<Vec<*const NSString>> = identifiers.map(|identifiers| {
+            identifiers
+                .iter()
+                .map(|identifier| {
+                    let identifier: *const NSString = identifier.deref();
+                    identifier
+                })
+                .collect()
+        });
+        // every pending notification of the delegate holds a reference to its waiter
+        let waiter_ptrs: Vec<*const c_void> = waiters
+            .iter()
+            .map(|waiter| match waiter {
+                Some(waiter) => Arc::into_raw(Arc::clone(waiter)) as *const c_void,
+                None => std::ptr::null(),
+            })
+            .collect();
+        let mut deliveries = vec![sys::DELIVERY_FAILED; notifications.len()];
+
+        unsafe {
+            sys::sendNotifications(
+                self.session.deref(),
+                notifications.len(),
+                identifiers
+                    .as_ref()
+                    .map_or(std::ptr::null(), |identifiers| identifiers.as_ptr()),
+                titles.as_ptr(),
+                subtitles.as_ptr(),
+                messages.as_ptr(),
+                options.as_ptr(),
+                waiter_ptrs.as_ptr(),
+                deliveries.as_mut_ptr(),
+            );
+        }
+
+        deliveries
+            .into_iter()
+            .map(|delivery| match delivery {
+                sys::DELIVERY_FAILED => Delivery::Failed,
+                sys::DELIVERY_AWAITING_RESPONSE => Delivery::AwaitingResponse,
+                _ => Delivery::Delivered,
+            })
+            .collect()
+    }
+}
+
+/// Remote images are only ever fetched within the limits, never by `NSImage`
+#[cfg(target_os = "macos")]
+fn local_image(url: &Option<String>) -> RawStr<'_> {
+    RawStr::from_option(url.as_ref().filter(|url| !remote::is_remote(url)))
+}
+
+#[cfg(target_os = "macos")]
+fn image_ptr(image: &Option<CachedImage>) -> *const c_void {
+    match image {
+        Some(CachedImage(image)) => {
+            let image: *const NSObject = image.deref();
+            image as *const c_void
+        }
+        None => std::ptr::null(),
+    }
+}
+
+#[cfg(target_os = "macos")]
+impl Deliver<PreparedNotification, NotificationResponse> for NotificationCenter {
+    fn deliver_all(
+        &self,
+        notifications: &[PreparedNotification],
+        waiters: &[Arc<ResponseWaiter>],
+    ) -> Vec<Delivery> {
+        let waiters: Vec<Option<&Arc<ResponseWaiter>>> = waiters.iter().map(Some).collect();
+        self.deliver_with(notifications, None, &waiters)
+    }
+
+    fn detach_all(&self, waiters: &[Arc<ResponseWaiter>]) {
+        if waiters.is_empty() {
+            return;
+        }
+        let waiter_ptrs: Vec<*const c_void> = waiters
+            .iter()
+            .map(|waiter| {
+                let waiter: *const ResponseWaiter = &**waiter;
+                waiter as *const c_void
+            })
+            .collect();
+        unsafe { sys::detachWaiters(self.session.deref(), waiters.len(), waiter_ptrs.as_ptr()) }
+    }
+
+    fn response_timeout(&self, notification: &PreparedNotification) -> Option<Duration> {
+        notification.options.response_timeout
+    }
+
+    fn cancel_handle<'a>(
+        &self,
+        notification: &'a PreparedNotification,
+    ) -> Option<&'a CancelHandle> {
+        notification.options.cancel_handle.as_ref()
+    }
+
+    fn gave_up(
+        &self,
+        notification: &PreparedNotification,
+        waiter: &Arc<ResponseWaiter>,
+        reason: GaveUp,
+    ) -> NotificationResponse {
+        if reason == GaveUp::Cancelled || notification.options.remove_on_timeout {
+            let waiter: *const ResponseWaiter = &**waiter;
+            unsafe { sys::withdrawWaiter(self.session.deref(), waiter as *const c_void) }
+        }
+        match reason {
+            GaveUp::TimedOut => NotificationResponse::TimedOut,
+            GaveUp::Cancelled => NotificationResponse::Cancelled,
+        }
+    }
+}
+
+#[cfg(target_os = "macos")]
+impl Drop for NotificationCenter {
+    fn drop(&mut self) {
+        // The shared delegate stays installed for the other sessions
+        unsafe { sys::closeNotificationCenter(self.session.deref()) }
+    }
+}
+
+/// A notification center running on a thread of its own
+///
+/// The thread sets up the notification center once and runs the run loop its callbacks arrive on,
+/// so responses come in without the sending thread running a run loop.
+/// Notifications can be sent, updated and removed from any thread, clones share the same thread.
+/// The thread stops once the service and all of its clones were dropped.
+///
+/// # Example:
+///
+/// ```no_run
+/// # use mac_notification_sys::*;
+/// let service = NotificationService::spawn().unwrap();
+/// let progress = service.send("Backup", None, "Started", None).unwrap();
+/// service.update(progress.id(), "Backup", None, "Halfway there", None).unwrap();
+/// service.remove(progress.id()).unwrap();
+/// ```
+#[cfg(target_os = "macos")]
+#[derive(Clone)]
+pub struct NotificationService {
+    service: Service<PreparedNotification, NotificationResponse>,
+}
+
+#[cfg(target_os = "macos")]
+impl NotificationService {
+    /// Start the thread and set up its notification center
+    ///
+    /// Uses the default application if none has been set yet.
+    pub fn spawn() -> NotificationResult<Self> {
+        let service = Service::spawn(|| {
+            Some(OwnedCenter {
+                center: NotificationCenter::new().ok()?,
+                run_loop: Arc::new(CurrentRunLoop::new()),
+                prefix: format!(
+                    "mac-notification-sys.{}.",
+                    SERVICE_COUNT.fetch_add(1, Ordering::Relaxed)
+                ),
+            })
+        })
+        .ok_or(NotificationError::UnableToDeliver)?;
+        Ok(NotificationService { service })
+    }
+
+    /// Delivers a new notification without waiting for the notification center
+    ///
+    /// The returned handle resolves once the user interacted with the notification,
+    /// fire-and-forget notifications resolve right after they were delivered.
+    pub fn send(
+        &self,
+        title: &str,
+        subtitle: Option<&str>,
+        message: &str,
+        options: Option<&Notification>,
+    ) -> NotificationResult<NotificationHandle> {
+        let prepared = prepare(&[(title, subtitle, message, options)])?.remove(0);
+        let waiter = Arc::new(Waiter::new(Arc::new(Parker::default())));
+        let id = self.send_prepared(prepared, Arc::clone(&waiter))?;
+        Ok(NotificationHandle {
+            id,
+            response: WaitFuture::new(Arc::clone(&waiter)),
+            waiter,
+        })
+    }
+
+    /// Hand a notification to the thread, which gives up on the response once the timeout
+    /// passed or the cancel handle was cancelled
+    fn send_prepared(
+        &self,
+        prepared: PreparedNotification,
+        waiter: Arc<ResponseWaiter>,
+    ) -> NotificationResult<u64> {
+        let patience = Patience {
+            deadline: prepared
+                .options
+                .response_timeout
+                .map(|timeout| Instant::now() + timeout),
+            remove_on_timeout: prepared.options.remove_on_timeout,
+            cancel: prepared.options.cancel_handle.clone(),
+        };
+        Ok(self
+            .service
+            .send(prepared, waiter, patience)
+            .ok_or(NotificationError::UnableToDeliver)?)
+    }
+
+    /// Replaces the notification with the given id, its handle stays the same
+    pub fn update(
+        &self,
+        id: u64,
+        title: &str,
+        subtitle: Option<&str>,
+        message: &str,
+        options: Option<&Notification>,
+    ) -> NotificationResult<()> {
+        let prepared = prepare(&[(title, subtitle, message, options)])?.remove(0);
+        self.service
+            .update(id, prepared)
+            .ok_or(NotificationError::UnableToDeliver)?;
+        Ok(())
+    }
+
+    /// Removes the notification with the given id, whether it is shown or still scheduled
+    ///
+    /// Its handle resolves to `NotificationResponse::None`.
+    pub fn remove(&self, id: u64) -> NotificationResult<()> {
+        self.service
+            .remove(id)
+            .ok_or(NotificationError::UnableToDeliver)?;
+        Ok(())
+    }
+
+    /// Ids of the notifications of this service that are currently shown
+    pub fn delivered(&self) -> NotificationResult<Vec<u64>> {
+        Ok(self
+            .service
+            .delivered()
+            .ok_or(NotificationError::UnableToDeliver)?)
+    }
+}
+
+#[cfg(target_os = "macos")]
+impl ScheduleHandle {
+    /// Takes the notification out of the schedule, returns whether it was still waiting
+    ///
+    /// A series is not delivered again. [`ScheduleHandle::wait`] returns
+    /// `NotificationResponse::Cancelled` after that, unless the first instance was delivered.
+    /// An instance that is being delivered right then is delivered all the same and `false`
+    /// returned, though a series ends with it.
+    pub fn cancel(&self) -> bool {
+        let stage = match scheduler() {
+            Some(scheduler) => scheduler.cancel(self.key),
+            None => Stage::Free,
+        };
+        // the instance of a series that is being delivered is its last one
+        let done = stage == Stage::Pending || (stage == Stage::Firing && self.repeats);
+        if let (true, Some(id)) = (done, self.outbox_id) {
+            if let Some(outbox) = outbox().lock().unwrap().as_mut() {
+                // a cancellation that could not be recorded is undone by a restart
+                let _ = outbox.cancel(id);
+            }
+        }
+        let cancelled = stage == Stage::Pending;
+        if cancelled {
+            self.waiter.complete(NotificationResponse::Cancelled);
+            self.delivered.complete(FirstDelivery {
+                at: Instant::now(),
+                remove: None,
+            });
+        }
+        cancelled
+    }
+
+    /// Whether the notification still waits for its delivery date, or a series for its next instance
+    pub fn is_pending(&self) -> bool {
+        matches!(scheduler(), Some(scheduler) if scheduler.is_pending(self.key))
+    }
+
+    /// Blocks until the notification was delivered and, if it asks for it, the user responded
+    ///
+    /// For a series this is the response to its first instance. The [`Notification::timeout`]
+    /// counts from when the notification was delivered. Once the
+    /// [`Notification::cancel_handle`] is cancelled, the notification is taken out of the
+    /// schedule, or off the screen if it was delivered already.
+    pub fn wait(self) -> NotificationResponse {
+        let delivered = match self.wait_for(&self.delivered, None) {
+            Some(delivered) => Some(delivered),
+            None => {
+                // cancelled, the notification may be going out right now
+                self.cancel();
+                self.delivered.wait(None)
+            }
+        };
+        let deadline = match (&delivered, self.timeout) {
+            (Some(delivered), Some(timeout)) => Some(delivered.at + timeout),
+            _ => None,
+        };
+        if let Some(response) = self.wait_for(&self.waiter, deadline) {
+            return response;
+        }
+        let cancelled = matches!(&self.cancel, Some(cancel) if cancel.is_cancelled());
+        if cancelled {
+            // later instances of a series are cancelled as well
+            self.cancel();
+        }
+        if cancelled || self.remove_on_timeout {
+            if let Some(remove) = delivered.and_then(|delivered| delivered.remove) {
+                remove();
+            }
+        }
+        if cancelled {
+            NotificationResponse::Cancelled
+        } else {
+            NotificationResponse::TimedOut
+        }
+    }
+
+    /// Wait for the waiter until the deadline, or until the cancel handle is cancelled
+    fn wait_for<T>(&self, waiter: &Waiter<T>, deadline: Option<Instant>) -> Option<T> {
+        match &self.cancel {
+            Some(cancel) => cancel.wait(waiter, deadline),
+            None => waiter.wait(deadline),
+        }
+    }
+}
+
+/// A notification sent through a [`NotificationService`]
+///
+/// Await it or call [`NotificationHandle::wait`] for the response.
+#[cfg(target_os = "macos")]
+pub struct NotificationHandle {
+    id: u64,
+    waiter: Arc<ResponseWaiter>,
+    response: WaitFuture<NotificationResponse>,
+}
+
+#[cfg(target_os = "macos")]
+impl NotificationHandle {
+    /// Identifies the notification to [`NotificationService::update`] and [`NotificationService::remove`]
+    pub fn id(&self) -> u64 {
+        self.id
+    }
+
+    /// Blocks until the response arrived, until the [`Notification::timeout`] passed
+    /// or until the [`Notification::cancel_handle`] was cancelled
+    ///
+    /// Awaiting the handle resolves the same way.
+    pub fn wait(self) -> NotificationResponse {
+        self.waiter.wait(None).unwrap_or(NotificationResponse::None)
+    }
+}
+
+#[cfg(target_os = "macos")]
+impl Future for NotificationHandle {
+    type Output = NotificationResponse;
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context) -> Poll<Self::Output> {
+        Pin::new(&mut self.get_mut().response)
+            .poll(cx)
+            .map(|response| response.unwrap_or(NotificationResponse::None))
+    }
+}
+
+/// The notification center on the thread of a [`NotificationService`], addressed by numeric ids
+#[cfg(target_os = "macos")]
+struct OwnedCenter {
+    center: NotificationCenter,
+    run_loop: Arc<CurrentRunLoop>,
+    // Sessions share the delegate, the prefix keeps their identifiers apart
+    prefix: String,
+}
+
+#[cfg(target_os = "macos")]
+impl OwnedCenter {
+    fn identifier(&self, id: u64) -> Id<NSString> {
+        NSString::from_str(&format!("{}{}", self.prefix, id))
+    }
+}
+
+#[cfg(target_os = "macos")]
+impl Center for OwnedCenter {
+    type Notification = PreparedNotification;
+    type Response = NotificationResponse;
+
+    fn event_loop(&self) -> Arc<dyn EventLoop> {
+        self.run_loop.clone()
+    }
+
+    fn deliver(
+        &mut self,
+        id: u64,
+        notification: PreparedNotification,
+        waiter: Option<Arc<ResponseWaiter>>,
+    ) {
+        let identifier = self.identifier(id);
+        let deliveries = self.center.deliver_with(
+            std::slice::from_ref(&notification),
+            Some(std::slice::from_ref(&identifier)),
+            &[waiter.as_ref()],
         );
+        if deliveries[0] == Delivery::Failed {
+            if let Some(waiter) = waiter {
+                waiter.complete(NotificationResponse::None);
+            }
+        }
+    }
+
+    fn remove(&mut self, id: u64) {
+        let identifier = self.identifier(id);
+        unsafe { sys::removeNotification(self.center.session.deref(), identifier.deref()) }
+    }
+
+    fn delivered(&mut self) -> Vec<u64> {
+        let identifiers: Id<NSArray<NSString>> = unsafe {
+            Id::from_retained_ptr(sys::deliveredNotificationIdentifiers(
+                self.center.session.deref(),
+            ))
+        };
+        identifiers
+            .to_vec()
+            .into_iter()
+            .map(|identifier| identifier.as_str())
+            .filter(|identifier| identifier.starts_with(&self.prefix))
+            .filter_map(|identifier| identifier[self.prefix.len()..].parse().ok())
+            .collect()
+    }
+
+    fn gave_up(&self, reason: GaveUp) -> NotificationResponse {
+        match reason {
+            GaveUp::TimedOut => NotificationResponse::TimedOut,
+            GaveUp::Cancelled => NotificationResponse::Cancelled,
+        }
+    }
+}
+
+/// Whether the hook that makes notifications appear to come from the application set with
+/// [`set_application`] is active.
+///
+/// It is installed once per process by the first [`NotificationCenter`].
+#[cfg(target_os = "macos")]
+pub fn bundle_hook_active() -> bool {
+    BUNDLE_HOOK.is_active()
+}
 
-        let response = NotificationResponse::from_dictionary(dictionary_response);
+/// Keep scheduled notifications in an outbox file, so they are delivered even if the process
+/// restarts
+///
+/// Notifications scheduled from then on are recorded in the file until they were delivered or
+/// cancelled. Notifications the file still holds from an earlier run are scheduled again
+/// right away and their handles returned: overdue ones are delivered at once, a series
+/// carries on with its next instance. Cancel handles are not kept. A notification that was
+/// delivered just before the process stopped may be delivered again.
+///
+/// Fails if the file cannot be read or written, if it is not empty and not an outbox, or if an
+/// outbox was set already. A file that is not an outbox is never overwritten.
+///
+/// # Example:
+///
+/// ```no_run
+/// # use mac_notification_sys::*;
+/// # use std::path::Path;
+/// let restored = set_outbox(Path::new("/tmp/reminders.outbox")).unwrap();
+/// println!("{} reminders are still scheduled", restored.len());
+/// ```
+#[cfg(target_os = "macos")]
+pub fn set_outbox(path: &Path) -> NotificationResult<Vec<ScheduleHandle>> {
+    let scheduler = scheduler().ok_or(NotificationError::UnableToDeliver)?;
+    let mut outbox = outbox().lock().unwrap();
+    ensure!(outbox.is_none(), NotificationError::UnableToSchedule);
+    let mut opened =
+        Outbox::open(path.to_path_buf(), true).map_err(|_| NotificationError::UnableToSchedule)?;
+    let mut restored = Vec::new();
+    let mut broken = Vec::new();
+    for (id, due, payload) in opened.pending() {
+        match PreparedNotification::decode(payload) {
+            Some(notification) => {
+                restored.push(enqueue(scheduler, notification, due, Some(id)));
+            }
+            None => broken.push(id),
+        }
+    }
+    for id in broken {
+        let _ = opened.cancel(id);
+    }
+    // restored notifications that are due already wait for the outbox to be set
+    *outbox = Some(opened);
+    Ok(restored)
+}
+
+/// Set how many bytes of decoded app icons and content images are kept in memory
+///
+/// Images given as a path or `file://` URL are decoded once and reused as long as the file keeps
+/// its modification time and size. The images used least recently are dropped first once
+/// the budget is exceeded, a budget of `0` turns the cache off. Defaults to 32 MiB.
+#[cfg(target_os = "macos")]
+pub fn set_image_cache_budget(bytes: usize) {
+    image_cache().lock().unwrap().set_budget(bytes);
+}
+
+/// Scale app icons and content images down to at most `pixels` wide and high
+///
+/// The banner of a notification only shows a small thumbnail, so images of many megapixels only
+/// take up memory for as long as their notification is shown. Thumbnails are decoded straight
+/// from the file without decoding it at full resolution first, and are what the image cache keeps.
+/// Changing the size drops all cached images. Defaults to `None`, which keeps images as they are.
+#[cfg(target_os = "macos")]
+pub fn set_image_max_pixel_size(pixels: Option<u32>) {
+    image_cache().lock().unwrap().set_max_pixel_size(pixels);
+}
+
+/// Bound how long fetching a remote app icon or content image may take, and how large it may be
+///
+/// Images given as `http://` or `https://` URL are fetched when sending, and kept in the
+/// user's cache directory. Only images without a cached copy are waited for, all images of a
+/// send at the same time, which delays it by `timeout` at most. A cached copy that is no
+/// longer fresh is sent as it is and revalidated with a conditional request in the background.
+/// An image that cannot be fetched within the limits is left out, and its server is not asked
+/// again for a while. Defaults to 2 seconds and 10 MiB.
+#[cfg(target_os = "macos")]
+pub fn set_remote_image_limits(timeout: Duration, max_bytes: usize) {
+    *remote_images().limits.lock().unwrap() = Limits { timeout, max_bytes };
+}
 
-        Ok(response)
+/// Hits, misses and the size of the image cache
+#[cfg(target_os = "macos")]
+pub fn image_cache_stats() -> ImageCacheStats {
+    image_cache().lock().unwrap().stats()
+}
+
+/// Drop the cached image of the given path, so it is decoded again the next time it is used
+///
+/// Only needed if the file was replaced without changing its modification time or size.
+#[cfg(target_os = "macos")]
+pub fn invalidate_cached_image(path: &str) {
+    if let Some(path) = image_cache::local_path(path) {
+        image_cache().lock().unwrap().invalidate(&path);
     }
 }
 
+/// Drop all cached images
+#[cfg(target_os = "macos")]
+pub fn clear_image_cache() {
+    image_cache().lock().unwrap().clear();
+}
+
+/// The sounds a notification can play, by the names [`Notification::sound`] takes
+///
+/// The sound directories of the user, the system and the network are scanned once and
+/// scanned again when one of them changed, which is checked at most once a second.
+/// Sends look their sound up in the same catalog, sounds that are not in it are muted.
+#[cfg(target_os = "macos")]
+pub fn available_sounds() -> AvailableSounds {
+    sound_catalog().lock().unwrap().sounds()
+}
+
 /// Search for a possible BundleIdentifier of a given appname.
 /// Defaults to "com.apple.Finder" if no BundleIdentifier is found.
+#[cfg(target_os = "macos")]
 pub fn get_bundle_identifier_or_default(app_name: &str) -> String {
     get_bundle_identifier(app_name).unwrap_or_else(|| "com.apple.Finder".to_string())
 }
 
 /// Search for a BundleIdentifier of an given appname.
+///
+/// Applications in `/Applications`, `/System/Applications`, `/System/Library/CoreServices`
+/// and `~/Applications` are looked up in an index of their `Info.plist` files, by the name of
+/// the bundle, `CFBundleName` or `CFBundleDisplayName`, ignoring case. The index is kept in
+/// the user's cache directory and built again once applications were added or removed.
+///
+/// Other names are resolved by the system and cached in memory and in the user's cache
+/// directory, so later runs do not ask the system again. Identifiers are resolved again after
+/// a week, names without an application after a day.
+#[cfg(target_os = "macos")]
 pub fn get_bundle_identifier(app_name: &str) -> Option<String> {
-    unsafe {
-        sys::getBundleIdentifier(NSString::from_str(app_name).deref()) // *const NSString
-            .as_ref() // Option<NSString>
-            .map(NSString::as_str)
-            .map(String::from)
+    let indexed = app_index().lock().unwrap().lookup(app_name);
+    indexed.or_else(|| BundleCache::get(bundle_cache(), app_name))
+}
+
+/// Search for the BundleIdentifiers of many appnames at once, in the same order.
+///
+/// Looks names up like [`get_bundle_identifier`], but checks the index once for all names, and
+/// resolves all names that are neither indexed nor cached with a single script.
+#[cfg(target_os = "macos")]
+pub fn get_bundle_identifiers(app_names: &[&str]) -> Vec<Option<String>> {
+    let mut bundles = app_index().lock().unwrap().lookup_all(app_names);
+    let missing: Vec<&str> = app_names
+        .iter()
+        .zip(&bundles)
+        .filter(|(_, bundle)| bundle.is_none())
+        .map(|(app_name, _)| *app_name)
+        .collect();
+    if missing.is_empty() {
+        return bundles;
     }
+    // scripts are run one at a time, in one batch
+    let mut resolved = BundleCache::get_all(bundle_cache(), &missing, 1).into_iter();
+    for bundle in bundles.iter_mut().filter(|bundle| bundle.is_none()) {
+        *bundle = resolved.next().unwrap_or(None);
+    }
+    bundles
+}
+
+/// Forget all bundle identifiers resolved by [`get_bundle_identifier`], in memory and on disk
+///
+/// Only needed if an application was installed or replaced and should be picked up right away.
+#[cfg(target_os = "macos")]
+pub fn clear_bundle_identifier_cache() {
+    bundle_cache().lock().unwrap().clear();
 }
 
 /// Set the application which delivers or schedules a notification
+#[cfg(target_os = "macos")]
 pub fn set_application(bundle_ident: &str) -> NotificationResult<()> {
-    unsafe {
-        ensure!(!APPLICATION_SET, ApplicationError::AlreadySet(bundle_ident.into()));
-        ensure!(
-            sys::setApplication(NSString::from_str(bundle_ident).deref()),
-            ApplicationError::CouldNotSet(bundle_ident.into())
-        );
-        INIT_APPLICATION_SET.call_once(|| {
-            APPLICATION_SET = true;
-        });
-        Ok(())
+    let claimed = APPLICATION_SET
+        .compare_exchange(false, true, Ordering::SeqCst, Ordering::SeqCst)
+        .is_ok();
+    ensure!(claimed, ApplicationError::AlreadySet(bundle_ident.into()));
+    if !unsafe { sys::setApplication(NSString::from_str(bundle_ident).deref()) } {
+        APPLICATION_SET.store(false, Ordering::SeqCst);
+        bail!(ApplicationError::CouldNotSet(bundle_ident.into()));
     }
+    Ok(())
 }
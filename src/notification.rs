@@ -1,10 +1,14 @@
 //! Custom structs and enums for mac-notification-sys.
 
-use objc_foundation::{INSDictionary, INSString, NSDictionary, NSString};
-use objc_id::Id;
+use crate::cancel::CancelHandle;
+use crate::options::*;
+use crate::recurrence::Recurrence;
+use crate::schedule::Key;
+use crate::wait::Waiter;
 use std::default::Default;
-use std::ops::Deref;
-use std::path::PathBuf;
+use std::fmt;
+use std::sync::Arc;
+use std::time::{Duration, Instant};
 
 /// Possible actions accessible through the main button of the notification
 pub enum MainButton<'a> {
@@ -44,9 +48,15 @@ pub struct Notification<'a> {
     pub(crate) close_button: Option<&'a str>,
     pub(crate) app_icon: Option<&'a str>,
     pub(crate) content_image: Option<&'a str>,
+    pub(crate) app_icon_bytes: Option<&'a [u8]>,
+    pub(crate) content_image_bytes: Option<&'a [u8]>,
     pub(crate) delivery_date: Option<f64>,
     pub(crate) sound: Option<&'a str>,
     pub(crate) asynchronous: Option<bool>,
+    pub(crate) timeout: Option<Duration>,
+    pub(crate) remove_on_timeout: bool,
+    pub(crate) cancel_handle: Option<&'a CancelHandle>,
+    pub(crate) recurrence: Option<Recurrence>,
 }
 
 impl<'a> Notification<'a> {
@@ -93,6 +103,25 @@ impl<'a> Notification<'a> {
     /// ```
     pub fn app_icon(&mut self, app_icon: &'a str) -> &mut Self {
         self.app_icon = Some(app_icon);
+        self.app_icon_bytes = None;
+        self
+    }
+
+    /// Display an icon on the left side of the notification, from an image in memory
+    ///
+    /// Takes any format `NSImage` can read, like PNG or ICNS. The bytes are handed to the
+    /// notification center as they are, so no temporary file is needed.
+    ///
+    /// # Example:
+    ///
+    /// ```no_run
+    /// # use mac_notification_sys::*;
+    /// let icon = std::fs::read("/path/to/icon.png").unwrap();
+    /// let _ = Notification::new().app_icon_bytes(&icon);
+    /// ```
+    pub fn app_icon_bytes(&mut self, app_icon: &'a [u8]) -> &mut Self {
+        self.app_icon_bytes = Some(app_icon);
+        self.app_icon = None;
         self
     }
 
@@ -106,11 +135,41 @@ impl<'a> Notification<'a> {
     /// ```
     pub fn content_image(&mut self, content_image: &'a str) -> &mut Self {
         self.content_image = Some(content_image);
+        self.content_image_bytes = None;
+        self
+    }
+
+    /// Display an image on the right side of the notification, from an image in memory
+    ///
+    /// Takes any format `NSImage` can read, see [`Notification::app_icon_bytes`].
+    ///
+    /// # Example:
+    ///
+    /// ```no_run
+    /// # use mac_notification_sys::*;
+    /// # fn render_chart() -> Vec<u8> { Vec::new() }
+    /// let chart: Vec<u8> = render_chart();
+    /// let _ = Notification::new().content_image_bytes(&chart);
+    /// ```
+    pub fn content_image_bytes(&mut self, content_image: &'a [u8]) -> &mut Self {
+        self.content_image_bytes = Some(content_image);
+        self.content_image = None;
         self
     }
 
     /// Schedule the notification to be delivered at a later time
     ///
+    /// Sends return `NotificationResponse::Scheduled` right away, the notification is held by
+    /// the crate until it is due and delivered from a thread of its own, so the process has to
+    /// keep running until then. Asynchronous sends and a [`NotificationService`] leave the
+    /// scheduling to the notification center instead.
+    ///
+    /// A notification kept in an outbox with [`set_outbox`] is also delivered if the process
+    /// restarts before it is due.
+    ///
+    /// [`NotificationService`]: crate::NotificationService
+    /// [`set_outbox`]: crate::set_outbox
+    ///
     /// # Example:
     ///
     /// ```no_run
@@ -152,56 +211,132 @@ impl<'a> Notification<'a> {
         self
     }
 
-    /// Convert the Notification to an Objective C NSDictionary
-    pub(crate) fn to_dictionary(&self) -> Id<NSDictionary<NSString, NSString>> {
-        // TODO: If possible, find a way to simplify this so I don't have to manually convert struct to NSDictionary
-        let keys = &[
-            &*NSString::from_str("mainButtonLabel"),
-            &*NSString::from_str("actions"),
-            &*NSString::from_str("closeButtonLabel"),
-            &*NSString::from_str("appIcon"),
-            &*NSString::from_str("contentImage"),
-            &*NSString::from_str("response"),
-            &*NSString::from_str("deliveryDate"),
-            &*NSString::from_str("asynchronous"),
-            &*NSString::from_str("sound"),
-        ];
-        let (main_button_label, actions, is_response): (&str, &[&str], bool) =
+    /// Stop waiting for the user to respond after the given time
+    ///
+    /// Sends that wait for a response return `NotificationResponse::TimedOut` once the time
+    /// passed without one, counted from when the notification was sent. Applies to
+    /// [`send_notification`], [`NotificationCenter::send`], the futures of
+    /// [`send_notification_async`], [`NotificationService::send`] and
+    /// [`ScheduleHandle::wait`], where it counts from when the notification was delivered.
+    /// The notification stays on screen unless [`Notification::remove_on_timeout`] is set.
+    ///
+    /// [`send_notification`]: crate::send_notification
+    /// [`NotificationCenter::send`]: crate::NotificationCenter::send
+    /// [`send_notification_async`]: crate::send_notification_async
+    /// [`NotificationService::send`]: crate::NotificationService::send
+    ///
+    /// # Example:
+    ///
+    /// ```no_run
+    /// # use mac_notification_sys::*;
+    /// # use std::time::Duration;
+    /// let _ = Notification::new()
+    ///     .main_button(MainButton::SingleAction("Approve"))
+    ///     .timeout(Duration::from_secs(60));
+    /// ```
+    pub fn timeout(&mut self, timeout: Duration) -> &mut Self {
+        self.timeout = Some(timeout);
+        self
+    }
+
+    /// Remove the notification from the screen once nobody waits for it after its [`Notification::timeout`]
+    ///
+    /// # Example:
+    ///
+    /// ```no_run
+    /// # use mac_notification_sys::*;
+    /// # use std::time::Duration;
+    /// let _ = Notification::new()
+    ///     .timeout(Duration::from_secs(60))
+    ///     .remove_on_timeout(true);
+    /// ```
+    pub fn remove_on_timeout(&mut self, remove_on_timeout: bool) -> &mut Self {
+        self.remove_on_timeout = remove_on_timeout;
+        self
+    }
+
+    /// Stop waiting for the user to respond once the given handle is cancelled
+    ///
+    /// Sends that wait for a response return `NotificationResponse::Cancelled` and remove the
+    /// notification from the screen. Applies to the same sends as [`Notification::timeout`].
+    /// A scheduled notification that was not delivered yet is taken out of the schedule.
+    ///
+    /// # Example:
+    ///
+    /// ```no_run
+    /// # use mac_notification_sys::*;
+    /// let cancel = CancelHandle::new();
+    /// let _ = Notification::new()
+    ///     .main_button(MainButton::SingleAction("Approve"))
+    ///     .cancel_handle(&cancel);
+    /// ```
+    pub fn cancel_handle(&mut self, cancel_handle: &'a CancelHandle) -> &mut Self {
+        self.cancel_handle = Some(cancel_handle);
+        self
+    }
+
+    /// Deliver the notification again and again, starting at the [`Notification::delivery_date`]
+    /// or else the first time the recurrence fires
+    ///
+    /// Sends return `NotificationResponse::Scheduled` right away and the series is held like a
+    /// scheduled notification, only its next instance is kept. Instances missed while the
+    /// machine was asleep are skipped. Asynchronous sends and a [`NotificationService`]
+    /// deliver the notification once.
+    ///
+    /// [`NotificationService`]: crate::NotificationService
+    ///
+    /// # Example:
+    ///
+    /// ```no_run
+    /// # use mac_notification_sys::*;
+    /// # use std::time::Duration;
+    /// let _ = Notification::new().recurrence(Recurrence::Every(Duration::from_secs(3600)));
+    /// let _ = Notification::new()
+    ///     .recurrence(Recurrence::Calendar(CalendarPattern::new().minutes(&[0]).hours(&[9])));
+    /// ```
+    pub fn recurrence(&mut self, recurrence: Recurrence) -> &mut Self {
+        self.recurrence = Some(recurrence);
+        self
+    }
+
+    /// Copy the options for the Objective C side
+    ///
+    /// Image bytes are copied once into a shared buffer, which the notification center may
+    /// keep using after the notification was sent.
+    /// The sound is taken as is, the caller checks whether it exists.
+    #[doc(hidden)]
+    pub fn to_options(&self) -> OwnedOptions {
+        let (main_button_label, actions, is_response): (Option<&str>, &[&str], bool) =
             match &self.main_button {
                 Some(main_button) => match main_button {
-                    MainButton::SingleAction(main_button_label) => (main_button_label, &[], false),
+                    MainButton::SingleAction(main_button_label) => {
+                        (Some(main_button_label), &[], false)
+                    }
                     MainButton::DropdownActions(main_button_label, actions) => {
-                        (main_button_label, actions, false)
+                        (Some(main_button_label), actions, false)
                     }
-                    MainButton::Response(response) => (response, &[], true),
+                    MainButton::Response(response) => (Some(response), &[], true),
                 },
-                None => ("", &[], false),
+                None => (None, &[], false),
             };
 
-        let vals = vec![
-            NSString::from_str(main_button_label),
-            // TODO: Find a way to support NSArray as a NSDictionary Value rather than JUST NSString so I don't have to convert array to string and back
-            NSString::from_str(&actions.join(",")),
-            NSString::from_str(self.close_button.unwrap_or("")),
-            NSString::from_str(self.app_icon.unwrap_or("")),
-            NSString::from_str(self.content_image.unwrap_or("")),
-            // TODO: Same as above, if NSDictionary could support multiple types, this could be a boolean
-            NSString::from_str(if is_response { "yes" } else { "" }),
-            NSString::from_str(&match self.delivery_date {
-                Some(delivery_date) => delivery_date.to_string(),
-                _ => String::new(),
-            }),
-            // TODO: Same as above, if NSDictionary could support multiple types, this could be a boolean
-            NSString::from_str(match self.asynchronous {
-                Some(true) => "yes",
-                _ => "no",
-            }),
-            NSString::from_str(match self.sound {
-                Some(sound) if check_sound(sound) => sound,
-                _ => "_mute",
-            }),
-        ];
-        NSDictionary::from_keys_and_objects(keys, vals)
+        OwnedOptions {
+            main_button_label: main_button_label.map(String::from),
+            actions: actions.iter().map(|action| action.to_string()).collect(),
+            close_button_label: self.close_button.map(String::from),
+            app_icon: self.app_icon.map(String::from),
+            content_image: self.content_image.map(String::from),
+            app_icon_bytes: self.app_icon_bytes.map(Arc::from),
+            content_image_bytes: self.content_image_bytes.map(Arc::from),
+            sound: self.sound.map(String::from),
+            delivery_date: self.delivery_date,
+            is_response,
+            asynchronous: self.asynchronous.unwrap_or(false),
+            response_timeout: self.timeout,
+            remove_on_timeout: self.remove_on_timeout,
+            cancel_handle: self.cancel_handle.cloned(),
+            recurrence: self.recurrence.clone(),
+        }
     }
 }
 
@@ -212,61 +347,114 @@ pub enum NotificationResponse {
     None,
     /// User clicked on an action button with the given name
     ActionButton(String),
+    /// User picked an action of a [`MainButton::DropdownActions`] with more than one action,
+    /// given by its index in the actions slice and its name
+    DropdownAction(usize, String),
     /// User clicked on the close button with the given name
     CloseButton(String),
     /// User clicked the notification directly
     Click,
     /// User submitted text to the input text field
     Reply(String),
+    /// Nobody responded within the [`Notification::timeout`]
+    TimedOut,
+    /// The [`Notification::cancel_handle`] was cancelled before anybody responded
+    Cancelled,
+    /// The notification waits for its [`Notification::delivery_date`] or [`Notification::recurrence`]
+    Scheduled(ScheduleHandle),
 }
 
-impl NotificationResponse {
-    /// Create a NotificationResponse from the given Objective C NSDictionary
-    pub(crate) fn from_dictionary(dictionary: Id<NSDictionary<NSString, NSString>>) -> Self {
-        let dictionary = dictionary.deref();
+/// A notification that waits for its [`Notification::delivery_date`], or a series of them
+/// that repeats by its [`Notification::recurrence`]
+///
+/// Dropping the handle leaves the notification scheduled.
+pub struct ScheduleHandle {
+    pub(crate) key: Key,
+    pub(crate) waiter: Arc<Waiter<NotificationResponse>>,
+    pub(crate) outbox_id: Option<u64>,
+    /// Whether it is a series
+    pub(crate) repeats: bool,
+    /// Completed once the first instance went out or the notification was cancelled
+    pub(crate) delivered: Arc<Waiter<FirstDelivery>>,
+    pub(crate) timeout: Option<Duration>,
+    pub(crate) remove_on_timeout: bool,
+    pub(crate) cancel: Option<CancelHandle>,
+}
 
-        let activation_type = dictionary
-            .object_for(NSString::from_str("activationType").deref())
-            .map(|str| str.deref().as_str().to_owned());
+/// The first instance of a scheduled notification going out, see `ScheduleHandle::wait`
+pub(crate) struct FirstDelivery {
+    pub(crate) at: Instant,
+    /// Takes the notification off the screen again, `None` if it was not shown
+    pub(crate) remove: Option<Box<dyn FnOnce() + Send>>,
+}
 
-        match activation_type.as_deref() {
-            Some("actionClicked") => NotificationResponse::ActionButton(
-                match dictionary.object_for(NSString::from_str("activationValue").deref()) {
-                    Some(str) => str.deref().as_str().to_owned(),
-                    None => String::from(""),
-                },
-            ),
-            Some("closeClicked") => NotificationResponse::CloseButton(
-                match dictionary.object_for(NSString::from_str("activationValue").deref()) {
-                    Some(str) => str.deref().as_str().to_owned(),
-                    None => String::from(""),
-                },
-            ),
-            Some("replied") => NotificationResponse::Reply(
-                match dictionary.object_for(NSString::from_str("activationValue").deref()) {
-                    Some(str) => str.deref().as_str().to_owned(),
-                    None => String::from(""),
-                },
-            ),
-            Some("contentsClicked") => NotificationResponse::Click,
+impl fmt::Debug for ScheduleHandle {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("ScheduleHandle")
+            .field("key", &self.key)
+            .finish()
+    }
+}
+
+impl NotificationResponse {
+    /// Create a NotificationResponse from the response of the Objective C side
+    ///
+    /// Unsafe because the value of the response has to be valid.
+    pub(crate) unsafe fn from_raw(response: &RawResponse) -> Self {
+        let value = || response.value.as_str().unwrap_or("").to_owned();
+        match response.activation {
+            ACTIVATION_ACTION_CLICKED if response.action_index >= 0 => {
+                NotificationResponse::DropdownAction(response.action_index as usize, value())
+            }
+            ACTIVATION_ACTION_CLICKED => NotificationResponse::ActionButton(value()),
+            ACTIVATION_CLOSE_CLICKED => NotificationResponse::CloseButton(value()),
+            ACTIVATION_REPLIED => NotificationResponse::Reply(value()),
+            ACTIVATION_CONTENTS_CLICKED => NotificationResponse::Click,
             _ => NotificationResponse::None,
         }
     }
 }
 
-pub(crate) fn check_sound(sound_name: &str) -> bool {
-    dirs_next::home_dir()
-        .map(|path| path.join("/Library/Sounds/"))
-        .into_iter()
-        .chain(
-            [
-                "/Library/Sounds/",
-                "/Network/Library/Sounds/",
-                "/System/Library/Sounds/",
-            ]
-            .iter()
-            .map(PathBuf::from),
-        )
-        .map(|sound_path| sound_path.join(format!("{}.aiff", sound_name)))
-        .any(|some_path| some_path.exists())
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn respond(activation: isize, action_index: isize, value: Option<&String>) -> String {
+        let response = RawResponse {
+            activation,
+            action_index,
+            value: RawStr::from_option(value),
+        };
+        format!("{:?}", unsafe { NotificationResponse::from_raw(&response) })
+    }
+
+    #[test]
+    fn buttons_carry_their_name() {
+        let name = "Snooze".to_string();
+        assert_eq!(
+            respond(ACTIVATION_ACTION_CLICKED, -1, Some(&name)),
+            "ActionButton(\"Snooze\")"
+        );
+        assert_eq!(
+            respond(ACTIVATION_CLOSE_CLICKED, -1, Some(&name)),
+            "CloseButton(\"Snooze\")"
+        );
+        assert_eq!(respond(ACTIVATION_REPLIED, -1, None), "Reply(\"\")");
+    }
+
+    #[test]
+    fn dropdown_action_carries_its_index() {
+        let name = "Reject".to_string();
+        assert_eq!(
+            respond(ACTIVATION_ACTION_CLICKED, 1, Some(&name)),
+            "DropdownAction(1, \"Reject\")"
+        );
+    }
+
+    #[test]
+    fn unknown_activation_is_none() {
+        assert_eq!(respond(ACTIVATION_CONTENTS_CLICKED, -1, None), "Click");
+        assert_eq!(respond(0, -1, None), "None");
+        assert_eq!(respond(42, -1, None), "None");
+    }
 }
@@ -0,0 +1,454 @@
+//! Notification options and responses in the layout the Objective C side uses.
+//!
+//! Options are copied into an `OwnedOptions` on the sending thread, and borrowed as a
+//! `#[repr(C)]` `RawOptions` for the duration of the FFI call. Strings cross the boundary
+//! as UTF-8 slices, flags and the delivery date as native values, so nothing has to be
+//! encoded into strings and parsed again. Responses come back the same way as a `RawResponse`.
+//! Image bytes are shared with the Objective C side instead, which keeps them alive for as long
+//! as the image needs them.
+
+use crate::cancel::CancelHandle;
+use crate::outbox::{Decoder, Encoder};
+use crate::recurrence::Recurrence;
+use std::marker::PhantomData;
+use std::os::raw::c_void;
+use std::sync::Arc;
+use std::time::Duration;
+use std::{mem, ptr, slice, str};
+
+/// A UTF-8 string borrowed across the FFI boundary, `data` is null for none
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct RawStr<'a> {
+    data: *const u8,
+    len: usize,
+    borrow: PhantomData<&'a str>,
+}
+
+impl<'a> RawStr<'a> {
+    /// Borrow the given string
+    pub(crate) fn new(string: &'a str) -> Self {
+        RawStr {
+            data: string.as_ptr(),
+            len: string.len(),
+            borrow: PhantomData,
+        }
+    }
+
+    /// Borrow the string if there is one
+    pub(crate) fn from_option(string: Option<&'a String>) -> Self {
+        match string {
+            Some(string) => RawStr::new(string),
+            None => RawStr {
+                data: ptr::null(),
+                len: 0,
+                borrow: PhantomData,
+            },
+        }
+    }
+
+    /// The borrowed string, `None` if there is none or it is not valid UTF-8.
+    ///
+    /// Unsafe because strings from the Objective C side are only valid as long as it says so.
+    pub(crate) unsafe fn as_str(&self) -> Option<&'a str> {
+        if self.data.is_null() {
+            return None;
+        }
+        str::from_utf8(slice::from_raw_parts(self.data, self.len)).ok()
+    }
+}
+
+/// A byte buffer shared with the Objective C side, `data` is null for none.
+///
+/// The Objective C side may only hold on to the buffer after `retain_bytes`.
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub(crate) struct RawBytes<'a> {
+    data: *const u8,
+    len: usize,
+    borrow: PhantomData<&'a [u8]>,
+}
+
+impl<'a> RawBytes<'a> {
+    /// Share the buffer if there is one
+    pub(crate) fn from_option(bytes: Option<&'a Arc<[u8]>>) -> Self {
+        match bytes {
+            Some(bytes) => RawBytes {
+                data: bytes.as_ptr(),
+                len: bytes.len(),
+                borrow: PhantomData,
+            },
+            None => RawBytes {
+                data: ptr::null(),
+                len: 0,
+                borrow: PhantomData,
+            },
+        }
+    }
+}
+
+/// Take another reference to the shared buffer passed as a `RawBytes`
+///
+/// Unsafe because `data` and `len` have to come from a `RawBytes` that is still alive.
+pub(crate) unsafe fn retain_bytes(data: *const u8, len: usize) {
+    let bytes: Arc<[u8]> = Arc::from_raw(slice::from_raw_parts(data, len));
+    mem::forget(Arc::clone(&bytes));
+    mem::forget(bytes);
+}
+
+/// Drop a reference taken with `retain_bytes`
+///
+/// Unsafe because every `retain_bytes` may only be released once.
+pub(crate) unsafe fn release_bytes(data: *const u8, len: usize) {
+    let bytes: Arc<[u8]> = Arc::from_raw(slice::from_raw_parts(data, len));
+    drop(bytes);
+}
+
+/// Options of a single notification, as passed to `sendNotifications`
+#[repr(C)]
+pub struct RawOptions<'a> {
+    pub(crate) main_button_label: RawStr<'a>,
+    pub(crate) actions: *const RawStr<'a>,
+    /// Number of `actions`
+    pub action_count: usize,
+    pub(crate) close_button_label: RawStr<'a>,
+    pub(crate) app_icon: RawStr<'a>,
+    pub(crate) content_image: RawStr<'a>,
+    /// Encoded images, take precedence over `app_icon` and `content_image`
+    pub(crate) app_icon_bytes: RawBytes<'a>,
+    pub(crate) content_image_bytes: RawBytes<'a>,
+    /// Already decoded `NSImage`s from the image cache, null to load `app_icon` and `content_image`
+    pub(crate) decoded_app_icon: *const c_void,
+    pub(crate) decoded_content_image: *const c_void,
+    /// Images that are not decoded yet are scaled down to this size, `0` for full resolution
+    pub(crate) max_image_pixel_size: usize,
+    pub(crate) sound: RawStr<'a>,
+    /// Seconds since the unix epoch, only read if `is_scheduled` is set
+    pub(crate) delivery_date: f64,
+    pub(crate) is_scheduled: bool,
+    pub(crate) is_response: bool,
+    pub(crate) asynchronous: bool,
+}
+
+/// Values of `RawResponse::activation`, `NotificationActivationType` on the Objective C side.
+/// Anything else means there was no interaction.
+pub(crate) const ACTIVATION_ACTION_CLICKED: isize = 1;
+pub(crate) const ACTIVATION_CLOSE_CLICKED: isize = 2;
+pub(crate) const ACTIVATION_CONTENTS_CLICKED: isize = 3;
+pub(crate) const ACTIVATION_REPLIED: isize = 4;
+
+/// The response to a notification, as passed to `notificationDidComplete`
+#[repr(C)]
+pub(crate) struct RawResponse<'a> {
+    pub(crate) activation: isize,
+    /// Index of the dropdown action that was picked, negative otherwise
+    pub(crate) action_index: isize,
+    /// Name of the button or the reply, depending on the activation
+    pub(crate) value: RawStr<'a>,
+}
+
+/// Notification options that own their strings, so they can be handed to another thread
+#[derive(Clone, Debug, Default, PartialEq)]
+pub struct OwnedOptions {
+    pub(crate) main_button_label: Option<String>,
+    pub(crate) actions: Vec<String>,
+    pub(crate) close_button_label: Option<String>,
+    pub(crate) app_icon: Option<String>,
+    pub(crate) content_image: Option<String>,
+    pub(crate) app_icon_bytes: Option<Arc<[u8]>>,
+    pub(crate) content_image_bytes: Option<Arc<[u8]>>,
+    /// `None` plays no sound
+    pub(crate) sound: Option<String>,
+    pub(crate) delivery_date: Option<f64>,
+    pub(crate) is_response: bool,
+    pub(crate) asynchronous: bool,
+    /// How long a sender waits for the user to respond, `None` waits until they do
+    pub(crate) response_timeout: Option<Duration>,
+    /// Whether a notification that timed out is removed from the screen
+    pub(crate) remove_on_timeout: bool,
+    pub(crate) cancel_handle: Option<CancelHandle>,
+    pub(crate) recurrence: Option<Recurrence>,
+}
+
+impl OwnedOptions {
+    /// The actions of the dropdown, in the layout `as_raw` expects
+    pub fn raw_actions(&self) -> Vec<RawStr<'_>> {
+        self.actions
+            .iter()
+            .map(|action| RawStr::new(action))
+            .collect()
+    }
+
+    /// Borrow the options for the Objective C side, `actions` are the `raw_actions` of these options
+    pub fn as_raw<'a>(&'a self, actions: &'a [RawStr<'a>]) -> RawOptions<'a> {
+        RawOptions {
+            main_button_label: RawStr::from_option(self.main_button_label.as_ref()),
+            actions: actions.as_ptr(),
+            action_count: actions.len(),
+            close_button_label: RawStr::from_option(self.close_button_label.as_ref()),
+            app_icon: RawStr::from_option(self.app_icon.as_ref()),
+            content_image: RawStr::from_option(self.content_image.as_ref()),
+            app_icon_bytes: RawBytes::from_option(self.app_icon_bytes.as_ref()),
+            content_image_bytes: RawBytes::from_option(self.content_image_bytes.as_ref()),
+            decoded_app_icon: ptr::null(),
+            decoded_content_image: ptr::null(),
+            max_image_pixel_size: 0,
+            sound: RawStr::from_option(self.sound.as_ref()),
+            delivery_date: self.delivery_date.unwrap_or(0.),
+            is_scheduled: self.delivery_date.is_some(),
+            is_response: self.is_response,
+            asynchronous: self.asynchronous,
+        }
+    }
+
+    /// Lay out the options for the outbox, without the cancel handle
+    pub(crate) fn encode(&self, encoder: &mut Encoder) {
+        let string = |encoder: &mut Encoder, string: &String| encoder.str(string);
+        let bytes = |encoder: &mut Encoder, bytes: &Arc<[u8]>| encoder.bytes(bytes);
+        encoder.option(self.main_button_label.as_ref(), string);
+        encoder.u64(self.actions.len() as u64);
+        for action in &self.actions {
+            encoder.str(action);
+        }
+        encoder.option(self.close_button_label.as_ref(), string);
+        encoder.option(self.app_icon.as_ref(), string);
+        encoder.option(self.content_image.as_ref(), string);
+        encoder.option(self.app_icon_bytes.as_ref(), bytes);
+        encoder.option(self.content_image_bytes.as_ref(), bytes);
+        encoder.option(self.sound.as_ref(), string);
+        encoder.option(self.delivery_date, |encoder, date| {
+            encoder.u64(date.to_bits())
+        });
+        encoder.u8(self.is_response as u8);
+        encoder.u8(self.asynchronous as u8);
+        encoder.option(self.response_timeout, |encoder, timeout| {
+            encoder.u64(timeout.as_nanos() as u64)
+        });
+        encoder.u8(self.remove_on_timeout as u8);
+        encoder.option(self.recurrence.as_ref(), |encoder, recurrence| {
+            recurrence.encode(encoder)
+        });
+    }
+
+    /// Read back options laid out by `encode`, `None` if they are broken
+    pub(crate) fn decode(decoder: &mut Decoder) -> Option<Self> {
+        let bytes = |decoder: &mut Decoder| decoder.bytes().map(Arc::from);
+        let main_button_label = decoder.option(Decoder::string)?;
+        let actions = (0..decoder.u64()?)
+            .map(|_| decoder.string())
+            .collect::<Option<_>>()?;
+        Some(OwnedOptions {
+            main_button_label,
+            actions,
+            close_button_label: decoder.option(Decoder::string)?,
+            app_icon: decoder.option(Decoder::string)?,
+            content_image: decoder.option(Decoder::string)?,
+            app_icon_bytes: decoder.option(bytes)?,
+            content_image_bytes: decoder.option(bytes)?,
+            sound: decoder.option(Decoder::string)?,
+            delivery_date: decoder.option(|decoder| decoder.u64().map(f64::from_bits))?,
+            is_response: decoder.u8()? != 0,
+            asynchronous: decoder.u8()? != 0,
+            response_timeout: decoder.option(|decoder| decoder.u64().map(Duration::from_nanos))?,
+            remove_on_timeout: decoder.u8()? != 0,
+            cancel_handle: None,
+            recurrence: decoder.option(Recurrence::decode)?,
+        })
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::notification::{MainButton, Notification, NotificationResponse};
+    use std::alloc::{GlobalAlloc, Layout, System};
+    use std::cell::Cell;
+
+    /// Counts the allocations of every thread separately, so tests can run in parallel
+    struct CountingAllocator;
+
+    thread_local!(static ALLOCATIONS: Cell<usize> = Cell::new(0));
+
+    unsafe impl GlobalAlloc for CountingAllocator {
+        unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+            let _ = ALLOCATIONS.try_with(|count| count.set(count.get() + 1));
+            System.alloc(layout)
+        }
+
+        unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+            System.dealloc(ptr, layout)
+        }
+    }
+
+    #[global_allocator]
+    static ALLOCATOR: CountingAllocator = CountingAllocator;
+
+    fn count_allocations<F: FnOnce()>(f: F) -> usize {
+        let before = ALLOCATIONS.with(Cell::get);
+        f();
+        ALLOCATIONS.with(Cell::get) - before
+    }
+
+    fn read(string: RawStr<'_>) -> Option<&str> {
+        unsafe { string.as_str() }
+    }
+
+    #[test]
+    fn default_options_are_empty() {
+        let options = Notification::new().to_options();
+        let actions = options.raw_actions();
+        let raw = options.as_raw(&actions);
+        assert!(read(raw.main_button_label).is_none());
+        assert!(read(raw.sound).is_none());
+        assert_eq!(raw.action_count, 0);
+        assert!(!raw.is_scheduled);
+        assert!(!raw.is_response);
+        assert!(!raw.asynchronous);
+    }
+
+    #[test]
+    fn actions_are_passed_as_array() {
+        let mut notification = Notification::new();
+        notification
+            .main_button(MainButton::DropdownActions(
+                "Pick",
+                &["Yes, please", "No, thanks"],
+            ))
+            .close_button("Later")
+            .delivery_date(1.5e9)
+            .asynchronous(true);
+        let options = notification.to_options();
+        let actions = options.raw_actions();
+        let raw = options.as_raw(&actions);
+
+        assert_eq!(read(raw.main_button_label), Some("Pick"));
+        let actions = unsafe { slice::from_raw_parts(raw.actions, raw.action_count) };
+        let actions: Vec<_> = actions.iter().map(|action| read(*action)).collect();
+        assert_eq!(actions, vec![Some("Yes, please"), Some("No, thanks")]);
+        assert_eq!(read(raw.close_button_label), Some("Later"));
+        assert!(raw.is_scheduled);
+        assert_eq!(raw.delivery_date, 1.5e9);
+        assert!(raw.asynchronous);
+    }
+
+    #[test]
+    fn response_button_sets_flag() {
+        let mut notification = Notification::new();
+        notification.main_button(MainButton::Response("Type here"));
+        let options = notification.to_options();
+        let raw = options.as_raw(&[]);
+        assert_eq!(read(raw.main_button_label), Some("Type here"));
+        assert!(raw.is_response);
+    }
+
+    #[test]
+    fn image_bytes_are_shared() {
+        let chart = [0x89, b'P', b'N', b'G'];
+        let mut notification = Notification::new();
+        notification.content_image_bytes(&chart);
+        let options = notification.to_options();
+        let bytes = options.content_image_bytes.as_ref().unwrap();
+        let raw = options.as_raw(&[]);
+        assert!(raw.app_icon_bytes.data.is_null());
+        assert_eq!(raw.content_image_bytes.data, bytes.as_ptr());
+        assert_eq!(raw.content_image_bytes.len, chart.len());
+
+        // an NSData holds on to the buffer, even after the options are gone
+        let (data, len) = (raw.content_image_bytes.data, raw.content_image_bytes.len);
+        unsafe { retain_bytes(data, len) };
+        let bytes = Arc::clone(bytes);
+        drop(options);
+        assert_eq!(Arc::strong_count(&bytes), 2);
+        unsafe { release_bytes(data, len) };
+        assert_eq!(Arc::strong_count(&bytes), 1);
+        assert_eq!(&bytes[..], &chart[..]);
+    }
+
+    #[test]
+    fn options_read_back_from_the_outbox() {
+        let mut notification = Notification::new();
+        let cancel = CancelHandle::new();
+        notification
+            .main_button(MainButton::DropdownActions("Pick", &["Yes", "No"]))
+            .app_icon("/tmp/icon.png")
+            .content_image_bytes(&[0x89, b'P', b'N', b'G'])
+            .sound("Blow")
+            .delivery_date(1.5e9)
+            .timeout(Duration::from_millis(1_500))
+            .remove_on_timeout(true)
+            .cancel_handle(&cancel)
+            .recurrence(Recurrence::Every(Duration::from_secs(60)));
+        let options = notification.to_options();
+        let mut encoder = Encoder::default();
+        options.encode(&mut encoder);
+        let bytes = encoder.finish();
+
+        let decoded = OwnedOptions::decode(&mut Decoder::new(&bytes)).unwrap();
+        // cancel handles only live as long as the process
+        assert_eq!(decoded.cancel_handle, None);
+        assert_eq!(
+            decoded,
+            OwnedOptions {
+                cancel_handle: None,
+                ..options
+            }
+        );
+        let defaults = Notification::new().to_options();
+        let mut encoder = Encoder::default();
+        defaults.encode(&mut encoder);
+        let bytes = encoder.finish();
+        assert_eq!(
+            OwnedOptions::decode(&mut Decoder::new(&bytes)),
+            Some(defaults)
+        );
+        assert_eq!(OwnedOptions::decode(&mut Decoder::new(&bytes[..5])), None);
+    }
+
+    #[test]
+    fn crossing_the_boundary_allocates_only_for_dropdowns() {
+        let mut notification = Notification::new();
+        notification
+            .main_button(MainButton::SingleAction("Open"))
+            .close_button("Later")
+            .sound("Blow")
+            .delivery_date(1.5e9);
+        let options = notification.to_options();
+        let click = RawResponse {
+            activation: ACTIVATION_CONTENTS_CLICKED,
+            action_index: -1,
+            value: RawStr::from_option(None),
+        };
+
+        let allocations = count_allocations(|| {
+            let actions = options.raw_actions();
+            let raw = options.as_raw(&actions);
+            assert_eq!(read(raw.main_button_label), Some("Open"));
+            let response = unsafe { NotificationResponse::from_raw(&click) };
+            assert!(matches!(response, NotificationResponse::Click));
+        });
+        assert_eq!(allocations, 0);
+
+        let mut notification = Notification::new();
+        notification.main_button(MainButton::DropdownActions("Pick", &["Yes", "No"]));
+        let options = notification.to_options();
+        let picked = "No".to_string();
+        let pick = RawResponse {
+            activation: ACTIVATION_ACTION_CLICKED,
+            action_index: 1,
+            value: RawStr::from_option(Some(&picked)),
+        };
+
+        // the array of the actions on the way in, the name of the picked one on the way out
+        let allocations = count_allocations(|| {
+            let actions = options.raw_actions();
+            let raw = options.as_raw(&actions);
+            assert_eq!(raw.action_count, 2);
+            let response = unsafe { NotificationResponse::from_raw(&pick) };
+            assert!(matches!(
+                response,
+                NotificationResponse::DropdownAction(1, _)
+            ));
+        });
+        assert_eq!(allocations, 2);
+    }
+}
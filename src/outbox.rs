@@ -0,0 +1,517 @@
+//! Outbox of scheduled notifications, so they survive a restart of the process.
+//!
+//! Every schedule, delivery and cancellation is appended to a file as a record with a
+//! checksum. On startup the file is read in one go and its records are replayed to rebuild
+//! the pending notifications, a torn or broken record ends the replay and is cut off.
+//! Once most of the file is records of notifications that are no longer pending, it is
+//! compacted: the pending notifications are written to a new file, which replaces the old one.
+
+use crate::remote::fnv1a;
+use std::collections::HashMap;
+use std::fs::{self, File, OpenOptions};
+use std::io::{self, Write};
+use std::path::{Path, PathBuf};
+use std::process;
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+const MAGIC: &[u8; 8] = b"MNSOUTB1";
+/// The length and checksum in front of every record
+const RECORD_HEADER_LEN: usize = 12;
+/// The kind, id and due time at the start of every record
+const RECORD_FIXED_LEN: usize = 17;
+/// Files smaller than this are never compacted
+const COMPACT_MIN: u64 = 64 * 1024;
+
+/// A notification was scheduled, with its payload
+const SCHEDULE: u8 = 1;
+/// A series was delivered and is due again
+const RESCHEDULE: u8 = 2;
+/// A notification was delivered for good
+const DONE: u8 = 3;
+const CANCEL: u8 = 4;
+
+/// Lays out the payload of a record: numbers are little endian, byte strings follow their length
+#[derive(Default)]
+pub(crate) struct Encoder {
+    bytes: Vec<u8>,
+}
+
+impl Encoder {
+    pub(crate) fn u8(&mut self, value: u8) {
+        self.bytes.push(value);
+    }
+
+    pub(crate) fn u64(&mut self, value: u64) {
+        self.bytes.extend_from_slice(&value.to_le_bytes());
+    }
+
+    pub(crate) fn bytes(&mut self, bytes: &[u8]) {
+        self.u64(bytes.len() as u64);
+        self.bytes.extend_from_slice(bytes);
+    }
+
+    pub(crate) fn str(&mut self, value: &str) {
+        self.bytes(value.as_bytes());
+    }
+
+    /// A flag whether there is a value, and the value
+    pub(crate) fn option<T, F: FnOnce(&mut Self, T)>(&mut self, value: Option<T>, encode: F) {
+        match value {
+            Some(value) => {
+                self.u8(1);
+                encode(self, value);
+            }
+            None => self.u8(0),
+        }
+    }
+
+    pub(crate) fn finish(self) -> Vec<u8> {
+        self.bytes
+    }
+}
+
+/// Reads what an `Encoder` laid out, every read is `None` once the payload is broken
+pub(crate) struct Decoder<'a> {
+    bytes: &'a [u8],
+}
+
+impl<'a> Decoder<'a> {
+    pub(crate) fn new(bytes: &'a [u8]) -> Self {
+        Decoder { bytes }
+    }
+
+    pub(crate) fn u8(&mut self) -> Option<u8> {
+        let (&value, rest) = self.bytes.split_first()?;
+        self.bytes = rest;
+        Some(value)
+    }
+
+    pub(crate) fn u64(&mut self) -> Option<u64> {
+        let value = le_u64(self.bytes.get(..8)?);
+        self.bytes = &self.bytes[8..];
+        Some(value)
+    }
+
+    pub(crate) fn bytes(&mut self) -> Option<&'a [u8]> {
+        let len = self.u64()?;
+        if len > self.bytes.len() as u64 {
+            return None;
+        }
+        let (bytes, rest) = self.bytes.split_at(len as usize);
+        self.bytes = rest;
+        Some(bytes)
+    }
+
+    pub(crate) fn string(&mut self) -> Option<String> {
+        String::from_utf8(self.bytes()?.to_vec()).ok()
+    }
+
+    pub(crate) fn option<T, F: FnOnce(&mut Self) -> Option<T>>(
+        &mut self,
+        decode: F,
+    ) -> Option<Option<T>> {
+        match self.u8()? {
+            0 => Some(None),
+            1 => decode(self).map(Some),
+            _ => None,
+        }
+    }
+}
+
+/// A notification that is still pending, as it was recorded
+struct Pending {
+    due: u64,
+    payload: Vec<u8>,
+}
+
+/// The outbox file and the notifications it holds as pending
+pub struct Outbox {
+    path: PathBuf,
+    file: File,
+    sync: bool,
+    pending: HashMap<u64, Pending>,
+    next_id: u64,
+    /// Length of the file
+    len: u64,
+    /// Length of the file once it is compacted
+    live_len: u64,
+}
+
+impl Outbox {
+    /// Open the outbox at `path`, or start one if there is none, and replay its records
+    ///
+    /// `sync` flushes every record to the disk before it counts as written. A file that is
+    /// neither empty nor an outbox is left as it is and fails with `InvalidData`.
+    pub fn open(path: PathBuf, sync: bool) -> io::Result<Self> {
+        let bytes = match fs::read(&path) {
+            Ok(bytes) => bytes,
+            Err(error) if error.kind() == io::ErrorKind::NotFound => Vec::new(),
+            Err(error) => return Err(error),
+        };
+        if !bytes.is_empty() && !bytes.starts_with(MAGIC) {
+            return Err(io::Error::new(io::ErrorKind::InvalidData, "not an outbox"));
+        }
+        let (pending, next_id, valid) = replay(&bytes);
+        let live_len = MAGIC.len() as u64 + pending.values().map(record_len).sum::<u64>();
+        let (file, len) = if valid == 0 || must_compact(valid as u64, live_len) {
+            rewrite(&path, &pending, sync)?
+        } else {
+            let file = OpenOptions::new().append(true).open(&path)?;
+            if valid < bytes.len() {
+                // appends go after the records that were read back
+                file.set_len(valid as u64)?;
+            }
+            (file, valid as u64)
+        };
+        Ok(Outbox {
+            path,
+            file,
+            sync,
+            pending,
+            next_id,
+            len,
+            live_len,
+        })
+    }
+
+    /// The ids of the pending notifications with the time they are due and their payload,
+    /// in the order they are due
+    pub(crate) fn pending(&self) -> Vec<(u64, u64, &[u8])> {
+        let mut pending: Vec<_> = self
+            .pending
+            .iter()
+            .map(|(&id, pending)| (id, pending.due, pending.payload.as_slice()))
+            .collect();
+        pending.sort_by_key(|&(id, due, _)| (due, id));
+        pending
+    }
+
+    /// Record a notification that is due at `due`, returns the id it is recorded under
+    pub fn schedule(&mut self, due: u64, payload: Vec<u8>) -> io::Result<u64> {
+        let id = self.next_id;
+        self.append(SCHEDULE, id, due, &payload)?;
+        self.next_id += 1;
+        let pending = Pending { due, payload };
+        self.live_len += record_len(&pending);
+        self.pending.insert(id, pending);
+        self.compact_if_needed();
+        Ok(id)
+    }
+
+    /// Record that a notification was delivered, and is due again at `next` if it is a series
+    ///
+    /// Does nothing for notifications that are no longer pending.
+    pub fn delivered(&mut self, id: u64, next: Option<u64>) -> io::Result<()> {
+        match (self.pending.contains_key(&id), next) {
+            (true, Some(next)) => {
+                self.append(RESCHEDULE, id, next, &[])?;
+                if let Some(pending) = self.pending.get_mut(&id) {
+                    pending.due = next;
+                }
+                self.compact_if_needed();
+                Ok(())
+            }
+            (true, None) => self.remove(DONE, id),
+            (false, _) => Ok(()),
+        }
+    }
+
+    /// Record that a notification was cancelled
+    ///
+    /// Does nothing for notifications that are no longer pending.
+    pub(crate) fn cancel(&mut self, id: u64) -> io::Result<()> {
+        if !self.pending.contains_key(&id) {
+            return Ok(());
+        }
+        self.remove(CANCEL, id)
+    }
+
+    fn remove(&mut self, kind: u8, id: u64) -> io::Result<()> {
+        self.append(kind, id, 0, &[])?;
+        if let Some(pending) = self.pending.remove(&id) {
+            self.live_len -= record_len(&pending);
+        }
+        self.compact_if_needed();
+        Ok(())
+    }
+
+    /// Append a record in one write, a record that was only written in part is cut off again
+    fn append(&mut self, kind: u8, id: u64, due: u64, payload: &[u8]) -> io::Result<()> {
+        let record = record(kind, id, due, payload);
+        let written = self.file.write_all(&record).and_then(|_| match self.sync {
+            true => self.file.sync_data(),
+            false => Ok(()),
+        });
+        if let Err(error) = written {
+            let _ = self.file.set_len(self.len);
+            return Err(error);
+        }
+        self.len += record.len() as u64;
+        Ok(())
+    }
+
+    /// Write the pending notifications to a new file once most records are of ones that are not
+    ///
+    /// A file that cannot be compacted is appended to until it can be.
+    fn compact_if_needed(&mut self) {
+        if !must_compact(self.len, self.live_len) {
+            return;
+        }
+        if let Ok((file, len)) = rewrite(&self.path, &self.pending, self.sync) {
+            self.file = file;
+            self.len = len;
+        }
+    }
+}
+
+fn must_compact(len: u64, live_len: u64) -> bool {
+    len >= COMPACT_MIN && len > 2 * live_len
+}
+
+/// The pending notifications of the records in `bytes`, the next free id and how many of the
+/// bytes are intact records
+fn replay(bytes: &[u8]) -> (HashMap<u64, Pending>, u64, usize) {
+    let mut pending = HashMap::new();
+    let mut next_id = 0;
+    if !bytes.starts_with(MAGIC) {
+        return (pending, next_id, 0);
+    }
+    let mut at = MAGIC.len();
+    while let Some((kind, id, due, payload, end)) = record_at(bytes, at) {
+        match kind {
+            SCHEDULE => {
+                let payload = payload.to_vec();
+                pending.insert(id, Pending { due, payload });
+            }
+            RESCHEDULE => {
+                if let Some(pending) = pending.get_mut(&id) {
+                    pending.due = due;
+                }
+            }
+            _ => {
+                pending.remove(&id);
+            }
+        }
+        next_id = next_id.max(id + 1);
+        at = end;
+    }
+    (pending, next_id, at)
+}
+
+/// Lay out a record: its length and checksum, then its kind, id, due time and payload
+fn record(kind: u8, id: u64, due: u64, payload: &[u8]) -> Vec<u8> {
+    let mut body = Vec::with_capacity(RECORD_FIXED_LEN + payload.len());
+    body.push(kind);
+    body.extend_from_slice(&id.to_le_bytes());
+    body.extend_from_slice(&due.to_le_bytes());
+    body.extend_from_slice(payload);
+    let mut record = Vec::with_capacity(RECORD_HEADER_LEN + body.len());
+    record.extend_from_slice(&(body.len() as u32).to_le_bytes());
+    record.extend_from_slice(&fnv1a(&body).to_le_bytes());
+    record.extend_from_slice(&body);
+    record
+}
+
+/// The kind, id, due time and payload of the record at `at` and where it ends,
+/// `None` if it is cut off or does not match its checksum
+fn record_at(bytes: &[u8], at: usize) -> Option<(u8, u64, u64, &[u8], usize)> {
+    let header = bytes.get(at..at.checked_add(RECORD_HEADER_LEN)?)?;
+    let mut len = [0; 4];
+    len.copy_from_slice(&header[..4]);
+    let start = at + RECORD_HEADER_LEN;
+    let end = start.checked_add(u32::from_le_bytes(len) as usize)?;
+    let body = bytes.get(start..end)?;
+    if body.len() < RECORD_FIXED_LEN || fnv1a(body) != le_u64(&header[4..]) {
+        return None;
+    }
+    let payload = &body[RECORD_FIXED_LEN..];
+    Some((
+        body[0],
+        le_u64(&body[1..9]),
+        le_u64(&body[9..17]),
+        payload,
+        end,
+    ))
+}
+
+fn record_len(pending: &Pending) -> u64 {
+    (RECORD_HEADER_LEN + RECORD_FIXED_LEN + pending.payload.len()) as u64
+}
+
+fn le_u64(bytes: &[u8]) -> u64 {
+    let mut value = [0; 8];
+    value.copy_from_slice(&bytes[..8]);
+    u64::from_le_bytes(value)
+}
+
+/// Replace the file with one that schedules the pending notifications, and open it for appending
+fn rewrite(path: &Path, pending: &HashMap<u64, Pending>, sync: bool) -> io::Result<(File, u64)> {
+    static TEMP_FILES: AtomicUsize = AtomicUsize::new(0);
+    let mut ids: Vec<&u64> = pending.keys().collect();
+    ids.sort();
+    let mut contents = MAGIC.to_vec();
+    for id in ids {
+        let pending = &pending[id];
+        contents.extend_from_slice(&record(SCHEDULE, *id, pending.due, &pending.payload));
+    }
+
+    let dir = path.parent().unwrap_or_else(|| Path::new("."));
+    fs::create_dir_all(dir)?;
+    let temp = dir.join(format!(
+        ".outbox-{}-{}.tmp",
+        process::id(),
+        TEMP_FILES.fetch_add(1, Ordering::Relaxed)
+    ));
+    let written = File::create(&temp).and_then(|mut file| {
+        file.write_all(&contents)?;
+        match sync {
+            true => file.sync_all(),
+            false => Ok(()),
+        }
+    });
+    if let Err(error) = written.and_then(|_| fs::rename(&temp, path)) {
+        let _ = fs::remove_file(&temp);
+        return Err(error);
+    }
+    let file = OpenOptions::new().append(true).open(path)?;
+    Ok((file, contents.len() as u64))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::env;
+
+    fn temp_file(name: &str) -> PathBuf {
+        let dir = env::temp_dir().join(format!("mac-notification-sys-{}-{}", name, process::id()));
+        let _ = fs::remove_dir_all(&dir);
+        dir.join("outbox")
+    }
+
+    fn pending(outbox: &Outbox) -> Vec<(u64, u64, Vec<u8>)> {
+        outbox
+            .pending()
+            .into_iter()
+            .map(|(id, due, payload)| (id, due, payload.to_vec()))
+            .collect()
+    }
+
+    #[test]
+    fn replays_pending_notifications_after_a_restart() {
+        let file = temp_file("outbox-replay");
+        let mut outbox = Outbox::open(file.clone(), true).unwrap();
+        let once = outbox.schedule(3_000, b"once".to_vec()).unwrap();
+        let series = outbox.schedule(1_000, b"series".to_vec()).unwrap();
+        let cancelled = outbox.schedule(2_000, b"cancelled".to_vec()).unwrap();
+        let delivered = outbox.schedule(500, b"delivered".to_vec()).unwrap();
+        outbox.delivered(series, Some(61_000)).unwrap();
+        outbox.cancel(cancelled).unwrap();
+        outbox.delivered(delivered, None).unwrap();
+        // late records of notifications that are gone change nothing
+        outbox.delivered(cancelled, Some(5_000)).unwrap();
+        outbox.cancel(delivered).unwrap();
+        let expected = vec![
+            (once, 3_000, b"once".to_vec()),
+            (series, 61_000, b"series".to_vec()),
+        ];
+        assert_eq!(pending(&outbox), expected);
+        drop(outbox);
+
+        let mut outbox = Outbox::open(file.clone(), true).unwrap();
+        assert_eq!(pending(&outbox), expected);
+        // ids are not handed out twice
+        assert_eq!(outbox.schedule(0, Vec::new()).unwrap(), delivered + 1);
+        fs::remove_dir_all(file.parent().unwrap()).unwrap();
+    }
+
+    #[test]
+    fn torn_and_broken_records_are_cut_off() {
+        let file = temp_file("outbox-torn");
+        let mut outbox = Outbox::open(file.clone(), false).unwrap();
+        let kept = outbox.schedule(1_000, b"kept".to_vec()).unwrap();
+        let intact = fs::metadata(&file).unwrap().len();
+        outbox.schedule(2_000, b"torn".to_vec()).unwrap();
+        drop(outbox);
+
+        // the process stopped halfway through the last record
+        let contents = fs::read(&file).unwrap();
+        fs::write(&file, &contents[..contents.len() - 3]).unwrap();
+        let mut outbox = Outbox::open(file.clone(), false).unwrap();
+        assert_eq!(pending(&outbox), vec![(kept, 1_000, b"kept".to_vec())]);
+        assert_eq!(fs::metadata(&file).unwrap().len(), intact);
+        let appended = outbox.schedule(3_000, b"appended".to_vec()).unwrap();
+        drop(outbox);
+
+        // a flipped bit ends the replay at the record it is in
+        let mut contents = fs::read(&file).unwrap();
+        let last = contents.len() - 1;
+        contents[last] ^= 1;
+        fs::write(&file, &contents).unwrap();
+        let outbox = Outbox::open(file.clone(), false).unwrap();
+        assert_eq!(pending(&outbox), vec![(kept, 1_000, b"kept".to_vec())]);
+        assert!(appended > kept);
+
+        // a file that is not an outbox is not touched, an empty one starts over
+        fs::write(&file, b"not an outbox").unwrap();
+        let error = Outbox::open(file.clone(), false).err().unwrap();
+        assert_eq!(error.kind(), io::ErrorKind::InvalidData);
+        assert_eq!(fs::read(&file).unwrap(), b"not an outbox");
+        fs::write(&file, b"").unwrap();
+        let outbox = Outbox::open(file.clone(), false).unwrap();
+        assert!(outbox.pending().is_empty());
+        assert_eq!(fs::read(&file).unwrap(), MAGIC);
+        fs::remove_dir_all(file.parent().unwrap()).unwrap();
+    }
+
+    #[test]
+    fn compacts_once_most_records_are_done() {
+        let file = temp_file("outbox-compact");
+        let mut outbox = Outbox::open(file.clone(), false).unwrap();
+        let payload = vec![7; 200];
+        let mut expected = Vec::new();
+        for index in 0..5_000 {
+            let id = outbox.schedule(index, payload.clone()).unwrap();
+            if index % 50 == 0 {
+                outbox.delivered(id, Some(index + 1_000)).unwrap();
+                expected.push((id, index + 1_000, payload.clone()));
+            } else {
+                outbox.delivered(id, None).unwrap();
+            }
+        }
+        assert_eq!(pending(&outbox), expected);
+
+        // a million bytes were appended, the file only holds what is pending and what came since
+        let len = fs::metadata(&file).unwrap().len();
+        assert_eq!(len, outbox.len);
+        assert!(len < COMPACT_MIN || len <= 2 * outbox.live_len);
+        drop(outbox);
+        let outbox = Outbox::open(file.clone(), false).unwrap();
+        assert_eq!(pending(&outbox), expected);
+        fs::remove_dir_all(file.parent().unwrap()).unwrap();
+    }
+
+    #[test]
+    fn payloads_read_back_as_encoded() {
+        let mut encoder = Encoder::default();
+        encoder.u8(3);
+        encoder.u64(u64::max_value());
+        encoder.str("Backup");
+        encoder.option(None::<&str>, |encoder, value| encoder.str(value));
+        encoder.option(Some(&[1u8, 2][..]), |encoder, value| encoder.bytes(value));
+        let bytes = encoder.finish();
+
+        let mut decoder = Decoder::new(&bytes);
+        assert_eq!(decoder.u8(), Some(3));
+        assert_eq!(decoder.u64(), Some(u64::max_value()));
+        assert_eq!(decoder.string().as_deref(), Some("Backup"));
+        assert_eq!(decoder.option(Decoder::string), Some(None));
+        assert_eq!(decoder.option(Decoder::bytes), Some(Some(&[1u8, 2][..])));
+        assert_eq!(decoder.u8(), None);
+
+        // a length that runs past the end breaks the payload
+        let mut decoder = Decoder::new(&bytes[..20]);
+        decoder.u8();
+        decoder.u64();
+        assert_eq!(decoder.bytes(), None);
+    }
+}
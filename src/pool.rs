@@ -0,0 +1,74 @@
+//! A fixed set of background threads that run queued jobs.
+
+use std::sync::mpsc::{self, Sender};
+use std::sync::{Arc, Mutex};
+use std::thread;
+
+type Job = Box<dyn FnOnce() + Send>;
+
+/// Background threads that take jobs from a shared queue, in the order they were queued
+pub(crate) struct Pool {
+    jobs: Mutex<Sender<Job>>,
+    // runs jobs on the calling thread if no thread could be started
+    threads: usize,
+}
+
+impl Pool {
+    /// Start up to `threads` threads with the given name
+    pub(crate) fn new(name: &str, threads: usize) -> Self {
+        let (jobs, queue) = mpsc::channel::<Job>();
+        let queue = Arc::new(Mutex::new(queue));
+        let threads = (0..threads)
+            .filter(|_| {
+                let queue = Arc::clone(&queue);
+                thread::Builder::new()
+                    .name(name.into())
+                    .spawn(move || loop {
+                        let job = match queue.lock().unwrap().recv() {
+                            Ok(job) => job,
+                            Err(_) => return,
+                        };
+                        job();
+                    })
+                    .is_ok()
+            })
+            .count();
+        Pool {
+            jobs: Mutex::new(jobs),
+            threads,
+        }
+    }
+
+    /// Queue the job for the next free thread
+    pub(crate) fn execute<F: FnOnce() + Send + 'static>(&self, job: F) {
+        if self.threads == 0 {
+            return job();
+        }
+        let _ = self.jobs.lock().unwrap().send(Box::new(job));
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn runs_jobs_on_its_threads() {
+        let pool = Pool::new("pool-test", 2);
+        let (done, finished) = mpsc::channel();
+        for index in 0..10 {
+            let done = done.clone();
+            pool.execute(move || {
+                let name = thread::current().name().map(String::from);
+                done.send((index, name)).unwrap();
+            });
+        }
+
+        let mut results: Vec<_> = finished.iter().take(10).collect();
+        results.sort();
+        for (index, (job, name)) in results.into_iter().enumerate() {
+            assert_eq!(job, index);
+            assert_eq!(name.as_deref(), Some("pool-test"));
+        }
+    }
+}
@@ -0,0 +1,381 @@
+//! Rules for notifications that are delivered again and again.
+//!
+//! The next time a rule fires is computed from the time it fired last, without stepping
+//! through the time in between. An interval is added as often as needed in one step.
+//! A calendar pattern keeps the months, days, hours and minutes it allows as bit sets:
+//! the first field of the current time that is not allowed is moved to its next allowed
+//! value with a single bit search, and the fields below it start over.
+
+use crate::outbox::{Decoder, Encoder};
+use chrono::{Datelike, NaiveDate, NaiveDateTime, TimeZone, Timelike, Weekday};
+use std::ops::RangeInclusive;
+use std::time::Duration;
+
+/// Years a calendar pattern is searched for its next time before it is taken to never match,
+/// the longest a valid pattern can wait is the 29th of February on a given weekday
+const SEARCH_YEARS: i32 = 30;
+
+/// How often a notification is delivered, see [`Notification::recurrence`]
+///
+/// [`Notification::recurrence`]: crate::Notification::recurrence
+#[derive(Clone, Debug, PartialEq)]
+pub enum Recurrence {
+    /// Every given interval, counted from the first delivery
+    ///
+    /// Deliveries that were missed while the machine was asleep are skipped.
+    Every(Duration),
+    /// Whenever the local time matches the pattern
+    Calendar(CalendarPattern),
+}
+
+/// The local times a [`Recurrence::Calendar`] fires at, by the minutes, hours, days,
+/// months and weekdays they fall on, like a cron schedule
+///
+/// Every field matches any value until it is restricted, a time matches once all fields
+/// do. Values that are out of range are left out, a pattern without any allowed value in a
+/// field never matches and cannot be sent.
+///
+/// # Example:
+///
+/// ```no_run
+/// # use mac_notification_sys::*;
+/// # use chrono::Weekday;
+/// // at 9:30 on every weekday
+/// let _ = CalendarPattern::new()
+///     .minutes(&[30])
+///     .hours(&[9])
+///     .weekdays(&[Weekday::Mon, Weekday::Tue, Weekday::Wed, Weekday::Thu, Weekday::Fri]);
+/// ```
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct CalendarPattern {
+    // bit `n` is set if the value `n` is allowed
+    minutes: u64,
+    hours: u32,
+    days: u32,
+    months: u16,
+    // bit 0 is Monday
+    weekdays: u8,
+}
+
+impl Default for CalendarPattern {
+    fn default() -> Self {
+        CalendarPattern {
+            minutes: bits(0..=59),
+            hours: bits(0..=23) as u32,
+            days: bits(1..=31) as u32,
+            months: bits(1..=12) as u16,
+            weekdays: bits(0..=6) as u8,
+        }
+    }
+}
+
+impl CalendarPattern {
+    /// A pattern that matches every minute
+    pub fn new() -> Self {
+        Default::default()
+    }
+
+    /// Only match the given minutes of the hour, from 0 to 59
+    pub fn minutes(mut self, minutes: &[u32]) -> Self {
+        self.minutes = allowed(minutes, 0..=59);
+        self
+    }
+
+    /// Only match the given hours of the day, from 0 to 23
+    pub fn hours(mut self, hours: &[u32]) -> Self {
+        self.hours = allowed(hours, 0..=23) as u32;
+        self
+    }
+
+    /// Only match the given days of the month, from 1 to 31
+    ///
+    /// Days a month does not have are skipped in that month.
+    pub fn days(mut self, days: &[u32]) -> Self {
+        self.days = allowed(days, 1..=31) as u32;
+        self
+    }
+
+    /// Only match the given months, from 1 to 12
+    pub fn months(mut self, months: &[u32]) -> Self {
+        self.months = allowed(months, 1..=12) as u16;
+        self
+    }
+
+    /// Only match the given days of the week
+    ///
+    /// A day has to match both the days of the month and the weekdays.
+    pub fn weekdays(mut self, weekdays: &[Weekday]) -> Self {
+        let weekdays: Vec<u32> = weekdays.iter().map(Weekday::num_days_from_monday).collect();
+        self.weekdays = allowed(&weekdays, 0..=6) as u8;
+        self
+    }
+
+    /// The first matching minute after `after`, `None` if there is none within `SEARCH_YEARS`
+    fn next_after(&self, after: NaiveDateTime) -> Option<NaiveDateTime> {
+        if self.minutes == 0
+            || self.hours == 0
+            || self.days == 0
+            || self.months == 0
+            || self.weekdays == 0
+        {
+            return None;
+        }
+        let mut date = after.date();
+        let minute = after.hour() * 60 + after.minute() + 1;
+        let (mut hour, mut minute) = (minute / 60, minute % 60);
+        let last_year = date.year() + SEARCH_YEARS;
+        loop {
+            if hour > 23 {
+                date = date.succ_opt()?;
+                hour = 0;
+                minute = 0;
+            }
+            if date.year() > last_year {
+                return None;
+            }
+
+            if !is_set(u64::from(self.months), date.month()) {
+                date = match next_set(u64::from(self.months), date.month() + 1) {
+                    Some(month) => NaiveDate::from_ymd_opt(date.year(), month, 1)?,
+                    None => NaiveDate::from_ymd_opt(date.year() + 1, 1, 1)?,
+                };
+                hour = 0;
+                minute = 0;
+                continue;
+            }
+            let weekday = date.weekday().num_days_from_monday();
+            if !is_set(u64::from(self.days), date.day())
+                || !is_set(u64::from(self.weekdays), weekday)
+            {
+                hour = 24;
+                continue;
+            }
+            if !is_set(u64::from(self.hours), hour) {
+                hour = next_set(u64::from(self.hours), hour).unwrap_or(24);
+                minute = 0;
+                continue;
+            }
+            match next_set(self.minutes, minute) {
+                Some(minute) => return date.and_hms_opt(hour, minute, 0),
+                None => {
+                    hour += 1;
+                    minute = 0;
+                }
+            }
+        }
+    }
+}
+
+impl Recurrence {
+    /// The first time the rule fires after `after`, in milliseconds since the unix epoch.
+    ///
+    /// Intervals count from `previous`, the time the rule fired last, or from `after` if it
+    /// has not fired yet. Calendar patterns go by the local time of the time zone `tz`.
+    /// Returns `None` if the rule never fires again.
+    #[doc(hidden)]
+    pub fn next_after<Tz: TimeZone>(
+        &self,
+        after: u64,
+        previous: Option<u64>,
+        tz: &Tz,
+    ) -> Option<u64> {
+        match self {
+            Recurrence::Every(interval) => {
+                let interval = interval.as_millis() as u64;
+                if interval == 0 {
+                    return None;
+                }
+                let previous = previous.unwrap_or(after).min(after);
+                let missed = (after - previous) / interval;
+                previous.checked_add((missed + 1).checked_mul(interval)?)
+            }
+            Recurrence::Calendar(pattern) => {
+                let after_seconds = (after / 1000) as i64;
+                let mut local = tz.timestamp_opt(after_seconds, 0).single()?.naive_local();
+                loop {
+                    local = pattern.next_after(local)?;
+                    // a time skipped by a daylight saving change is left out,
+                    // a time that happens twice fires the first time
+                    let fires = match tz.from_local_datetime(&local).earliest() {
+                        Some(fires) => fires.timestamp(),
+                        None => continue,
+                    };
+                    if fires > after_seconds {
+                        return Some(fires as u64 * 1000);
+                    }
+                }
+            }
+        }
+    }
+
+    /// Lay out the rule for the outbox
+    pub(crate) fn encode(&self, encoder: &mut Encoder) {
+        match self {
+            Recurrence::Every(interval) => {
+                encoder.u8(0);
+                encoder.u64(interval.as_nanos() as u64);
+            }
+            Recurrence::Calendar(pattern) => {
+                encoder.u8(1);
+                encoder.u64(pattern.minutes);
+                encoder.u64(u64::from(pattern.hours));
+                encoder.u64(u64::from(pattern.days));
+                encoder.u64(u64::from(pattern.months));
+                encoder.u64(u64::from(pattern.weekdays));
+            }
+        }
+    }
+
+    /// Read back a rule laid out by `encode`, `None` if it is broken
+    pub(crate) fn decode(decoder: &mut Decoder) -> Option<Self> {
+        match decoder.u8()? {
+            0 => Some(Recurrence::Every(Duration::from_nanos(decoder.u64()?))),
+            1 => Some(Recurrence::Calendar(CalendarPattern {
+                minutes: decoder.u64()?,
+                hours: decoder.u64()? as u32,
+                days: decoder.u64()? as u32,
+                months: decoder.u64()? as u16,
+                weekdays: decoder.u64()? as u8,
+            })),
+            _ => None,
+        }
+    }
+}
+
+/// The set of all values in `range`
+fn bits(range: RangeInclusive<u32>) -> u64 {
+    range.fold(0, |bits, value| bits | 1 << value)
+}
+
+/// The set of the values that are in `range`
+fn allowed(values: &[u32], range: RangeInclusive<u32>) -> u64 {
+    values
+        .iter()
+        .filter(|&value| range.contains(value))
+        .fold(0, |bits, value| bits | 1 << value)
+}
+
+fn is_set(bits: u64, value: u32) -> bool {
+    bits & (1 << value) != 0
+}
+
+/// The smallest value in the set that is at least `from`
+fn next_set(bits: u64, from: u32) -> Option<u32> {
+    if from >= 64 {
+        return None;
+    }
+    match bits & (!0 << from) {
+        0 => None,
+        rest => Some(rest.trailing_zeros()),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use chrono::{FixedOffset, Utc};
+
+    fn millis<Tz: TimeZone>(tz: &Tz, y: i32, mo: u32, d: u32, h: u32, mi: u32) -> u64 {
+        let local = NaiveDate::from_ymd_opt(y, mo, d)
+            .unwrap()
+            .and_hms_opt(h, mi, 0)
+            .unwrap();
+        tz.from_local_datetime(&local).unwrap().timestamp() as u64 * 1000
+    }
+
+    /// Every fire time of the rule in the following `count`, starting after `after`
+    fn fires<Tz: TimeZone>(rule: &Recurrence, tz: &Tz, after: u64, count: usize) -> Vec<u64> {
+        let mut fires = Vec::new();
+        let mut previous = None;
+        let mut now = after;
+        while fires.len() < count {
+            match rule.next_after(now, previous, tz) {
+                Some(next) => {
+                    fires.push(next);
+                    previous = Some(next);
+                    now = next;
+                }
+                None => break,
+            }
+        }
+        fires
+    }
+
+    #[test]
+    fn intervals_skip_missed_deliveries() {
+        let rule = Recurrence::Every(Duration::from_secs(60));
+        assert_eq!(rule.next_after(1_000, None, &Utc), Some(61_000));
+        assert_eq!(rule.next_after(61_000, Some(61_000), &Utc), Some(121_000));
+        // woke up long after the last delivery, the next one stays on the grid
+        assert_eq!(
+            rule.next_after(3_600_500, Some(61_000), &Utc),
+            Some(3_601_000)
+        );
+        assert_eq!(
+            Recurrence::Every(Duration::from_secs(0)).next_after(0, None, &Utc),
+            None
+        );
+    }
+
+    #[test]
+    fn calendar_patterns_fire_on_matching_minutes() {
+        let utc = &Utc;
+        let weekdays = Recurrence::Calendar(
+            CalendarPattern::new()
+                .minutes(&[0, 30])
+                .hours(&[9, 17])
+                .weekdays(&[Weekday::Mon, Weekday::Fri]),
+        );
+        // 2021-01-01 was a Friday
+        assert_eq!(
+            fires(&weekdays, utc, millis(utc, 2021, 1, 1, 9, 0), 5),
+            vec![
+                millis(utc, 2021, 1, 1, 9, 30),
+                millis(utc, 2021, 1, 1, 17, 0),
+                millis(utc, 2021, 1, 1, 17, 30),
+                millis(utc, 2021, 1, 4, 9, 0),
+                millis(utc, 2021, 1, 4, 9, 30),
+            ]
+        );
+
+        let leap_days = Recurrence::Calendar(
+            CalendarPattern::new()
+                .minutes(&[0])
+                .hours(&[12])
+                .days(&[29])
+                .months(&[2]),
+        );
+        assert_eq!(
+            fires(&leap_days, utc, millis(utc, 2021, 3, 1, 0, 0), 3),
+            vec![
+                millis(utc, 2024, 2, 29, 12, 0),
+                millis(utc, 2028, 2, 29, 12, 0),
+                millis(utc, 2032, 2, 29, 12, 0),
+            ]
+        );
+
+        let never = Recurrence::Calendar(CalendarPattern::new().days(&[31]).months(&[2]));
+        assert_eq!(never.next_after(0, None, utc), None);
+        let none_allowed = Recurrence::Calendar(CalendarPattern::new().hours(&[24]));
+        assert_eq!(none_allowed.next_after(0, None, utc), None);
+    }
+
+    #[test]
+    fn calendar_patterns_go_by_local_time() {
+        let berlin = &FixedOffset::east_opt(3600).unwrap();
+        let daily = Recurrence::Calendar(CalendarPattern::new().minutes(&[15]).hours(&[23]));
+        let after = millis(berlin, 2021, 12, 31, 23, 15);
+        assert_eq!(
+            fires(&daily, berlin, after, 2),
+            vec![
+                millis(berlin, 2022, 1, 1, 23, 15),
+                millis(berlin, 2022, 1, 2, 23, 15),
+            ]
+        );
+        // the same instant is 22:15 in UTC, where 23:15 is still to come that day
+        assert_eq!(
+            daily.next_after(after, None, &Utc),
+            Some(millis(&Utc, 2021, 12, 31, 23, 15))
+        );
+    }
+}
@@ -0,0 +1,997 @@
+//! Remote images, fetched within a deadline and kept in an on-disk cache.
+//!
+//! Bodies are stored under the hash of their contents, so URLs that serve the same image
+//! share one file, and the image cache sees an unchanged file as long as the image does not
+//! change. A body is deleted when the last URL that served it gets a new one.
+//!
+//! Every URL has an index entry with its validators. Once an entry is no longer fresh it is
+//! revalidated with a conditional request. If the server is slow, unreachable or sends too
+//! much, the cached copy is used as it is, and without one the image is left out. An URL whose
+//! fetch failed is not fetched again until a backoff passed, which doubles with every failure
+//! in a row, so a server that is down costs one timeout per backoff at most.
+
+use std::collections::{HashMap, HashSet};
+use std::fs;
+use std::io::{self, Read, Write};
+use std::mem;
+use std::net::{TcpStream, ToSocketAddrs};
+use std::path::{Path, PathBuf};
+use std::process;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Mutex;
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+
+/// How long a response without `Cache-Control: max-age` counts as fresh, in seconds
+const DEFAULT_MAX_AGE: u64 = 300;
+/// How long an URL is not fetched again after its first failure in a row
+const MIN_BACKOFF: Duration = Duration::from_secs(10);
+const MAX_BACKOFF: Duration = Duration::from_secs(10 * 60);
+/// Longest response head that is accepted, in bytes
+const MAX_HEAD: usize = 16 * 1024;
+
+/// A conditional GET request
+pub(crate) struct Request<'a> {
+    pub(crate) url: &'a str,
+    pub(crate) etag: Option<&'a str>,
+    pub(crate) last_modified: Option<&'a str>,
+    /// The whole request has to be done by then, otherwise it fails with `TimedOut`
+    pub(crate) deadline: Instant,
+    /// Longer bodies fail with `InvalidData`
+    pub(crate) max_bytes: usize,
+}
+
+/// The response to a `Request`
+#[derive(Debug, Default, PartialEq)]
+pub(crate) struct Response {
+    /// `None` if the server answered that the cached copy is still valid
+    pub(crate) body: Option<Vec<u8>>,
+    pub(crate) etag: Option<String>,
+    pub(crate) last_modified: Option<String>,
+    /// `max-age` of the `Cache-Control` header, `Some(0)` for `no-cache` and `no-store`
+    pub(crate) max_age: Option<u64>,
+}
+
+impl Response {
+    /// Take the cache headers of a response, given by their lowercase name
+    pub(crate) fn with_headers<'h, I>(body: Option<Vec<u8>>, headers: I) -> Self
+    where
+        I: IntoIterator<Item = (&'h str, &'h str)>,
+    {
+        let mut response = Response {
+            body,
+            ..Response::default()
+        };
+        for (name, value) in headers {
+            match name {
+                "etag" => response.etag = Some(value.to_string()),
+                "last-modified" => response.last_modified = Some(value.to_string()),
+                "cache-control" => response.max_age = max_age(value),
+                _ => {}
+            }
+        }
+        response
+    }
+}
+
+/// Sends requests to the server of an URL
+pub(crate) trait Transport {
+    /// Send the request, fails with `TimedOut` once the deadline passed
+    fn fetch(&self, request: &Request) -> io::Result<Response>;
+}
+
+/// Bounds of every fetch
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub(crate) struct Limits {
+    pub(crate) timeout: Duration,
+    pub(crate) max_bytes: usize,
+}
+
+impl Default for Limits {
+    fn default() -> Self {
+        Limits {
+            timeout: Duration::from_secs(2),
+            max_bytes: 10 * 1024 * 1024,
+        }
+    }
+}
+
+/// What the index knows about an URL
+#[derive(Debug, PartialEq)]
+struct IndexEntry {
+    url: String,
+    file: String,
+    etag: Option<String>,
+    last_modified: Option<String>,
+    fetched_at: u64,
+    max_age: u64,
+}
+
+impl IndexEntry {
+    fn parse(contents: &str) -> Option<Self> {
+        let mut lines = contents.lines();
+        let mut next = || lines.next().map(String::from);
+        let optional = |line: String| if line.is_empty() { None } else { Some(line) };
+        Some(IndexEntry {
+            url: next()?,
+            file: next()?,
+            etag: optional(next()?),
+            last_modified: optional(next()?),
+            fetched_at: next()?.parse().ok()?,
+            max_age: next()?.parse().ok()?,
+        })
+    }
+
+    fn serialize(&self) -> String {
+        format!(
+            "{}\n{}\n{}\n{}\n{}\n{}\n",
+            self.url,
+            self.file,
+            self.etag.as_deref().unwrap_or(""),
+            self.last_modified.as_deref().unwrap_or(""),
+            self.fetched_at,
+            self.max_age
+        )
+    }
+}
+
+/// The cached copy of an URL, as far as it is known without asking the server
+#[derive(Debug, PartialEq)]
+pub(crate) enum Cached {
+    Fresh(PathBuf),
+    /// No longer fresh, to be revalidated
+    Stale(PathBuf),
+    Missing,
+}
+
+/// An URL whose last fetch failed
+struct Failure {
+    retry_at: Instant,
+    backoff: Duration,
+}
+
+/// On-disk cache of remote images
+pub(crate) struct RemoteCache<T: Transport> {
+    dir: PathBuf,
+    transport: T,
+    failures: Mutex<HashMap<String, Failure>>,
+    /// URLs that are being revalidated in the background
+    refreshing: Mutex<HashSet<String>>,
+    min_backoff: Duration,
+}
+
+impl<T: Transport> RemoteCache<T> {
+    /// Keep the images in `dir`, which is created when the first image is stored
+    pub(crate) fn new(dir: PathBuf, transport: T) -> Self {
+        RemoteCache {
+            dir,
+            transport,
+            failures: Mutex::new(HashMap::new()),
+            refreshing: Mutex::new(HashSet::new()),
+            min_backoff: MIN_BACKOFF,
+        }
+    }
+
+    /// The cached copy of `url`, without asking the server
+    pub(crate) fn lookup(&self, url: &str) -> Cached {
+        match self.cached(url) {
+            Some(entry) if unix_time() < entry.fetched_at.saturating_add(entry.max_age) => {
+                Cached::Fresh(self.dir.join(entry.file))
+            }
+            Some(entry) => Cached::Stale(self.dir.join(entry.file)),
+            None => Cached::Missing,
+        }
+    }
+
+    /// Claim the revalidation of `url`, false if it is claimed already.
+    ///
+    /// The claim ends with the next `fetch` of the URL.
+    pub(crate) fn claim_refresh(&self, url: &str) -> bool {
+        self.refreshing.lock().unwrap().insert(url.to_string())
+    }
+
+    /// Fetch or revalidate the image of `url`, unless it is backing off from a failure.
+    ///
+    /// Returns the cached copy if the fetch failed, `None` if there is none.
+    pub(crate) fn fetch(&self, url: &str, limits: Limits) -> Option<PathBuf> {
+        let fetched = self.fetch_now(url, limits);
+        self.refreshing.lock().unwrap().remove(url);
+        fetched
+    }
+
+    fn fetch_now(&self, url: &str, limits: Limits) -> Option<PathBuf> {
+        let cached = self.cached(url);
+        let backing_off = matches!(
+            self.failures.lock().unwrap().get(url),
+            Some(failure) if Instant::now() < failure.retry_at
+        );
+        if backing_off {
+            return cached.map(|entry| self.dir.join(entry.file));
+        }
+
+        let response = self.transport.fetch(&Request {
+            url,
+            etag: cached.as_ref().and_then(|entry| entry.etag.as_deref()),
+            last_modified: cached
+                .as_ref()
+                .and_then(|entry| entry.last_modified.as_deref()),
+            deadline: Instant::now() + limits.timeout,
+            max_bytes: limits.max_bytes,
+        });
+        let response = match response {
+            Ok(response) => response,
+            Err(_) => {
+                self.back_off(url);
+                return cached.map(|entry| self.dir.join(&entry.file));
+            }
+        };
+        self.failures.lock().unwrap().remove(url);
+
+        let file = match (response.body, &cached) {
+            (Some(body), _) => self.write_body(url, &body).ok()?,
+            (None, Some(entry)) => entry.file.clone(),
+            (None, None) => return None,
+        };
+        let entry = IndexEntry {
+            url: url.to_string(),
+            file,
+            etag: response.etag,
+            last_modified: response.last_modified,
+            fetched_at: unix_time(),
+            max_age: response.max_age.unwrap_or(DEFAULT_MAX_AGE),
+        };
+        let written = self.write(&self.index_path(url), entry.serialize().as_bytes());
+        if let (Ok(()), Some(previous)) = (written, cached) {
+            if previous.file != entry.file {
+                self.remove_unused_body(&previous.file);
+            }
+        }
+        Some(self.dir.join(entry.file))
+    }
+
+    /// Keep from fetching `url` again for twice as long as after its previous failure
+    fn back_off(&self, url: &str) {
+        let mut failures = self.failures.lock().unwrap();
+        let backoff = match failures.get(url) {
+            Some(failure) => (failure.backoff * 2).min(MAX_BACKOFF),
+            None => self.min_backoff,
+        };
+        let retry_at = Instant::now() + backoff;
+        failures.insert(url.to_string(), Failure { retry_at, backoff });
+    }
+
+    /// The index entry of `url`, if its body is still there
+    fn cached(&self, url: &str) -> Option<IndexEntry> {
+        self.read_index(url)
+            .filter(|entry| self.dir.join(&entry.file).is_file())
+    }
+
+    fn index_path(&self, url: &str) -> PathBuf {
+        self.dir
+            .join("index")
+            .join(format!("{:016x}", fnv1a(url.as_bytes())))
+    }
+
+    fn read_index(&self, url: &str) -> Option<IndexEntry> {
+        let contents = fs::read_to_string(self.index_path(url)).ok()?;
+        // a different URL with the same hash is a miss
+        IndexEntry::parse(&contents).filter(|entry| entry.url == url)
+    }
+
+    /// Store the body under its content hash, keeping the extension of the URL for the decoder
+    fn write_body(&self, url: &str, body: &[u8]) -> io::Result<String> {
+        let file = format!(
+            "{:016x}-{}{}",
+            fnv1a(body),
+            body.len(),
+            extension(url).unwrap_or("")
+        );
+        let path = self.dir.join(&file);
+        if !path.is_file() {
+            self.write(&path, body)?;
+        }
+        Ok(file)
+    }
+
+    /// Delete a body that no index entry refers to any more.
+    ///
+    /// An entry written for the same body meanwhile is left without it, which is a miss.
+    fn remove_unused_body(&self, file: &str) {
+        let index = match fs::read_dir(self.dir.join("index")) {
+            Ok(index) => index,
+            Err(_) => return,
+        };
+        let used = index.filter_map(Result::ok).any(|entry| {
+            let contents = fs::read_to_string(entry.path()).ok();
+            matches!(
+                contents.as_deref().and_then(IndexEntry::parse),
+                Some(entry) if entry.file == file
+            )
+        });
+        if !used {
+            let _ = fs::remove_file(self.dir.join(file));
+        }
+    }
+
+    /// Write the file as a whole, so readers never see half of it
+    fn write(&self, path: &Path, contents: &[u8]) -> io::Result<()> {
+        static TEMP_FILES: AtomicUsize = AtomicUsize::new(0);
+        let dir = path.parent().unwrap_or(&self.dir);
+        fs::create_dir_all(dir)?;
+        let temp = dir.join(format!(
+            ".{}-{}.tmp",
+            process::id(),
+            TEMP_FILES.fetch_add(1, Ordering::Relaxed)
+        ));
+        fs::write(&temp, contents)?;
+        if let Err(error) = fs::rename(&temp, path) {
+            let _ = fs::remove_file(&temp);
+            return Err(error);
+        }
+        Ok(())
+    }
+}
+
+/// Plain HTTP/1.1 on a `TcpStream`, for `http://` URLs
+pub(crate) struct Http;
+
+impl Transport for Http {
+    fn fetch(&self, request: &Request) -> io::Result<Response> {
+        let (host, port, path) = split_http_url(request.url)
+            .ok_or_else(|| io::Error::new(io::ErrorKind::InvalidInput, "not an http:// URL"))?;
+        // name resolution itself can not be bounded with std, hosts are usually cached by the system
+        let address = (host, port)
+            .to_socket_addrs()?
+            .next()
+            .ok_or_else(|| io::Error::new(io::ErrorKind::NotFound, "no address"))?;
+        let mut stream = TcpStream::connect_timeout(&address, remaining(request.deadline)?)?;
+
+        let mut head = format!(
+            "GET {} HTTP/1.1\r\nHost: {}\r\nConnection: close\r\nAccept: image/*\r\n",
+            path,
+            host_header(host, port)
+        );
+        if let Some(etag) = request.etag {
+            head.push_str(&format!("If-None-Match: {}\r\n", etag));
+        }
+        if let Some(last_modified) = request.last_modified {
+            head.push_str(&format!("If-Modified-Since: {}\r\n", last_modified));
+        }
+        head.push_str("\r\n");
+        stream.set_write_timeout(Some(remaining(request.deadline)?))?;
+        stream.write_all(head.as_bytes())?;
+
+        let mut incoming = Incoming::new(request.max_bytes);
+        let mut received = 0;
+        let mut buffer = [0; 8192];
+        loop {
+            stream.set_read_timeout(Some(remaining(request.deadline)?))?;
+            let read = match stream.read(&mut buffer) {
+                Ok(read) => read,
+                Err(error) if error.kind() == io::ErrorKind::WouldBlock => {
+                    return Err(io::ErrorKind::TimedOut.into())
+                }
+                Err(error) => return Err(error),
+            };
+            if read == 0 {
+                return incoming.closed();
+            }
+            received += read;
+            if received > MAX_HEAD + request.max_bytes {
+                return Err(too_large());
+            }
+            if let Some(response) = incoming.push(&buffer[..read])? {
+                return Ok(response);
+            }
+        }
+    }
+}
+
+/// How the end of a response body is found
+enum Framing {
+    /// `Content-Length`
+    Length(usize),
+    Chunked(Chunk),
+    /// The body ends with the connection
+    UntilClosed,
+}
+
+/// Where the decoder of a chunked body is
+#[derive(Clone, Copy)]
+enum Chunk {
+    /// Waiting for the line with the size of the next chunk
+    Size,
+    /// This many bytes of the current chunk are still to come
+    Data(usize),
+    /// Waiting for the line break after a chunk
+    DataEnd,
+}
+
+/// A response as it arrives
+///
+/// The head is parsed once it is complete, after that every read only decodes the bytes that
+/// are new, so a body takes linear time however it is split up.
+struct Incoming {
+    max_bytes: usize,
+    /// The head until it is complete, then the body bytes that were not decoded yet
+    pending: Vec<u8>,
+    /// How much of the head was searched for its end already
+    scanned: usize,
+    /// The response with the cache headers and how its body ends, once the head was parsed
+    head: Option<(Response, Framing)>,
+    /// The decoded body of a chunked response
+    body: Vec<u8>,
+}
+
+impl Incoming {
+    fn new(max_bytes: usize) -> Self {
+        Incoming {
+            max_bytes,
+            pending: Vec::new(),
+            scanned: 0,
+            head: None,
+            body: Vec::new(),
+        }
+    }
+
+    /// Take the bytes of the next read, returns the response once it is complete
+    fn push(&mut self, bytes: &[u8]) -> io::Result<Option<Response>> {
+        self.pending.extend_from_slice(bytes);
+        if self.head.is_none() {
+            // the end of the head may have started in the previous read
+            let from = self.scanned.saturating_sub(3);
+            let end = match find(&self.pending[from..], b"\r\n\r\n") {
+                Some(end) => from + end,
+                None if self.pending.len() > MAX_HEAD => {
+                    return Err(invalid("response head too long"))
+                }
+                None => {
+                    self.scanned = self.pending.len();
+                    return Ok(None);
+                }
+            };
+            let (response, framing) = parse_head(&self.pending[..end], self.max_bytes)?;
+            let framing = match framing {
+                Some(framing) => framing,
+                None => return Ok(Some(response)),
+            };
+            self.pending.drain(..end + 4);
+            self.head = Some((response, framing));
+        }
+        self.decode()
+    }
+
+    /// The connection was closed, the response is complete if its body ends with it
+    fn closed(mut self) -> io::Result<Response> {
+        match self.head.take() {
+            Some((mut response, Framing::UntilClosed)) => {
+                response.body = Some(self.pending);
+                Ok(response)
+            }
+            _ => Err(io::ErrorKind::UnexpectedEof.into()),
+        }
+    }
+
+    /// Decode the pending body bytes, returns the response once its body is complete
+    fn decode(&mut self) -> io::Result<Option<Response>> {
+        let complete = match &mut self.head {
+            Some((_, Framing::Length(length))) => {
+                let length = *length;
+                if self.pending.len() < length {
+                    return Ok(None);
+                }
+                self.pending.truncate(length);
+                Some(mem::take(&mut self.pending))
+            }
+            Some((_, Framing::UntilClosed)) if self.pending.len() > self.max_bytes => {
+                return Err(too_large())
+            }
+            Some((_, Framing::Chunked(chunk))) => {
+                let (next, used, done) =
+                    dechunk(*chunk, &self.pending, &mut self.body, self.max_bytes)?;
+                *chunk = next;
+                self.pending.drain(..used);
+                if done {
+                    Some(mem::take(&mut self.body))
+                } else {
+                    None
+                }
+            }
+            _ => None,
+        };
+        Ok(complete.and_then(|body| {
+            let (mut response, _) = self.head.take()?;
+            response.body = Some(body);
+            Some(response)
+        }))
+    }
+}
+
+/// The cache headers of a response head and how its body ends, `None` if it has no body
+fn parse_head(head: &[u8], max_bytes: usize) -> io::Result<(Response, Option<Framing>)> {
+    let head = std::str::from_utf8(head).map_err(|_| invalid("head is not UTF-8"))?;
+    let mut lines = head.split("\r\n");
+    let status: u16 = lines
+        .next()
+        .and_then(|line| line.split(' ').nth(1))
+        .and_then(|status| status.parse().ok())
+        .ok_or_else(|| invalid("no status"))?;
+    let headers: Vec<(String, &str)> = lines
+        .filter_map(|line| {
+            let colon = line.find(':')?;
+            Some((line[..colon].to_ascii_lowercase(), line[colon + 1..].trim()))
+        })
+        .collect();
+    let header = |name: &str| {
+        headers
+            .iter()
+            .find(|(header, _)| header == name)
+            .map(|(_, value)| *value)
+    };
+    let response = Response::with_headers(
+        None,
+        headers.iter().map(|(name, value)| (name.as_str(), *value)),
+    );
+
+    match status {
+        304 => return Ok((response, None)),
+        200 => {}
+        _ => return Err(invalid(&format!("status {}", status))),
+    }
+
+    let framing = if matches!(header("transfer-encoding"), Some(coding) if coding.eq_ignore_ascii_case("chunked"))
+    {
+        Framing::Chunked(Chunk::Size)
+    } else {
+        match header("content-length") {
+            Some(length) => {
+                let length: usize = length.parse().map_err(|_| invalid("bad content-length"))?;
+                if length > max_bytes {
+                    return Err(too_large());
+                }
+                Framing::Length(length)
+            }
+            None => Framing::UntilClosed,
+        }
+    };
+    Ok((response, Some(framing)))
+}
+
+/// Decode as much of a chunked body as arrived, going on from `state`
+///
+/// Returns the state to go on from with the next bytes, how many of the bytes were used and
+/// whether the last chunk arrived.
+fn dechunk(
+    mut state: Chunk,
+    chunked: &[u8],
+    body: &mut Vec<u8>,
+    max_bytes: usize,
+) -> io::Result<(Chunk, usize, bool)> {
+    let mut used = 0;
+    loop {
+        let rest = &chunked[used..];
+        match state {
+            Chunk::Size => {
+                let line_end = match find(rest, b"\r\n") {
+                    Some(line_end) => line_end,
+                    None => return Ok((state, used, false)),
+                };
+                let size = std::str::from_utf8(&rest[..line_end])
+                    .ok()
+                    .and_then(|line| line.split(';').next())
+                    .and_then(|size| usize::from_str_radix(size.trim(), 16).ok())
+                    .ok_or_else(|| invalid("bad chunk size"))?;
+                used += line_end + 2;
+                if size == 0 {
+                    return Ok((state, used, true));
+                }
+                if body.len() + size > max_bytes {
+                    return Err(too_large());
+                }
+                state = Chunk::Data(size);
+            }
+            Chunk::Data(left) => {
+                if rest.is_empty() {
+                    return Ok((state, used, false));
+                }
+                let taken = left.min(rest.len());
+                body.extend_from_slice(&rest[..taken]);
+                used += taken;
+                state = match left - taken {
+                    0 => Chunk::DataEnd,
+                    left => Chunk::Data(left),
+                };
+            }
+            Chunk::DataEnd => {
+                if rest.len() < 2 {
+                    return Ok((state, used, false));
+                }
+                used += 2;
+                state = Chunk::Size;
+            }
+        }
+    }
+}
+
+/// Whether the image is fetched from a server, given as an `http://` or `https://` URL
+pub(crate) fn is_remote(url: &str) -> bool {
+    let scheme = url.split("://").next().unwrap_or("");
+    url.len() > scheme.len()
+        && (scheme.eq_ignore_ascii_case("http") || scheme.eq_ignore_ascii_case("https"))
+}
+
+/// Host, port and path of an `http://` URL, the host of an IPv6 literal without its brackets
+fn split_http_url(url: &str) -> Option<(&str, u16, &str)> {
+    let mut parts = url.splitn(2, "://");
+    if !parts.next()?.eq_ignore_ascii_case("http") {
+        return None;
+    }
+    let rest = parts.next()?;
+    let (authority, path) = match rest.find('/') {
+        Some(slash) => (&rest[..slash], &rest[slash..]),
+        None => (rest, "/"),
+    };
+    let (host, port) = if authority.starts_with('[') {
+        let close = authority.find(']')?;
+        (&authority[1..close], &authority[close + 1..])
+    } else {
+        match authority.rfind(':') {
+            Some(colon) => (&authority[..colon], &authority[colon..]),
+            None => (authority, ""),
+        }
+    };
+    let port = match port {
+        "" => 80,
+        port if port.starts_with(':') => port[1..].parse().ok()?,
+        _ => return None,
+    };
+    Some((host, port, path))
+}
+
+/// The `Host` header for a host and port, which names the port unless it is the default one
+fn host_header(host: &str, port: u16) -> String {
+    let host = if host.contains(':') {
+        format!("[{}]", host)
+    } else {
+        host.to_string()
+    };
+    match port {
+        80 => host,
+        port => format!("{}:{}", host, port),
+    }
+}
+
+/// `max-age` of a `Cache-Control` header
+fn max_age(cache_control: &str) -> Option<u64> {
+    cache_control
+        .split(',')
+        .map(str::trim)
+        .find_map(|directive| {
+            if directive.eq_ignore_ascii_case("no-cache")
+                || directive.eq_ignore_ascii_case("no-store")
+            {
+                Some(0)
+            } else if directive.to_ascii_lowercase().starts_with("max-age=") {
+                directive["max-age=".len()..].parse().ok()
+            } else {
+                None
+            }
+        })
+}
+
+/// The extension of the last path segment of the URL, with its dot
+fn extension(url: &str) -> Option<&str> {
+    let path = url.split(&['?', '#'][..]).next()?;
+    let name = &path[path.rfind('/')? + 1..];
+    let extension = &name[name.rfind('.')?..];
+    if extension.len() > 1
+        && extension.len() <= 6
+        && extension[1..].chars().all(|c| c.is_ascii_alphanumeric())
+    {
+        Some(extension)
+    } else {
+        None
+    }
+}
+
+/// Time left until the deadline, `TimedOut` once it has passed
+fn remaining(deadline: Instant) -> io::Result<Duration> {
+    let now = Instant::now();
+    if now >= deadline {
+        Err(io::ErrorKind::TimedOut.into())
+    } else {
+        Ok(deadline - now)
+    }
+}
+
+fn find(haystack: &[u8], needle: &[u8]) -> Option<usize> {
+    haystack
+        .windows(needle.len())
+        .position(|window| window == needle)
+}
+
+fn invalid(reason: &str) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, reason)
+}
+
+fn too_large() -> io::Error {
+    invalid("response larger than the maximum size")
+}
+
+fn unix_time() -> u64 {
+    SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .map_or(0, |since| since.as_secs())
+}
+
+/// 64 bit FNV-1a, stable across platforms and Rust versions unlike the std hashers
+pub(crate) fn fnv1a(bytes: &[u8]) -> u64 {
+    bytes.iter().fold(0xcbf2_9ce4_8422_2325, |hash, byte| {
+        (hash ^ u64::from(*byte)).wrapping_mul(0x0000_0100_0000_01b3)
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::env;
+    use std::net::TcpListener;
+    use std::sync::mpsc::{self, Receiver};
+    use std::thread;
+
+    /// Stand-in server: answers one connection after the other with the given responses,
+    /// each after its delay, and hands out the requests it got
+    fn serve(responses: Vec<(Duration, &'static str)>) -> (String, Receiver<String>) {
+        let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+        let url = format!("http://{}/images/chart.png", listener.local_addr().unwrap());
+        let (requests, received) = mpsc::channel();
+        thread::spawn(move || {
+            for (delay, response) in responses {
+                let mut stream = match listener.accept() {
+                    Ok((stream, _)) => stream,
+                    Err(_) => return,
+                };
+                let mut request = Vec::new();
+                let mut buffer = [0; 1024];
+                while find(&request, b"\r\n\r\n").is_none() {
+                    match stream.read(&mut buffer) {
+                        Ok(0) | Err(_) => break,
+                        Ok(read) => request.extend_from_slice(&buffer[..read]),
+                    }
+                }
+                let _ = requests.send(String::from_utf8_lossy(&request).into_owned());
+                thread::sleep(delay);
+                let _ = stream.write_all(response.as_bytes());
+            }
+        });
+        (url, received)
+    }
+
+    impl<T: Transport> RemoteCache<T> {
+        /// The cached image of `url`, fetched or revalidated first if it is not fresh
+        fn get(&self, url: &str, limits: Limits) -> Option<PathBuf> {
+            match self.lookup(url) {
+                Cached::Fresh(path) => Some(path),
+                _ => self.fetch(url, limits),
+            }
+        }
+    }
+
+    fn cache(name: &str) -> RemoteCache<Http> {
+        let dir = env::temp_dir().join(format!("mac-notification-sys-{}-{}", name, process::id()));
+        let _ = fs::remove_dir_all(&dir);
+        RemoteCache::new(dir, Http)
+    }
+
+    fn limits(timeout_ms: u64, max_bytes: usize) -> Limits {
+        Limits {
+            timeout: Duration::from_millis(timeout_ms),
+            max_bytes,
+        }
+    }
+
+    #[test]
+    fn revalidates_stale_copies() {
+        let now = Duration::from_millis(0);
+        let (url, requests) = serve(vec![
+            (now, "HTTP/1.1 200 OK\r\nETag: \"v1\"\r\nCache-Control: max-age=0\r\nContent-Length: 4\r\n\r\npng!"),
+            (now, "HTTP/1.1 304 Not Modified\r\nCache-Control: public, max-age=60\r\n\r\n"),
+        ]);
+        let cache = cache("remote-revalidates");
+
+        let path = cache.get(&url, limits(1000, 100)).unwrap();
+        assert_eq!(fs::read(&path).unwrap(), b"png!");
+        assert!(path.to_str().unwrap().ends_with(".png"));
+        let request = requests.recv().unwrap();
+        assert!(!request.contains("If-None-Match"));
+        assert!(request.contains(&format!("Host: {}\r\n", url.split('/').nth(2).unwrap())));
+
+        assert_eq!(cache.get(&url, limits(1000, 100)), Some(path.clone()));
+        assert!(requests
+            .recv()
+            .unwrap()
+            .contains("If-None-Match: \"v1\"\r\n"));
+
+        // fresh for a minute now, no request at all
+        assert_eq!(cache.get(&url, limits(1000, 100)), Some(path));
+        assert!(requests.try_recv().is_err());
+        fs::remove_dir_all(&cache.dir).unwrap();
+    }
+
+    #[test]
+    fn slow_servers_fall_back_to_the_cached_copy() {
+        let (url, _requests) = serve(vec![
+            (
+                Duration::from_millis(0),
+                "HTTP/1.1 200 OK\r\nCache-Control: no-cache\r\nContent-Length: 4\r\n\r\nold!",
+            ),
+            (
+                Duration::from_millis(500),
+                "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nnew!",
+            ),
+        ]);
+        let cache = cache("remote-slow");
+        let old = cache.get(&url, limits(1000, 100)).unwrap();
+
+        let start = Instant::now();
+        assert_eq!(cache.get(&url, limits(100, 100)), Some(old));
+        assert!(start.elapsed() < Duration::from_millis(400));
+        fs::remove_dir_all(&cache.dir).unwrap();
+    }
+
+    #[test]
+    fn failing_servers_are_not_asked_again_until_the_backoff_passed() {
+        let now = Duration::from_millis(0);
+        let (url, requests) = serve(vec![
+            (
+                now,
+                "HTTP/1.1 200 OK\r\nCache-Control: no-cache\r\nContent-Length: 4\r\n\r\nold!",
+            ),
+            (
+                now,
+                "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n",
+            ),
+            (now, "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nnew!"),
+        ]);
+        let mut cache = cache("remote-backoff");
+        cache.min_backoff = Duration::from_millis(300);
+        let old = cache.get(&url, limits(1000, 100)).unwrap();
+        assert_eq!(cache.lookup(&url), Cached::Stale(old.clone()));
+        requests.recv().unwrap();
+
+        // the failure is remembered, the stale copy is served without asking again
+        assert!(cache.claim_refresh(&url) && !cache.claim_refresh(&url));
+        assert_eq!(cache.fetch(&url, limits(1000, 100)), Some(old.clone()));
+        requests.recv().unwrap();
+        assert!(cache.claim_refresh(&url));
+        assert_eq!(cache.fetch(&url, limits(1000, 100)), Some(old));
+        assert!(requests.recv_timeout(Duration::from_millis(50)).is_err());
+
+        thread::sleep(Duration::from_millis(300));
+        let new = cache.get(&url, limits(1000, 100)).unwrap();
+        assert_eq!(fs::read(new).unwrap(), b"new!");
+        assert!(cache.failures.lock().unwrap().is_empty());
+        fs::remove_dir_all(&cache.dir).unwrap();
+    }
+
+    #[test]
+    fn replaced_bodies_are_deleted_once_unused() {
+        let now = Duration::from_millis(0);
+        let (url, _requests) = serve(vec![
+            (
+                now,
+                "HTTP/1.1 200 OK\r\nCache-Control: no-cache\r\nContent-Length: 4\r\n\r\nold!",
+            ),
+            (
+                now,
+                "HTTP/1.1 200 OK\r\nCache-Control: no-cache\r\nContent-Length: 4\r\n\r\nold!",
+            ),
+            (
+                now,
+                "HTTP/1.1 200 OK\r\nCache-Control: no-cache\r\nContent-Length: 4\r\n\r\nnew!",
+            ),
+            (
+                now,
+                "HTTP/1.1 200 OK\r\nCache-Control: no-cache\r\nContent-Length: 4\r\n\r\nnew!",
+            ),
+        ]);
+        let copy = url.replace("chart", "copy");
+        let cache = cache("remote-replaced");
+        let old = cache.get(&url, limits(1000, 100)).unwrap();
+        assert_eq!(cache.get(&copy, limits(1000, 100)), Some(old.clone()));
+
+        // the other URL still serves the old body
+        let new = cache.get(&url, limits(1000, 100)).unwrap();
+        assert_eq!(fs::read(&new).unwrap(), b"new!");
+        assert!(old.is_file());
+
+        assert_eq!(cache.get(&copy, limits(1000, 100)), Some(new));
+        assert!(!old.exists());
+        fs::remove_dir_all(&cache.dir).unwrap();
+    }
+
+    #[test]
+    fn urls_name_their_host_and_port() {
+        let urls = [
+            (
+                "http://example.com/icon.png",
+                "example.com",
+                80,
+                "/icon.png",
+            ),
+            ("http://example.com:8080", "example.com", 8080, "/"),
+            ("http://[::1]:8080/icon.png", "::1", 8080, "/icon.png"),
+            ("http://[fe80::1]/icon.png", "fe80::1", 80, "/icon.png"),
+        ];
+        for (url, host, port, path) in urls.iter() {
+            assert_eq!(split_http_url(url), Some((*host, *port, *path)));
+        }
+        assert_eq!(split_http_url("http://[::1/icon.png"), None);
+        assert_eq!(split_http_url("http://[::1]8080/icon.png"), None);
+        assert_eq!(split_http_url("https://example.com/icon.png"), None);
+
+        assert_eq!(host_header("example.com", 80), "example.com");
+        assert_eq!(host_header("example.com", 8080), "example.com:8080");
+        assert_eq!(host_header("::1", 8080), "[::1]:8080");
+        assert_eq!(host_header("::1", 80), "[::1]");
+    }
+
+    #[test]
+    fn responses_are_decoded_however_they_arrive() {
+        let responses: [(&[u8], Option<&[u8]>); 4] = [
+            (b"HTTP/1.1 200 OK\r\nETag: \"v2\"\r\nContent-Length: 4\r\n\r\npng!", Some(b"png!")),
+            (
+                b"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nETag: \"v2\"\r\n\r\n2;x=y\r\npn\r\n2\r\ng!\r\n0\r\n\r\n",
+                Some(b"png!"),
+            ),
+            (b"HTTP/1.1 304 Not Modified\r\nETag: \"v2\"\r\n\r\n", None),
+            (b"HTTP/1.1 200 OK\r\nETag: \"v2\"\r\n\r\npng!", Some(b"png!")),
+        ];
+        for (bytes, body) in responses.iter() {
+            for split in &[1, 3, bytes.len()] {
+                let mut incoming = Incoming::new(100);
+                let mut pushed = bytes.chunks(*split);
+                let response = loop {
+                    match pushed.next() {
+                        Some(bytes) => {
+                            if let Some(response) = incoming.push(bytes).unwrap() {
+                                break response;
+                            }
+                        }
+                        None => break incoming.closed().unwrap(),
+                    }
+                };
+                assert_eq!(response.body.as_deref(), *body);
+                assert_eq!(response.etag.as_deref(), Some("\"v2\""));
+            }
+        }
+
+        let mut truncated = Incoming::new(100);
+        assert!(truncated
+            .push(b"HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\npn")
+            .unwrap()
+            .is_none());
+        assert_eq!(
+            truncated.closed().unwrap_err().kind(),
+            io::ErrorKind::UnexpectedEof
+        );
+    }
+
+    #[test]
+    fn oversized_bodies_are_not_stored() {
+        assert!(is_remote("HTTPS://example.com/icon.png"));
+        assert!(!is_remote("file:///tmp/icon.png") && !is_remote("http"));
+        let now = Duration::from_millis(0);
+        let (url, _requests) = serve(vec![
+            (now, "HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\n"),
+            (now, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n2\r\npn\r\n2\r\ng!\r\n0\r\n\r\n"),
+        ]);
+        let mut cache = cache("remote-oversized");
+        cache.min_backoff = Duration::from_millis(0);
+
+        assert_eq!(cache.get(&url, limits(1000, 10)), None);
+        assert!(!cache.dir.exists());
+        let path = cache.get(&url, limits(1000, 10)).unwrap();
+        assert_eq!(fs::read(path).unwrap(), b"png!");
+        fs::remove_dir_all(&cache.dir).unwrap();
+    }
+}
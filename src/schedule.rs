@@ -0,0 +1,645 @@
+//! Holding scheduled notifications until their delivery date.
+//!
+//! Pending notifications are kept in a hierarchical timing wheel of six levels of 64 slots.
+//! A slot of the first level spans one millisecond, a slot of every further level spans a
+//! whole revolution of the level below. An entry goes into the level of the highest bit in
+//! which its deadline differs from the current time, and moves down whenever the wheel reaches
+//! its slot, until it expires from the first level. Entries are linked into their slot by
+//! index, so inserting and cancelling take constant time, and a bit per slot tells which
+//! slots are occupied, so finding the next slot to visit never looks at empty ones.
+//!
+//! A `Scheduler` thread sleeps until that slot is due and hands expired entries to a callback.
+//! An entry keeps its key while the callback runs, the callback can put it back into the wheel
+//! to be due again, which is how a series of notifications only ever holds its next instance.
+
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread;
+use std::time::{Duration, SystemTime, UNIX_EPOCH};
+
+const LEVELS: usize = 6;
+const SLOT_BITS: u32 = 6;
+const SLOTS: usize = 1 << SLOT_BITS;
+
+/// Deadlines further ahead are parked in the last level until they come closer, about 2 years
+const MAX_AHEAD: u64 = (1 << (SLOT_BITS * LEVELS as u32)) - 1;
+
+/// End of a slot's list
+const NIL: u32 = u32::MAX;
+
+/// The longest the scheduler sleeps at once, so it notices a wall clock that jumped ahead
+/// while the machine was asleep
+const MAX_SLEEP: Duration = Duration::from_secs(1);
+
+/// Identifies an entry of a `TimerWheel`, it no longer matches once the entry is done or was cancelled
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct Key {
+    index: u32,
+    generation: u32,
+}
+
+/// Where an entry of a `TimerWheel` is in its life
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub(crate) enum Stage {
+    /// Not in the wheel, done or cancelled
+    Free,
+    /// Linked into a slot
+    Pending,
+    /// Taken out by `expire`, waiting to be settled
+    Firing,
+    /// Cancelled while firing, freed once it is settled
+    Cancelled,
+}
+
+struct Entry<T> {
+    // `Some` while the entry is pending
+    value: Option<T>,
+    stage: Stage,
+    when: u64,
+    generation: u32,
+    // the slot the entry is linked into, `level * SLOTS + slot`
+    slot: usize,
+    prev: u32,
+    next: u32,
+}
+
+/// Values that are due at a given millisecond, see the module documentation
+pub struct TimerWheel<T> {
+    entries: Vec<Entry<T>>,
+    free: Vec<u32>,
+    heads: Vec<u32>,
+    occupied: [u64; LEVELS],
+    // the time the wheel has been advanced to
+    elapsed: u64,
+    len: usize,
+}
+
+impl<T> TimerWheel<T> {
+    /// Create an empty wheel at the given time
+    pub fn new(now: u64) -> Self {
+        TimerWheel {
+            entries: Vec::new(),
+            free: Vec::new(),
+            heads: vec![NIL; LEVELS * SLOTS],
+            occupied: [0; LEVELS],
+            elapsed: now,
+            len: 0,
+        }
+    }
+
+    /// Add a value that expires at `when`, values due already expire on the next `expire`
+    pub fn insert(&mut self, when: u64, value: T) -> Key {
+        let index = match self.free.pop() {
+            Some(index) => index,
+            None => {
+                self.entries.push(Entry {
+                    value: None,
+                    stage: Stage::Free,
+                    when: 0,
+                    generation: 0,
+                    slot: 0,
+                    prev: NIL,
+                    next: NIL,
+                });
+                (self.entries.len() - 1) as u32
+            }
+        };
+        let entry = &mut self.entries[index as usize];
+        entry.value = Some(value);
+        entry.stage = Stage::Pending;
+        entry.when = when;
+        let generation = entry.generation;
+        self.link(index);
+        self.len += 1;
+        Key { index, generation }
+    }
+
+    fn stage(&self, key: Key) -> Stage {
+        match self.entries.get(key.index as usize) {
+            Some(entry) if entry.generation == key.generation => entry.stage,
+            _ => Stage::Free,
+        }
+    }
+
+    /// Whether the entry is pending or firing
+    pub(crate) fn contains(&self, key: Key) -> bool {
+        matches!(self.stage(key), Stage::Pending | Stage::Firing)
+    }
+
+    /// Drop a pending entry, or a firing one once it is settled.
+    ///
+    /// Returns the stage the entry was in.
+    pub(crate) fn cancel(&mut self, key: Key) -> Stage {
+        let stage = self.stage(key);
+        match stage {
+            Stage::Pending => {
+                self.unlink(key.index);
+                self.release(key.index);
+            }
+            Stage::Firing => self.entries[key.index as usize].stage = Stage::Cancelled,
+            Stage::Free | Stage::Cancelled => {}
+        }
+        stage
+    }
+
+    /// Put an entry taken out by `expire` back to be due at `next`, or drop it for good
+    ///
+    /// Entries that were cancelled while firing are dropped either way.
+    pub fn settle(&mut self, key: Key, value: T, next: Option<u64>) {
+        match (self.stage(key), next) {
+            (Stage::Firing, Some(next)) => {
+                let entry = &mut self.entries[key.index as usize];
+                entry.value = Some(value);
+                entry.stage = Stage::Pending;
+                entry.when = next;
+                self.link(key.index);
+            }
+            (Stage::Firing, None) | (Stage::Cancelled, _) => self.release(key.index),
+            _ => {}
+        }
+    }
+
+    /// When `expire` has something to do next, `None` if the wheel is empty
+    ///
+    /// This is when the next entry expires, or earlier when entries have to move down a level first.
+    pub(crate) fn next_expiry(&self) -> Option<u64> {
+        self.next_slot().map(|(_, due)| due)
+    }
+
+    /// Advance the wheel to `now` and take out the entries that expired, in the order they did
+    ///
+    /// Their keys stay taken until they are settled.
+    pub fn expire(&mut self, now: u64) -> Vec<(Key, T)> {
+        let mut expired = Vec::new();
+        while let Some((slot, due)) = self.next_slot().filter(|&(_, due)| due <= now) {
+            self.elapsed = self.elapsed.max(due);
+            let mut index = self.heads[slot];
+            self.heads[slot] = NIL;
+            self.occupied[slot / SLOTS] &= !(1 << (slot % SLOTS));
+            while index != NIL {
+                let (next, when) = {
+                    let entry = &self.entries[index as usize];
+                    (entry.next, entry.when)
+                };
+                if when <= self.elapsed {
+                    let entry = &mut self.entries[index as usize];
+                    entry.stage = Stage::Firing;
+                    let key = Key {
+                        index,
+                        generation: entry.generation,
+                    };
+                    expired.push((key, entry.value.take().unwrap()));
+                } else {
+                    self.link(index);
+                }
+                index = next;
+            }
+        }
+        self.elapsed = self.elapsed.max(now);
+        expired
+    }
+
+    /// The slot an entry due at `when` goes into at the current time
+    fn slot_for(&self, when: u64) -> usize {
+        let when = when.max(self.elapsed).min(self.elapsed + MAX_AHEAD);
+        let significant = 63 - ((self.elapsed ^ when) | (SLOTS as u64 - 1)).leading_zeros();
+        // a deadline parked at the very end may carry into a level past the last one
+        let level = ((significant / SLOT_BITS) as usize).min(LEVELS - 1);
+        let slot = (when >> (level as u32 * SLOT_BITS)) as usize & (SLOTS - 1);
+        level * SLOTS + slot
+    }
+
+    /// The next occupied slot and when it is due, which is in the lowest level that has one:
+    /// entries of a lower level are all due before the next slot of a higher one starts
+    fn next_slot(&self) -> Option<(usize, u64)> {
+        if self.len == 0 {
+            return None;
+        }
+        for level in 0..LEVELS {
+            let occupied = self.occupied[level];
+            if occupied == 0 {
+                continue;
+            }
+            let shift = level as u32 * SLOT_BITS;
+            let slot_span = 1u64 << shift;
+            let level_span = slot_span << SLOT_BITS;
+            let current = (self.elapsed >> shift) as usize & (SLOTS - 1);
+            // only the first level holds entries in the current slot, which are due now
+            let first = if level == 0 {
+                current
+            } else {
+                (current + 1) % SLOTS
+            };
+            let slot =
+                (occupied.rotate_right(first as u32).trailing_zeros() as usize + first) % SLOTS;
+            let mut due = (self.elapsed & !(level_span - 1)) + slot as u64 * slot_span;
+            if slot < current || (level > 0 && slot == current) {
+                due += level_span;
+            }
+            return Some((level * SLOTS + slot, due));
+        }
+        None
+    }
+
+    fn link(&mut self, index: u32) {
+        let slot = self.slot_for(self.entries[index as usize].when);
+        let head = self.heads[slot];
+        let entry = &mut self.entries[index as usize];
+        entry.slot = slot;
+        entry.prev = NIL;
+        entry.next = head;
+        if head != NIL {
+            self.entries[head as usize].prev = index;
+        }
+        self.heads[slot] = index;
+        self.occupied[slot / SLOTS] |= 1 << (slot % SLOTS);
+    }
+
+    fn unlink(&mut self, index: u32) {
+        let entry = &self.entries[index as usize];
+        let (slot, prev, next) = (entry.slot, entry.prev, entry.next);
+        if prev == NIL {
+            self.heads[slot] = next;
+        } else {
+            self.entries[prev as usize].next = next;
+        }
+        if next != NIL {
+            self.entries[next as usize].prev = prev;
+        }
+        if self.heads[slot] == NIL {
+            self.occupied[slot / SLOTS] &= !(1 << (slot % SLOTS));
+        }
+    }
+
+    /// Free an entry that is no longer linked, dropping its value
+    fn release(&mut self, index: u32) {
+        let entry = &mut self.entries[index as usize];
+        entry.generation = entry.generation.wrapping_add(1);
+        entry.stage = Stage::Free;
+        entry.value = None;
+        self.free.push(index);
+        self.len -= 1;
+    }
+}
+
+/// The time a `Scheduler` goes by, in milliseconds since the unix epoch
+pub(crate) trait Clock: Send + Sync + 'static {
+    /// The current time
+    fn now(&self) -> u64;
+}
+
+/// The wall clock, which delivery dates are given in
+pub(crate) struct SystemClock;
+
+impl Clock for SystemClock {
+    fn now(&self) -> u64 {
+        SystemTime::now()
+            .duration_since(UNIX_EPOCH)
+            .map_or(0, |since| since.as_millis() as u64)
+    }
+}
+
+struct State<T> {
+    wheel: TimerWheel<T>,
+    // when the thread wakes up by itself, `None` while it is awake
+    sleeping_until: Option<u64>,
+    stopped: bool,
+}
+
+struct Shared<T> {
+    state: Mutex<State<T>>,
+    changed: Condvar,
+    clock: Box<dyn Clock>,
+}
+
+/// A timing wheel with a thread that hands every entry to a callback once it is due
+///
+/// The thread stops once the scheduler is dropped, pending entries are dropped with it.
+pub(crate) struct Scheduler<T> {
+    shared: Arc<Shared<T>>,
+}
+
+impl<T: Send + 'static> Scheduler<T> {
+    /// Start the thread, which calls `deliver` with every entry once it is due and the
+    /// current time. The entry is due again at the time `deliver` returns, if any.
+    ///
+    /// Returns `None` if the thread could not be started.
+    pub(crate) fn spawn<C, F>(clock: C, deliver: F) -> Option<Self>
+    where
+        C: Clock,
+        F: FnMut(&mut T, u64) -> Option<u64> + Send + 'static,
+    {
+        let shared = Arc::new(Shared {
+            state: Mutex::new(State {
+                wheel: TimerWheel::new(clock.now()),
+                sleeping_until: None,
+                stopped: false,
+            }),
+            changed: Condvar::new(),
+            clock: Box::new(clock),
+        });
+        let running = Arc::clone(&shared);
+        thread::Builder::new()
+            .name("mac-notification-sys-schedule".into())
+            .spawn(move || run(&running, deliver))
+            .ok()?;
+        Some(Scheduler { shared })
+    }
+
+    /// Hand `value` to the callback at `when`, right away if that has passed
+    pub(crate) fn schedule(&self, when: u64, value: T) -> Key {
+        let mut state = self.shared.state.lock().unwrap();
+        let key = state.wheel.insert(when, value);
+        // the thread only needs to hear about entries due before it wakes up anyway
+        if matches!(state.sleeping_until, Some(until) if when < until) {
+            state.sleeping_until = None;
+            self.shared.changed.notify_one();
+        }
+        key
+    }
+
+    /// Drop an entry, so it is not handed to the callback again
+    ///
+    /// Returns the stage it was in, `Stage::Firing` while the callback is running for it.
+    pub(crate) fn cancel(&self, key: Key) -> Stage {
+        self.shared.state.lock().unwrap().wheel.cancel(key)
+    }
+
+    /// Whether the entry is still scheduled
+    pub(crate) fn is_pending(&self, key: Key) -> bool {
+        self.shared.state.lock().unwrap().wheel.contains(key)
+    }
+}
+
+impl<T> Drop for Scheduler<T> {
+    fn drop(&mut self) {
+        self.shared.state.lock().unwrap().stopped = true;
+        self.shared.changed.notify_one();
+    }
+}
+
+/// The scheduler thread: deliver what is due, then sleep until the wheel has something to do
+fn run<T, F: FnMut(&mut T, u64) -> Option<u64>>(shared: &Shared<T>, mut deliver: F) {
+    let mut state = shared.state.lock().unwrap();
+    while !state.stopped {
+        let now = shared.clock.now();
+        let due = state.wheel.expire(now);
+        if !due.is_empty() {
+            // the callback may take a while, schedule and cancel go on meanwhile
+            drop(state);
+            let settled: Vec<_> = due
+                .into_iter()
+                .map(|(key, mut value)| {
+                    let next = deliver(&mut value, now);
+                    (key, value, next)
+                })
+                .collect();
+            state = shared.state.lock().unwrap();
+            for (key, value, next) in settled {
+                state.wheel.settle(key, value, next);
+            }
+            continue;
+        }
+
+        let next = state.wheel.next_expiry();
+        state.sleeping_until = Some(next.unwrap_or(u64::MAX));
+        state = match next {
+            Some(next) => {
+                let timeout = Duration::from_millis(next - now).min(MAX_SLEEP);
+                shared.changed.wait_timeout(state, timeout).unwrap().0
+            }
+            None => shared.changed.wait(state).unwrap(),
+        };
+        state.sleeping_until = None;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::atomic::{AtomicU64, Ordering};
+    use std::sync::mpsc;
+
+    /// Deadlines spread over a year, from a linear congruential generator
+    fn deadlines(start: u64, count: usize) -> Vec<u64> {
+        let mut state = 0x2545_f491_4f6c_dd1d_u64;
+        (0..count)
+            .map(|_| {
+                state = state
+                    .wrapping_mul(6_364_136_223_846_793_005)
+                    .wrapping_add(1_442_695_040_888_963_407);
+                start + (state >> 33) % (365 * 24 * 3600 * 1000)
+            })
+            .collect()
+    }
+
+    /// Take out the entries due at `now` and drop them for good
+    fn expire_once(wheel: &mut TimerWheel<u64>, now: u64) -> Vec<u64> {
+        let due = wheel.expire(now);
+        for &(key, value) in &due {
+            wheel.settle(key, value, None);
+        }
+        due.into_iter().map(|(_, value)| value).collect()
+    }
+
+    /// Advance the wheel in irregular steps until `end`, checking every entry expires
+    /// on the first step that reached its deadline
+    fn expire_until(wheel: &mut TimerWheel<u64>, mut now: u64, end: u64, step: u64) -> Vec<u64> {
+        let mut expired = Vec::new();
+        let mut step_index = 0;
+        while now < end {
+            let previous = now;
+            step_index += 1;
+            now = (now + step * (step_index % 7 + 1)).min(end);
+            if let Some(next) = wheel.next_expiry() {
+                assert!(next > previous);
+            }
+            let due = expire_once(wheel, now);
+            assert!(due.windows(2).all(|pair| pair[0] <= pair[1]));
+            assert!(due.iter().all(|&when| previous < when && when <= now));
+            expired.extend(due);
+        }
+        expired
+    }
+
+    #[test]
+    fn entries_expire_when_due_across_levels() {
+        let start = 1_600_000_000_000;
+        let mut wheel = TimerWheel::new(start);
+        let offsets = [
+            0,
+            1,
+            63,
+            64,
+            65,
+            4_095,
+            4_096,
+            262_143,
+            262_144,
+            16_777_216,
+            1_073_741_824,
+            MAX_AHEAD,
+            MAX_AHEAD * 3,
+        ];
+        for &offset in offsets.iter().rev() {
+            wheel.insert(start + offset, start + offset);
+        }
+        wheel.insert(start - 5, start);
+        assert_eq!(wheel.len, offsets.len() + 1);
+
+        assert_eq!(wheel.next_expiry(), Some(start));
+        assert_eq!(expire_once(&mut wheel, start), vec![start, start]);
+        let end = start + MAX_AHEAD * 4;
+        let expired = expire_until(&mut wheel, start, start + 300_000, 1);
+        let expired: Vec<u64> = expired
+            .into_iter()
+            .chain(expire_until(&mut wheel, start + 300_000, end, 3_600_000))
+            .collect();
+        let expected: Vec<u64> = offsets[1..].iter().map(|offset| start + offset).collect();
+        assert_eq!(expired, expected);
+        assert_eq!((wheel.len, wheel.next_expiry()), (0, None));
+    }
+
+    #[test]
+    fn cancelled_entries_never_expire() {
+        let mut wheel = TimerWheel::new(0);
+        let first = wheel.insert(100, 100);
+        let second = wheel.insert(100, 101);
+        let far = wheel.insert(1_000_000, 1_000_000);
+        assert_eq!(wheel.cancel(first), Stage::Pending);
+        assert_eq!(wheel.cancel(first), Stage::Free);
+        assert!(!wheel.contains(first) && wheel.contains(second));
+
+        // the freed entry is reused, the old key does not match it
+        let reused = wheel.insert(200, 200);
+        assert_eq!(reused.index, first.index);
+        assert_eq!(wheel.cancel(first), Stage::Free);
+
+        assert_eq!(expire_once(&mut wheel, 150), vec![101]);
+        assert_eq!(wheel.cancel(second), Stage::Free);
+        assert_eq!(wheel.cancel(far), Stage::Pending);
+        assert_eq!(expire_once(&mut wheel, 2_000_000), vec![200]);
+        assert_eq!(wheel.len, 0);
+    }
+
+    #[test]
+    fn firing_entries_are_put_back_under_their_key() {
+        let mut wheel = TimerWheel::new(0);
+        let key = wheel.insert(10, 1);
+        let due = wheel.expire(10);
+        assert_eq!(due, vec![(key, 1)]);
+        assert!(wheel.contains(key));
+        assert_eq!(wheel.next_expiry(), None);
+
+        wheel.settle(key, 2, Some(5_000));
+        assert!(wheel.expire(4_999).is_empty());
+        assert_eq!(wheel.expire(5_000), vec![(key, 2)]);
+        // an entry due in the past is due on the next expiry
+        wheel.settle(key, 3, Some(0));
+        assert_eq!(wheel.expire(5_000), vec![(key, 3)]);
+
+        // cancelling while firing wins over putting it back
+        assert_eq!(wheel.cancel(key), Stage::Firing);
+        assert_eq!(wheel.cancel(key), Stage::Cancelled);
+        wheel.settle(key, 4, Some(6_000));
+        assert!(!wheel.contains(key));
+        assert_eq!(wheel.cancel(key), Stage::Free);
+        assert_eq!((wheel.len, wheel.next_expiry()), (0, None));
+        assert!(wheel.expire(10_000).is_empty());
+    }
+
+    #[test]
+    fn hundred_thousand_pending_entries() {
+        let start = 1_600_000_000_000;
+        let mut wheel = TimerWheel::new(start);
+        let deadlines = deadlines(start + 1, 100_000);
+        let keys: Vec<Key> = deadlines
+            .iter()
+            .map(|&when| wheel.insert(when, when))
+            .collect();
+        for key in keys.iter().step_by(3) {
+            assert_eq!(wheel.cancel(*key), Stage::Pending);
+        }
+        let mut expected: Vec<u64> = deadlines
+            .iter()
+            .enumerate()
+            .filter(|(index, _)| index % 3 != 0)
+            .map(|(_, &when)| when)
+            .collect();
+        expected.sort();
+        assert_eq!(wheel.len, expected.len());
+
+        let end = start + 366 * 24 * 3600 * 1000;
+        assert_eq!(expire_until(&mut wheel, start, end, 60_000), expected);
+        assert_eq!(wheel.len, 0);
+    }
+
+    /// A clock that only moves when told to
+    #[derive(Clone, Default)]
+    struct VirtualClock(Arc<AtomicU64>);
+
+    impl<T> Scheduler<T> {
+        /// Have the thread look at the virtual clock again
+        fn wake(&self) {
+            self.shared.state.lock().unwrap().sleeping_until = None;
+            self.shared.changed.notify_one();
+        }
+    }
+
+    impl Clock for VirtualClock {
+        fn now(&self) -> u64 {
+            self.0.load(Ordering::SeqCst)
+        }
+    }
+
+    #[test]
+    fn scheduler_delivers_when_the_clock_reaches_the_deadline() {
+        let clock = VirtualClock::default();
+        clock.0.store(1_000, Ordering::SeqCst);
+        let (delivered, inbox) = mpsc::channel();
+        // entries are a name and the interval they repeat at, if any
+        let scheduler = Scheduler::spawn(clock.clone(), move |entry: &mut (&str, u64), now| {
+            delivered.send(entry.0).unwrap();
+            Some(now + entry.1).filter(|_| entry.1 > 0)
+        })
+        .unwrap();
+        let quiet = || inbox.recv_timeout(Duration::from_millis(20)).is_err();
+
+        scheduler.schedule(61_000, ("later", 0));
+        let cancelled = scheduler.schedule(2_000, ("cancelled", 0));
+        scheduler.schedule(1_500, ("soon", 0));
+        assert!(quiet());
+
+        let set = |now: u64| {
+            clock.0.store(now, Ordering::SeqCst);
+            scheduler.wake();
+        };
+        set(1_499);
+        assert!(quiet());
+        set(1_500);
+        assert_eq!(inbox.recv_timeout(Duration::from_secs(5)), Ok("soon"));
+        assert_eq!(scheduler.cancel(cancelled), Stage::Pending);
+        assert!(!scheduler.is_pending(cancelled));
+        set(100_000);
+        assert_eq!(inbox.recv_timeout(Duration::from_secs(5)), Ok("later"));
+        assert!(quiet());
+        assert_eq!(scheduler.shared.state.lock().unwrap().wheel.len, 0);
+
+        scheduler.schedule(0, ("overdue", 0));
+        assert_eq!(inbox.recv_timeout(Duration::from_secs(5)), Ok("overdue"));
+
+        let repeating = scheduler.schedule(200_000, ("repeating", 1_000));
+        set(200_000);
+        assert_eq!(inbox.recv_timeout(Duration::from_secs(5)), Ok("repeating"));
+        set(200_999);
+        assert!(quiet() && scheduler.is_pending(repeating));
+        set(201_000);
+        assert_eq!(inbox.recv_timeout(Duration::from_secs(5)), Ok("repeating"));
+        // the callback may not have returned yet
+        assert!(matches!(
+            scheduler.cancel(repeating),
+            Stage::Pending | Stage::Firing
+        ));
+        set(300_000);
+        assert!(quiet() && !scheduler.is_pending(repeating));
+    }
+}
@@ -0,0 +1,436 @@
+//! A notification center owned by a single thread.
+//!
+//! The owner thread runs the event loop the center's callbacks arrive on and executes
+//! commands sent by any number of other threads. Callers get their handles right away
+//! and never touch the center themselves.
+//!
+//! The owner thread also gives up on responses on behalf of their senders: it wakes up for the
+//! earliest deadline and whenever a cancel handle of a notification is cancelled, so a sender
+//! that only awaits the waiter needs no timer of its own.
+
+use crate::batch::GaveUp;
+use crate::cancel::{CancelHandle, Watch};
+use crate::wait::{EventLoop, Waiter};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::mpsc::{self, Receiver, Sender};
+use std::sync::Arc;
+use std::thread;
+use std::time::Instant;
+
+/// The notification center driven by the owner thread
+pub(crate) trait Center {
+    /// A notification, prepared on the calling thread
+    type Notification: Send + 'static;
+    /// What the waiter of a notification is completed with
+    type Response: Send + 'static;
+
+    /// The event loop the center delivers its callbacks on
+    fn event_loop(&self) -> Arc<dyn EventLoop>;
+
+    /// Deliver the notification under the given id, replacing a previous one with the same id.
+    ///
+    /// Without a waiter the waiter of the replaced notification is kept.
+    fn deliver(
+        &mut self,
+        id: u64,
+        notification: Self::Notification,
+        waiter: Option<Arc<Waiter<Self::Response>>>,
+    );
+
+    /// Remove the notification with the given id, whether it was delivered or is still scheduled
+    fn remove(&mut self, id: u64);
+
+    /// Ids of the notifications currently shown
+    fn delivered(&mut self) -> Vec<u64>;
+
+    /// What the waiter of a notification is completed with once the owner thread gave up on it
+    fn gave_up(&self, reason: GaveUp) -> Self::Response;
+}
+
+/// How long the owner thread waits for the response to a notification
+#[derive(Default)]
+pub(crate) struct Patience {
+    /// When the response times out, `None` waits until the user responds
+    pub(crate) deadline: Option<Instant>,
+    /// Whether a notification that timed out is removed, cancelled ones always are
+    pub(crate) remove_on_timeout: bool,
+    pub(crate) cancel: Option<CancelHandle>,
+}
+
+/// A response the owner thread gives up on once its deadline passed or it was cancelled
+struct Outstanding<R> {
+    id: u64,
+    waiter: Arc<Waiter<R>>,
+    deadline: Option<Instant>,
+    remove_on_timeout: bool,
+    // wakes the owner thread on cancellation for as long as the response is outstanding
+    cancel: Option<(CancelHandle, Watch)>,
+}
+
+enum Command<N, R> {
+    Deliver {
+        id: u64,
+        notification: N,
+        waiter: Option<Arc<Waiter<R>>>,
+        patience: Patience,
+    },
+    Remove(u64),
+    Delivered(Sender<Vec<u64>>),
+}
+
+/// Handle to the owner thread, can be cloned and shared between threads.
+///
+/// The owner thread stops once every handle was dropped.
+pub(crate) struct Service<N, R> {
+    commands: Sender<Command<N, R>>,
+    event_loop: Arc<dyn EventLoop>,
+    next_id: Arc<AtomicU64>,
+}
+
+impl<N, R> Clone for Service<N, R> {
+    fn clone(&self) -> Self {
+        Service {
+            commands: self.commands.clone(),
+            event_loop: Arc::clone(&self.event_loop),
+            next_id: Arc::clone(&self.next_id),
+        }
+    }
+}
+
+impl<N: Send + 'static, R: Send + 'static> Service<N, R> {
+    /// Start the owner thread, which creates the center with `make_center`.
+    ///
+    /// Returns `None` if the center could not be created.
+    pub(crate) fn spawn<C, F>(make_center: F) -> Option<Self>
+    where
+        C: Center<Notification = N, Response = R>,
+        F: FnOnce() -> Option<C> + Send + 'static,
+    {
+        let (commands, inbox) = mpsc::channel();
+        let (started, on_start) = mpsc::channel();
+        thread::Builder::new()
+            .name("mac-notification-sys".into())
+            .spawn(move || match make_center() {
+                Some(center) => {
+                    let _ = started.send(Some(center.event_loop()));
+                    run(center, inbox);
+                }
+                None => {
+                    let _ = started.send(None);
+                }
+            })
+            .ok()?;
+
+        let event_loop = on_start.recv().ok()??;
+        Some(Service {
+            commands,
+            event_loop,
+            next_id: Arc::new(AtomicU64::new(1)),
+        })
+    }
+
+    /// Deliver a notification, returns its id. The waiter is completed with the response,
+    /// or with what the center gives for giving up once the patience ran out.
+    pub(crate) fn send(
+        &self,
+        notification: N,
+        waiter: Arc<Waiter<R>>,
+        patience: Patience,
+    ) -> Option<u64> {
+        let id = self.next_id.fetch_add(1, Ordering::Relaxed);
+        self.command(Command::Deliver {
+            id,
+            notification,
+            waiter: Some(waiter),
+            patience,
+        })?;
+        Some(id)
+    }
+
+    /// Replace the notification with the given id, its waiter stays the same
+    pub(crate) fn update(&self, id: u64, notification: N) -> Option<()> {
+        self.command(Command::Deliver {
+            id,
+            notification,
+            waiter: None,
+            patience: Patience::default(),
+        })
+    }
+
+    /// Remove the notification with the given id
+    pub(crate) fn remove(&self, id: u64) -> Option<()> {
+        self.command(Command::Remove(id))
+    }
+
+    /// Ids of the notifications currently shown, waits for the owner thread to answer
+    pub(crate) fn delivered(&self) -> Option<Vec<u64>> {
+        let (reply, answer) = mpsc::channel();
+        self.command(Command::Delivered(reply))?;
+        answer.recv().ok()
+    }
+
+    fn command(&self, command: Command<N, R>) -> Option<()> {
+        self.commands.send(command).ok()?;
+        self.event_loop.wake();
+        Some(())
+    }
+}
+
+/// The owner thread: execute all queued commands, give up on the responses whose patience ran
+/// out, then run the event loop until woken or the next deadline
+fn run<C: Center>(mut center: C, inbox: Receiver<Command<C::Notification, C::Response>>) {
+    let event_loop = center.event_loop();
+    let mut outstanding: Vec<Outstanding<C::Response>> = Vec::new();
+    loop {
+        loop {
+            match inbox.try_recv() {
+                Ok(Command::Deliver {
+                    id,
+                    notification,
+                    waiter,
+                    patience,
+                }) => {
+                    if let Some(waiter) = &waiter {
+                        if patience.deadline.is_some() || patience.cancel.is_some() {
+                            outstanding.push(Outstanding {
+                                id,
+                                waiter: Arc::clone(waiter),
+                                deadline: patience.deadline,
+                                remove_on_timeout: patience.remove_on_timeout,
+                                cancel: patience.cancel.map(|cancel| {
+                                    let watch = cancel.watch(&event_loop);
+                                    (cancel, watch)
+                                }),
+                            });
+                        }
+                    }
+                    center.deliver(id, notification, waiter);
+                }
+                Ok(Command::Remove(id)) => center.remove(id),
+                Ok(Command::Delivered(reply)) => {
+                    let _ = reply.send(center.delivered());
+                }
+                Err(mpsc::TryRecvError::Empty) => break,
+                Err(mpsc::TryRecvError::Disconnected) => return,
+            }
+        }
+
+        let now = Instant::now();
+        outstanding.retain(|response| {
+            if response.waiter.is_complete() {
+                return false;
+            }
+            let reason = match (&response.cancel, response.deadline) {
+                (Some((cancel, _)), _) if cancel.is_cancelled() => GaveUp::Cancelled,
+                (_, Some(deadline)) if deadline <= now => GaveUp::TimedOut,
+                _ => return true,
+            };
+            // completed first, so the removal does not answer the sender instead
+            response.waiter.complete(center.gave_up(reason));
+            if reason == GaveUp::Cancelled || response.remove_on_timeout {
+                center.remove(response.id);
+            }
+            false
+        });
+        let timeout = outstanding
+            .iter()
+            .filter_map(|response| response.deadline)
+            .min()
+            .map(|deadline| deadline.saturating_duration_since(now));
+        event_loop.run_once(timeout);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::wait::Parker;
+    use std::collections::HashMap;
+    use std::sync::Mutex;
+    use std::thread::ThreadId;
+    use std::time::Duration;
+
+    type Shown = Arc<Mutex<HashMap<u64, (&'static str, Arc<Waiter<&'static str>>)>>>;
+
+    /// Shows notifications in a map and records the thread it was called on
+    struct MockCenter {
+        event_loop: Arc<Parker>,
+        shown: Shown,
+        threads: Arc<Mutex<Vec<ThreadId>>>,
+    }
+
+    impl Center for MockCenter {
+        type Notification = &'static str;
+        type Response = &'static str;
+
+        fn event_loop(&self) -> Arc<dyn EventLoop> {
+            self.event_loop.clone()
+        }
+
+        fn deliver(
+            &mut self,
+            id: u64,
+            notification: &'static str,
+            waiter: Option<Arc<Waiter<&'static str>>>,
+        ) {
+            self.threads.lock().unwrap().push(thread::current().id());
+            let mut shown = self.shown.lock().unwrap();
+            let waiter = match waiter {
+                Some(waiter) => waiter,
+                None => shown[&id].1.clone(),
+            };
+            shown.insert(id, (notification, waiter));
+        }
+
+        fn remove(&mut self, id: u64) {
+            if let Some((_, waiter)) = self.shown.lock().unwrap().remove(&id) {
+                waiter.complete("removed");
+            }
+        }
+
+        fn delivered(&mut self) -> Vec<u64> {
+            let mut ids: Vec<u64> = self.shown.lock().unwrap().keys().cloned().collect();
+            ids.sort();
+            ids
+        }
+
+        fn gave_up(&self, reason: GaveUp) -> &'static str {
+            match reason {
+                GaveUp::TimedOut => "timed out",
+                GaveUp::Cancelled => "cancelled",
+            }
+        }
+    }
+
+    fn spawn_mock() -> (
+        Service<&'static str, &'static str>,
+        Shown,
+        Arc<Mutex<Vec<ThreadId>>>,
+    ) {
+        let shown = Shown::default();
+        let threads = Arc::new(Mutex::new(Vec::new()));
+        let center = MockCenter {
+            event_loop: Arc::new(Parker::default()),
+            shown: shown.clone(),
+            threads: threads.clone(),
+        };
+        let service = Service::spawn(move || Some(center)).unwrap();
+        (service, shown, threads)
+    }
+
+    fn parked_waiter() -> Arc<Waiter<&'static str>> {
+        Arc::new(Waiter::new(Arc::new(Parker::default())))
+    }
+
+    #[test]
+    fn commands_run_on_owner_thread() {
+        let (service, _, threads) = spawn_mock();
+        let senders: Vec<_> = (0..4)
+            .map(|_| {
+                let service = service.clone();
+                thread::spawn(move || {
+                    for _ in 0..25 {
+                        service
+                            .send("hello", parked_waiter(), Patience::default())
+                            .unwrap();
+                    }
+                })
+            })
+            .collect();
+        for sender in senders {
+            sender.join().unwrap();
+        }
+
+        assert_eq!(
+            service.delivered().unwrap(),
+            (1..=100).collect::<Vec<u64>>()
+        );
+        let threads = threads.lock().unwrap();
+        assert_eq!(threads.len(), 100);
+        assert!(threads.iter().all(|id| *id == threads[0]));
+        assert_ne!(threads[0], thread::current().id());
+    }
+
+    #[test]
+    fn update_keeps_waiter_and_remove_completes_it() {
+        let (service, shown, _) = spawn_mock();
+        let waiter = parked_waiter();
+        let id = service
+            .send("first", waiter.clone(), Patience::default())
+            .unwrap();
+        service.update(id, "second").unwrap();
+        assert_eq!(service.delivered().unwrap(), vec![id]);
+        assert_eq!(shown.lock().unwrap()[&id].0, "second");
+
+        service.remove(id).unwrap();
+        assert_eq!(waiter.wait(None), Some("removed"));
+        assert!(service.delivered().unwrap().is_empty());
+    }
+
+    #[test]
+    fn owner_thread_gives_up_on_timed_out_and_cancelled_responses() {
+        let (service, _, _) = spawn_mock();
+        let patient = parked_waiter();
+        service
+            .send("patient", patient.clone(), Patience::default())
+            .unwrap();
+        let timed_out = parked_waiter();
+        let deadline = Instant::now() + Duration::from_millis(20);
+        let kept = service
+            .send(
+                "kept",
+                timed_out.clone(),
+                Patience {
+                    deadline: Some(deadline),
+                    ..Patience::default()
+                },
+            )
+            .unwrap();
+        assert_eq!(timed_out.wait(None), Some("timed out"));
+        assert!(Instant::now() >= deadline);
+
+        let cancel = CancelHandle::new();
+        let cancelled = parked_waiter();
+        let removed = service
+            .send(
+                "removed",
+                cancelled.clone(),
+                Patience {
+                    cancel: Some(cancel.clone()),
+                    ..Patience::default()
+                },
+            )
+            .unwrap();
+        thread::sleep(Duration::from_millis(5));
+        cancel.cancel();
+        assert_eq!(cancelled.wait(None), Some("cancelled"));
+
+        // only cancelled responses, or those that ask for it, are taken off the screen
+        let delivered = service.delivered().unwrap();
+        assert!(delivered.contains(&kept) && !delivered.contains(&removed));
+        assert!(!patient.is_complete());
+    }
+
+    #[test]
+    fn failing_center_does_not_start() {
+        assert!(Service::<(), ()>::spawn(|| None::<UnitCenter>).is_none());
+    }
+
+    /// Center that never gets created
+    struct UnitCenter;
+
+    impl Center for UnitCenter {
+        type Notification = ();
+        type Response = ();
+
+        fn event_loop(&self) -> Arc<dyn EventLoop> {
+            Arc::new(Parker::default())
+        }
+        fn deliver(&mut self, _: u64, _: (), _: Option<Arc<Waiter<()>>>) {}
+        fn remove(&mut self, _: u64) {}
+        fn delivered(&mut self) -> Vec<u64> {
+            Vec::new()
+        }
+        fn gave_up(&self, _: GaveUp) {}
+    }
+}
@@ -0,0 +1,302 @@
+//! Catalog of the system sounds a notification can play.
+//!
+//! The sound directories are scanned once and the names of their sounds kept in a map, under
+//! their lowercase name as macOS finds sounds regardless of case. Sends look sounds up in the
+//! map instead of probing the file system. The directories are
+//! scanned again only once one of their modification times changed, which is checked at most
+//! once per recheck interval.
+
+use std::collections::HashMap;
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::sync::Arc;
+use std::time::{Duration, Instant, SystemTime};
+
+/// File extension of the sounds a notification can play
+const SOUND_EXTENSION: &str = "aiff";
+
+/// How often the modification times of the sound directories are checked at most
+const RECHECK_INTERVAL: Duration = Duration::from_secs(1);
+
+/// Modification times this close to a scan are not trusted, as the file system may not tell
+/// apart a change in the same tick
+const RACY_INTERVAL: Duration = Duration::from_secs(1);
+
+/// The sounds found in the sound directories, see `available_sounds`
+///
+/// A snapshot of the catalog, it does not change once taken.
+#[derive(Clone, Debug, Default)]
+pub struct AvailableSounds {
+    // the lowercase names to the names of the files
+    names: Arc<HashMap<String, String>>,
+}
+
+impl AvailableSounds {
+    /// Whether there is a sound with the given name, as it is passed to [`Notification::sound`],
+    /// ignoring case
+    ///
+    /// [`Notification::sound`]: crate::Notification::sound
+    pub fn contains(&self, name: &str) -> bool {
+        self.names.contains_key(&name.to_lowercase())
+    }
+
+    /// The names of all sounds, in no particular order
+    pub fn iter(&self) -> impl Iterator<Item = &str> {
+        self.names.values().map(String::as_str)
+    }
+
+    /// Number of sounds
+    pub fn len(&self) -> usize {
+        self.names.len()
+    }
+
+    /// Whether no sounds were found
+    pub fn is_empty(&self) -> bool {
+        self.names.is_empty()
+    }
+}
+
+/// A sound directory as it was when it was scanned
+struct Dir {
+    path: PathBuf,
+    // `None` if the directory did not exist
+    modified: Option<SystemTime>,
+}
+
+impl Dir {
+    fn modified(path: &Path) -> Option<SystemTime> {
+        fs::metadata(path)
+            .and_then(|metadata| metadata.modified())
+            .ok()
+    }
+}
+
+/// The sounds in a list of directories, scanned again when one of the directories changes
+pub(crate) struct SoundCatalog {
+    dirs: Vec<Dir>,
+    sounds: AvailableSounds,
+    // `None` until the first scan, and after a scan that may have missed a change
+    checked: Option<Instant>,
+    recheck: Duration,
+    racy: Duration,
+    scans: u64,
+}
+
+impl SoundCatalog {
+    /// Create a catalog of the sounds in `dirs`, which is scanned on first use
+    pub(crate) fn new(dirs: Vec<PathBuf>) -> Self {
+        SoundCatalog {
+            dirs: dirs
+                .into_iter()
+                .map(|path| Dir {
+                    path,
+                    modified: None,
+                })
+                .collect(),
+            sounds: AvailableSounds::default(),
+            checked: None,
+            recheck: RECHECK_INTERVAL,
+            racy: RACY_INTERVAL,
+            scans: 0,
+        }
+    }
+
+    /// The sounds in the directories, scanned again if a directory changed since the last scan
+    pub(crate) fn sounds(&mut self) -> AvailableSounds {
+        let due = match self.checked {
+            Some(checked) => checked.elapsed() >= self.recheck,
+            None => true,
+        };
+        if due {
+            let changed = self.checked.is_none()
+                || self
+                    .dirs
+                    .iter()
+                    .any(|dir| Dir::modified(&dir.path) != dir.modified);
+            if changed {
+                self.scan();
+            } else {
+                self.checked = Some(Instant::now());
+            }
+        }
+        self.sounds.clone()
+    }
+
+    fn scan(&mut self) {
+        let started = SystemTime::now();
+        let mut names = HashMap::new();
+        for dir in &mut self.dirs {
+            dir.modified = Dir::modified(&dir.path);
+            let entries = match fs::read_dir(&dir.path) {
+                Ok(entries) => entries,
+                Err(_) => continue,
+            };
+            for entry in entries.filter_map(Result::ok) {
+                if matches!(entry.file_type(), Ok(file_type) if file_type.is_dir()) {
+                    continue;
+                }
+                let path = entry.path();
+                if path.extension().and_then(|extension| extension.to_str())
+                    != Some(SOUND_EXTENSION)
+                {
+                    continue;
+                }
+                // the first directory with a sound of a name wins, as it does for macOS
+                if let Some(name) = path.file_stem().and_then(|name| name.to_str()) {
+                    names
+                        .entry(name.to_lowercase())
+                        .or_insert_with(|| name.to_owned());
+                }
+            }
+        }
+        self.sounds = AvailableSounds {
+            names: Arc::new(names),
+        };
+        self.scans += 1;
+
+        // a directory changed right around the scan may change again without a new time
+        let racy = self.racy;
+        let settled = self.dirs.iter().all(|dir| match dir.modified {
+            Some(modified) => matches!(started.duration_since(modified), Ok(age) if age >= racy),
+            None => true,
+        });
+        self.checked = if settled { Some(Instant::now()) } else { None };
+    }
+}
+
+/// The directories macOS looks for sounds in, the user's own first
+pub(crate) fn sound_dirs() -> Vec<PathBuf> {
+    dirs_next::home_dir()
+        .map(|home| home.join("Library/Sounds"))
+        .into_iter()
+        .chain(
+            [
+                "/Library/Sounds",
+                "/Network/Library/Sounds",
+                "/System/Library/Sounds",
+            ]
+            .iter()
+            .map(PathBuf::from),
+        )
+        .collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::env;
+    use std::process;
+    use std::thread;
+
+    fn temp_dir(name: &str) -> PathBuf {
+        let dir = env::temp_dir().join(format!("mac-notification-sys-{}-{}", name, process::id()));
+        let _ = fs::remove_dir_all(&dir);
+        fs::create_dir_all(&dir).unwrap();
+        dir
+    }
+
+    fn catalog(dirs: Vec<PathBuf>) -> SoundCatalog {
+        let mut catalog = SoundCatalog::new(dirs);
+        catalog.recheck = Duration::from_secs(0);
+        catalog.racy = Duration::from_secs(0);
+        catalog
+    }
+
+    /// Let the next change of a directory get a new modification time,
+    /// which can take a timer tick of the file system
+    fn settle() {
+        thread::sleep(Duration::from_millis(20));
+    }
+
+    #[test]
+    fn finds_sounds_in_all_directories() {
+        let dir = temp_dir("sounds-all");
+        let (user, system) = (dir.join("user"), dir.join("system"));
+        fs::create_dir_all(&user).unwrap();
+        fs::create_dir_all(system.join("Nested.aiff")).unwrap();
+        fs::write(user.join("Mine.aiff"), "").unwrap();
+        fs::write(user.join("README.txt"), "").unwrap();
+        fs::write(system.join("Blow.aiff"), "").unwrap();
+
+        let mut catalog = catalog(vec![user, dir.join("missing"), system]);
+        let sounds = catalog.sounds();
+        let mut names: Vec<&str> = sounds.iter().collect();
+        names.sort();
+        assert_eq!(names, ["Blow", "Mine"]);
+        assert!(sounds.contains("Blow"));
+        assert!(!sounds.contains("README"));
+
+        let home = dirs_next::home_dir().map(|home| home.join("Library/Sounds"));
+        if let Some(home) = home {
+            assert_eq!(sound_dirs()[0], home);
+        }
+        fs::remove_dir_all(dir).unwrap();
+    }
+
+    #[test]
+    fn sound_names_ignore_case() {
+        let dir = temp_dir("sounds-case");
+        let (user, system) = (dir.join("user"), dir.join("system"));
+        fs::create_dir_all(&user).unwrap();
+        fs::create_dir_all(&system).unwrap();
+        fs::write(user.join("glass.aiff"), "").unwrap();
+        fs::write(system.join("Glass.aiff"), "").unwrap();
+        fs::write(system.join("Blow.aiff"), "").unwrap();
+
+        let sounds = catalog(vec![user, system]).sounds();
+        assert!(sounds.contains("blow") && sounds.contains("BLOW") && sounds.contains("Blow"));
+        assert!(sounds.contains("Glass"));
+        let mut names: Vec<&str> = sounds.iter().collect();
+        names.sort();
+        assert_eq!(names, ["Blow", "glass"]);
+        fs::remove_dir_all(dir).unwrap();
+    }
+
+    #[test]
+    fn rescans_only_when_a_directory_changes() {
+        let dir = temp_dir("sounds-rescan");
+        let (sounds, missing) = (dir.join("sounds"), dir.join("missing"));
+        fs::create_dir_all(&sounds).unwrap();
+        fs::write(sounds.join("Blow.aiff"), "").unwrap();
+        let mut catalog = catalog(vec![sounds.clone(), missing.clone()]);
+        settle();
+
+        assert!(catalog.sounds().contains("Blow"));
+        assert!(catalog.sounds().contains("Blow"));
+        assert_eq!(catalog.scans, 1);
+
+        fs::remove_file(sounds.join("Blow.aiff")).unwrap();
+        fs::write(sounds.join("Glass.aiff"), "").unwrap();
+        let changed = catalog.sounds();
+        assert!(!changed.contains("Blow") && changed.contains("Glass"));
+        assert_eq!(catalog.scans, 2);
+        settle();
+
+        fs::create_dir_all(&missing).unwrap();
+        fs::write(missing.join("Ping.aiff"), "").unwrap();
+        assert!(catalog.sounds().contains("Ping"));
+        assert_eq!(catalog.scans, 3);
+        fs::remove_dir_all(dir).unwrap();
+    }
+
+    #[test]
+    fn waits_for_the_recheck_interval_and_settled_directories() {
+        let dir = temp_dir("sounds-recheck");
+        fs::write(dir.join("Blow.aiff"), "").unwrap();
+        let mut catalog = catalog(vec![dir.clone()]);
+        catalog.recheck = Duration::from_secs(3600);
+
+        assert!(catalog.sounds().contains("Blow"));
+        fs::write(dir.join("Glass.aiff"), "").unwrap();
+        assert!(!catalog.sounds().contains("Glass"));
+        assert_eq!(catalog.scans, 1);
+
+        // a directory changed just before the scan is scanned again on the next use
+        catalog.racy = Duration::from_secs(3600);
+        catalog.checked = None;
+        assert!(catalog.sounds().contains("Glass"));
+        assert!(catalog.sounds().contains("Glass"));
+        assert_eq!(catalog.scans, 3);
+        fs::remove_dir_all(dir).unwrap();
+    }
+}
@@ -0,0 +1,281 @@
+//! Event-driven waiting for notification center callbacks.
+//!
+//! The thread that needs an answer from the notification center runs its event loop
+//! until a `Waiter` is completed. Completion comes straight from the delegate callbacks,
+//! which wake the event loop instead of having the waiting thread poll it.
+//! Asynchronous senders await a `WaitFuture` instead, which is woken the same way.
+
+use std::future::Future;
+use std::pin::Pin;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Arc, Condvar, Mutex};
+use std::task::{Context, Poll, Waker};
+use std::time::{Duration, Instant};
+
+/// An event loop that is run by the waiting thread and can be woken from any thread.
+pub trait EventLoop: Send + Sync {
+    /// Run the loop until it handled an event, was woken or `timeout` elapsed
+    fn run_once(&self, timeout: Option<Duration>);
+
+    /// Wake up a thread blocked in `run_once`
+    fn wake(&self);
+}
+
+/// Event loop for threads that have nothing to do but wait, blocks on a condition variable
+#[derive(Default)]
+pub struct Parker {
+    woken: Mutex<bool>,
+    condvar: Condvar,
+}
+
+impl EventLoop for Parker {
+    fn run_once(&self, timeout: Option<Duration>) {
+        let mut woken = self.woken.lock().unwrap();
+        if !*woken {
+            woken = match timeout {
+                Some(timeout) => self.condvar.wait_timeout(woken, timeout).unwrap().0,
+                None => self.condvar.wait(woken).unwrap(),
+            };
+        }
+        *woken = false;
+    }
+
+    fn wake(&self) {
+        *self.woken.lock().unwrap() = true;
+        self.condvar.notify_all();
+    }
+}
+
+struct Slot<T> {
+    value: Option<T>,
+    waker: Option<Waker>,
+}
+
+/// Single-use slot that is completed by a delegate callback and waited on by the sender.
+pub struct Waiter<T> {
+    event_loop: Option<Arc<dyn EventLoop>>,
+    done: AtomicBool,
+    slot: Mutex<Slot<T>>,
+}
+
+impl<T> Waiter<T> {
+    /// Create a Waiter that runs the given event loop while waiting
+    pub fn new(event_loop: Arc<dyn EventLoop>) -> Self {
+        Self::with_event_loop(Some(event_loop))
+    }
+
+    /// Create a Waiter that is only awaited through a `WaitFuture`
+    pub(crate) fn new_async() -> Self {
+        Self::with_event_loop(None)
+    }
+
+    fn with_event_loop(event_loop: Option<Arc<dyn EventLoop>>) -> Self {
+        Waiter {
+            event_loop,
+            done: AtomicBool::new(false),
+            slot: Mutex::new(Slot {
+                value: None,
+                waker: None,
+            }),
+        }
+    }
+
+    /// Hand the value to the waiting thread or task and wake it up.
+    ///
+    /// Only the first completion counts, later ones are dropped.
+    pub fn complete(&self, value: T) {
+        let waker = {
+            let mut slot = self.slot.lock().unwrap();
+            if self.done.load(Ordering::Acquire) {
+                return;
+            }
+            slot.value = Some(value);
+            self.done.store(true, Ordering::Release);
+            slot.waker.take()
+        };
+        if let Some(waker) = waker {
+            waker.wake();
+        }
+        if let Some(event_loop) = &self.event_loop {
+            event_loop.wake();
+        }
+    }
+
+    /// Whether `complete` has been called
+    pub(crate) fn is_complete(&self) -> bool {
+        self.done.load(Ordering::Acquire)
+    }
+
+    /// The event loop that is run while waiting, `None` for Waiters that are only awaited
+    pub(crate) fn event_loop(&self) -> Option<&Arc<dyn EventLoop>> {
+        self.event_loop.as_ref()
+    }
+
+    /// Run the event loop until the Waiter is completed or the deadline has passed.
+    ///
+    /// Returns `None` if the deadline passed first.
+    pub fn wait(&self, deadline: Option<Instant>) -> Option<T> {
+        self.wait_unless(deadline, || false)
+    }
+
+    /// Like `wait`, but also gives up once `stop` returns true after the event loop was woken
+    pub(crate) fn wait_unless<F: Fn() -> bool>(
+        &self,
+        deadline: Option<Instant>,
+        stop: F,
+    ) -> Option<T> {
+        while !self.is_complete() {
+            if stop() {
+                return None;
+            }
+            let timeout = match deadline {
+                Some(deadline) => {
+                    let now = Instant::now();
+                    if now >= deadline {
+                        return None;
+                    }
+                    Some(deadline - now)
+                }
+                None => None,
+            };
+            match &self.event_loop {
+                Some(event_loop) => event_loop.run_once(timeout),
+                None => return None,
+            }
+        }
+        self.slot.lock().unwrap().value.take()
+    }
+
+    /// Take the value if completed, otherwise register the waker to be woken by `complete`
+    fn poll_value(&self, waker: &Waker) -> Poll<Option<T>> {
+        let mut slot = self.slot.lock().unwrap();
+        if self.is_complete() {
+            Poll::Ready(slot.value.take())
+        } else {
+            slot.waker = Some(waker.clone());
+            Poll::Pending
+        }
+    }
+}
+
+/// Future that resolves once a Waiter was completed
+pub(crate) struct WaitFuture<T> {
+    waiter: Option<Arc<Waiter<T>>>,
+}
+
+impl<T> WaitFuture<T> {
+    /// Wait for the given Waiter
+    pub(crate) fn new(waiter: Arc<Waiter<T>>) -> Self {
+        WaitFuture {
+            waiter: Some(waiter),
+        }
+    }
+
+    /// A future that resolves to `None` right away, for notifications nobody waits on
+    pub(crate) fn ready() -> Self {
+        WaitFuture { waiter: None }
+    }
+}
+
+impl<T> Future for WaitFuture<T> {
+    type Output = Option<T>;
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context) -> Poll<Self::Output> {
+        match &self.waiter {
+            Some(waiter) => waiter.poll_value(cx.waker()),
+            None => Poll::Ready(None),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::task::{RawWaker, RawWakerVTable};
+    use std::thread;
+
+    fn fake_loop() -> Arc<dyn EventLoop> {
+        Arc::new(Parker::default())
+    }
+
+    /// Minimal executor, parks the thread until the future's waker unparks it
+    fn block_on<F: Future>(future: F) -> F::Output {
+        fn clone(thread: *const ()) -> RawWaker {
+            let thread = unsafe { Arc::from_raw(thread as *const thread::Thread) };
+            let cloned = Arc::clone(&thread);
+            std::mem::forget(thread);
+            RawWaker::new(Arc::into_raw(cloned) as *const (), &VTABLE)
+        }
+        fn wake(thread: *const ()) {
+            unsafe { Arc::from_raw(thread as *const thread::Thread) }.unpark();
+        }
+        fn wake_by_ref(thread: *const ()) {
+            unsafe { &*(thread as *const thread::Thread) }.unpark();
+        }
+        fn drop(thread: *const ()) {
+            unsafe { Arc::from_raw(thread as *const thread::Thread) };
+        }
+        static VTABLE: RawWakerVTable = RawWakerVTable::new(clone, wake, wake_by_ref, drop);
+
+        let thread = Arc::into_raw(Arc::new(thread::current())) as *const ();
+        let waker = unsafe { Waker::from_raw(RawWaker::new(thread, &VTABLE)) };
+        let mut cx = Context::from_waker(&waker);
+        let mut future = Box::pin(future);
+        loop {
+            match future.as_mut().poll(&mut cx) {
+                Poll::Ready(output) => return output,
+                Poll::Pending => thread::park(),
+            }
+        }
+    }
+
+    #[test]
+    fn delegate_wakes_waiter() {
+        let waiter = Arc::new(Waiter::new(fake_loop()));
+        let delegate = {
+            let waiter = Arc::clone(&waiter);
+            thread::spawn(move || {
+                thread::sleep(Duration::from_millis(5));
+                waiter.complete("activated");
+            })
+        };
+
+        let start = Instant::now();
+        assert_eq!(waiter.wait(None), Some("activated"));
+        assert!(start.elapsed() < Duration::from_secs(1));
+        delegate.join().unwrap();
+    }
+
+    #[test]
+    fn completed_before_waiting() {
+        let waiter = Waiter::new(fake_loop());
+        waiter.complete(1);
+        waiter.complete(2);
+        assert_eq!(waiter.wait(Some(Instant::now())), Some(1));
+    }
+
+    #[test]
+    fn deadline_passes_without_delegate() {
+        let waiter = Waiter::<()>::new(fake_loop());
+        let deadline = Instant::now() + Duration::from_millis(20);
+        assert_eq!(waiter.wait(Some(deadline)), None);
+        assert!(Instant::now() >= deadline);
+    }
+
+    #[test]
+    fn delegate_wakes_future() {
+        let waiters: Vec<_> = (0..100).map(|_| Arc::new(Waiter::new_async())).collect();
+        let futures: Vec<_> = waiters.iter().cloned().map(WaitFuture::new).collect();
+        let delegate = thread::spawn(move || {
+            for (index, waiter) in waiters.iter().enumerate().rev() {
+                waiter.complete(index);
+            }
+        });
+
+        for (index, future) in futures.into_iter().enumerate() {
+            assert_eq!(block_on(future), Some(index));
+        }
+        assert_eq!(block_on(WaitFuture::<()>::ready()), None);
+        delegate.join().unwrap();
+    }
+}
@@ -1,3 +1,5 @@
+#![cfg(target_os = "macos")]
+
 use mac_notification_sys::*;
 
 #[test]
@@ -1,3 +1,5 @@
+#![cfg(target_os = "macos")]
+
 use chrono::offset::*;
 use mac_notification_sys::*;
 